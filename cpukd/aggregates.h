@@ -0,0 +1,258 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* per-subtree aggregates (point count, summed weight, bounding box)
+   for left-balanced trees, and count/sum/kernel-sum queries over a
+   fixed radius that use these aggregates to account for entire
+   subtrees at once, rather than enumerating each point within the
+   radius: a subtree whose box is entirely inside the query ball
+   contributes its aggregate, one entirely outside gets skipped, and
+   only subtrees straddling the ball's boundary get opened.
+
+   The aggregates are an optional, auxiliary array parallel to the
+   tree's nodes (aggregates[i] is the aggregate of subtree i), so the
+   tree itself stays the same, and can still be used with all other
+   traversals */
+
+#pragma once
+
+#include "cpukd/builder.h"
+#include "cpukd/bounds.h"
+#include "cpukd/fcp.h"
+#include "cpukd/parallel_for.h"
+
+namespace cpukd {
+
+  // ==================================================================
+  // INTERFACE SECTION
+  // ==================================================================
+
+  template<typename scalar_t, int numDims>
+  struct SubtreeAggregate {
+    /*! number of points in the subtree */
+    int      count;
+    /*! sum of all the subtree's points' weights */
+    scalar_t weightSum;
+    /*! bounding box of all the subtree's points */
+    Box<scalar_t,numDims> bounds;
+  };
+
+  /*! computes the aggregates of all N subtrees of the left-balanced
+      tree d_nodes, bottom-up (one tree level at a time, each level in
+      parallel); getWeight(point) returns the weight (eg, mass) of a
+      point, typically from its payload */
+  template<typename point_t, typename scalar_t, int numDims, typename GetWeight>
+  void computeAggregates(SubtreeAggregate<scalar_t,numDims> *d_aggregates,
+                         const point_t *d_nodes,
+                         int N,
+                         GetWeight &&getWeight);
+
+  /*! returns the number of points within 'radius' of the query
+      point; exact */
+  template<typename point_t, typename scalar_t, int numDims>
+  int countInRadius(point_t queryPoint,
+                    scalar_t radius,
+                    const point_t *d_nodes,
+                    const SubtreeAggregate<scalar_t,numDims> *d_aggregates,
+                    int N);
+
+  /*! returns the sum of the weights of all points within 'radius' of
+      the query point; exact, up to float rounding. getWeight must be
+      the same as the one the aggregates were computed with. */
+  template<typename point_t, typename scalar_t, int numDims, typename GetWeight>
+  scalar_t weightSumInRadius(point_t queryPoint,
+                             scalar_t radius,
+                             const point_t *d_nodes,
+                             const SubtreeAggregate<scalar_t,numDims> *d_aggregates,
+                             int N,
+                             GetWeight &&getWeight);
+
+  /*! returns sum_i weight_i * kernel(dist2_i) over all points within
+      'radius' of the query point, with dist2_i the squared distance
+      of point i. kernel(dist2) must be non-increasing in dist2 (as
+      are all usual SPH smoothing kernels), and is assumed zero
+      beyond 'radius'. Subtrees inside the ball over which the kernel
+      varies by no more than 2*maxKernelError get approximated by
+      their weight sum times the kernel's mid-range value, so for
+      non-negative weights the result is within maxKernelError times
+      the summed weight of all points in the ball of the exact value;
+      maxKernelError=0 computes the exact sum. */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename GetWeight, typename Kernel>
+  scalar_t kernelSum(point_t queryPoint,
+                     scalar_t radius,
+                     const point_t *d_nodes,
+                     const SubtreeAggregate<scalar_t,numDims> *d_aggregates,
+                     int N,
+                     GetWeight &&getWeight,
+                     Kernel &&kernel,
+                     scalar_t maxKernelError=scalar_t(0));
+
+  // ==================================================================
+  // IMPLEMENTATION SECTION
+  // ==================================================================
+
+  template<typename point_t, typename scalar_t, int numDims, typename GetWeight>
+  void computeAggregates(SubtreeAggregate<scalar_t,numDims> *d_aggregates,
+                         const point_t *d_nodes,
+                         int N,
+                         GetWeight &&getWeight)
+  {
+    if (N == 0) return;
+    for (int level=levelOf(N-1);level>=0;--level) {
+      const int levelBegin = (1<<level)-1;
+      const int levelEnd   = std::min(N,(2<<level)-1);
+      common::parallel_for_blocked
+        (levelBegin,levelEnd,1024,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++) {
+             const int n = (int)i;
+             SubtreeAggregate<scalar_t,numDims> &agg = d_aggregates[n];
+             agg.count     = subtreeSize(n,N);
+             agg.weightSum = getWeight(d_nodes[n]);
+             agg.bounds.setEmpty();
+             agg.bounds.extend((const scalar_t*)&d_nodes[n]);
+             for (int c : { lChild(n), rChild(n) })
+               if (c < N) {
+                 agg.weightSum += d_aggregates[c].weightSum;
+                 agg.bounds.extend(d_aggregates[c].bounds);
+               }
+           }
+         });
+    }
+  }
+
+  /*! generic aggregate-culling traversal: calls
+      processSubtree(node,minDist2,maxDist2) for each subtree that
+      processSubtree wants to take at once (by returning true;
+      minDist2/maxDist2 are the squared distance range from the query
+      to that subtree's box), and processPoint(node,dist2) for the
+      points of all nodes opened along the way. Subtrees entirely
+      outside the radius get skipped. */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename ProcessSubtree, typename ProcessPoint>
+  inline void aggregateTraversal(point_t queryPoint,
+                                 scalar_t radius,
+                                 const point_t *d_nodes,
+                                 const SubtreeAggregate<scalar_t,numDims> *d_aggregates,
+                                 int N,
+                                 ProcessSubtree &&processSubtree,
+                                 ProcessPoint   &&processPoint)
+  {
+    const scalar_t  radius2 = radius*radius;
+    const scalar_t *query   = (const scalar_t*)&queryPoint;
+
+    // each node pushes at most two children, and one gets popped
+    // right away, so stack depth is bounded by tree depth
+    int stack[64];
+    int stackPtr = 0;
+    if (N > 0) stack[stackPtr++] = 0;
+    while (stackPtr > 0) {
+      const int curr = stack[--stackPtr];
+      const scalar_t dist2
+        = sqrDistance<point_t,scalar_t,numDims>(queryPoint,d_nodes[curr]);
+      if (lChild(curr) >= N) {
+        // leaf: box is the point itself, no need to look at it
+        if (dist2 <= radius2)
+          processPoint(curr,dist2);
+        continue;
+      }
+
+      const Box<scalar_t,numDims> &bounds = d_aggregates[curr].bounds;
+      scalar_t minDist2, maxDist2;
+      sqrDistanceRangeToBox(query,bounds,minDist2,maxDist2);
+      if (minDist2 > radius2) continue;
+      if (processSubtree(curr,minDist2,maxDist2)) continue;
+
+      if (dist2 <= radius2)
+        processPoint(curr,dist2);
+      if (rChild(curr) < N) stack[stackPtr++] = rChild(curr);
+      if (lChild(curr) < N) stack[stackPtr++] = lChild(curr);
+    }
+  }
+
+  template<typename point_t, typename scalar_t, int numDims>
+  inline int countInRadius(point_t queryPoint,
+                           scalar_t radius,
+                           const point_t *d_nodes,
+                           const SubtreeAggregate<scalar_t,numDims> *d_aggregates,
+                           int N)
+  {
+    const scalar_t radius2 = radius*radius;
+    int count = 0;
+    aggregateTraversal<point_t,scalar_t,numDims>
+      (queryPoint,radius,d_nodes,d_aggregates,N,
+       [&](int node, scalar_t, scalar_t maxDist2) {
+         if (maxDist2 > radius2) return false;
+         count += d_aggregates[node].count;
+         return true;
+       },
+       [&](int, scalar_t) { ++count; });
+    return count;
+  }
+
+  template<typename point_t, typename scalar_t, int numDims, typename GetWeight>
+  inline scalar_t weightSumInRadius(point_t queryPoint,
+                                    scalar_t radius,
+                                    const point_t *d_nodes,
+                                    const SubtreeAggregate<scalar_t,numDims> *d_aggregates,
+                                    int N,
+                                    GetWeight &&getWeight)
+  {
+    const scalar_t radius2 = radius*radius;
+    scalar_t sum = scalar_t(0);
+    aggregateTraversal<point_t,scalar_t,numDims>
+      (queryPoint,radius,d_nodes,d_aggregates,N,
+       [&](int node, scalar_t, scalar_t maxDist2) {
+         if (maxDist2 > radius2) return false;
+         sum += d_aggregates[node].weightSum;
+         return true;
+       },
+       [&](int node, scalar_t) { sum += getWeight(d_nodes[node]); });
+    return sum;
+  }
+
+  template<typename point_t, typename scalar_t, int numDims,
+           typename GetWeight, typename Kernel>
+  inline scalar_t kernelSum(point_t queryPoint,
+                            scalar_t radius,
+                            const point_t *d_nodes,
+                            const SubtreeAggregate<scalar_t,numDims> *d_aggregates,
+                            int N,
+                            GetWeight &&getWeight,
+                            Kernel &&kernel,
+                            scalar_t maxKernelError)
+  {
+    const scalar_t radius2 = radius*radius;
+    scalar_t sum = scalar_t(0);
+    aggregateTraversal<point_t,scalar_t,numDims>
+      (queryPoint,radius,d_nodes,d_aggregates,N,
+       [&](int node, scalar_t minDist2, scalar_t maxDist2) {
+         // kernel range over this subtree's box; only subtrees fully
+         // inside the ball may be approximated, else a huge subtree
+         // that barely touches the ball could be, too
+         if (maxDist2 > radius2) return false;
+         const scalar_t kMax = kernel(minDist2);
+         const scalar_t kMin = kernel(maxDist2);
+         if (kMax - kMin > scalar_t(2)*maxKernelError) return false;
+         sum += d_aggregates[node].weightSum * scalar_t(0.5)*(kMin+kMax);
+         return true;
+       },
+       [&](int node, scalar_t dist2) { sum += getWeight(d_nodes[node])*kernel(dist2); });
+    return sum;
+  }
+
+} // ::cpukd
@@ -0,0 +1,130 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* all-points k-nearest-neighbor graph: for every point in a tree,
+   find its k nearest neighbors in that same tree */
+
+#pragma once
+
+#include "cpukd/knn.h"
+#include "cpukd/parallel_for.h"
+#include <vector>
+
+namespace cpukd {
+
+  // ==================================================================
+  // INTERFACE SECTION
+  // ==================================================================
+
+  /*! the k-nearest-neighbor graph, in CSR form: the neighbors of
+      point i are neighbors[offsets[i]..offsets[i+1]), sorted by
+      increasing distance, with dist2[] the squared distances to
+      those neighbors; all point IDs refer to the tree's d_nodes[]
+      array */
+  struct KNNGraph {
+    /*! N*k can exceed 2^31 for large N, so these are 64-bit */
+    std::vector<size_t> offsets;
+    std::vector<int>    neighbors;
+    std::vector<float>  dist2;
+  };
+
+  /*! computes the k nearest neighbors of each of the N points in
+      tree d_nodes (excluding each point itself, if excludeSelf is
+      set). Rather than querying points in array order, this queries
+      them in the tree's in-order sequence (where consecutive points
+      are spatially close), and seeds each query's search radius with
+      the previous query's k-th neighbor distance plus the distance
+      between the two points (which by the triangle inequality is
+      guaranteed to contain at least k points) */
+  template<typename point_t, typename scalar_t, int numDims, int k>
+  void allKNN(KNNGraph &graph,
+              const point_t *d_nodes,
+              int N,
+              bool excludeSelf=true);
+
+  // ==================================================================
+  // IMPLEMENTATION SECTION
+  // ==================================================================
+
+  /*! returns the in-order sequence of the nodes of a left-balanced
+      tree with N nodes */
+  inline std::vector<int> inOrderSequence(int N)
+  {
+    std::vector<int> sequence;
+    sequence.reserve(N);
+    int stack[40];
+    int stackPtr = 0;
+    int curr = 0;
+    while (curr < N || stackPtr > 0) {
+      while (curr < N) {
+        stack[stackPtr++] = curr;
+        curr = 2*curr+1;
+      }
+      curr = stack[--stackPtr];
+      sequence.push_back(curr);
+      curr = 2*curr+2;
+    }
+    return sequence;
+  }
+
+  template<typename point_t, typename scalar_t, int numDims, int k>
+  void allKNN(KNNGraph &graph,
+              const point_t *d_nodes,
+              int N,
+              bool excludeSelf)
+  {
+    const int numPerPoint = std::max(0,std::min(k,N-(excludeSelf?1:0)));
+    graph.offsets.resize(N+1);
+    for (int i=0;i<=N;i++)
+      graph.offsets[i] = size_t(i)*numPerPoint;
+    graph.neighbors.resize(size_t(N)*numPerPoint);
+    graph.dist2.resize(size_t(N)*numPerPoint);
+
+    const std::vector<int> sequence = inOrderSequence(N);
+    const float inf = std::numeric_limits<float>::infinity();
+    // pad the seeded radius a bit, so float rounding can never make
+    // it exclude the k-th neighbor
+    const float padding = 1.f+1e-5f;
+    common::parallel_for_blocked
+      (0,N,1024,
+       [&](size_t begin, size_t end) {
+         int   prev = -1;
+         float prevMaxDist = inf;
+         for (size_t j=begin;j<end;j++) {
+           const int curr = sequence[j];
+           const float seedRadius
+             = (prev < 0 || numPerPoint < k)
+             ? inf
+             : padding*(prevMaxDist+distance<point_t,scalar_t,numDims>(d_nodes[prev],d_nodes[curr]));
+           FixedCandidateList<k> result(seedRadius*seedRadius);
+           float maxRadius2 = excludeSelf
+             ? knn<point_t,scalar_t,numDims>
+               (result,d_nodes[curr],d_nodes,N,
+                [curr](int pointID, const point_t &) { return pointID != curr; })
+             : knn<point_t,scalar_t,numDims>(result,d_nodes[curr],d_nodes,N);
+           
+           const size_t ofs = graph.offsets[curr];
+           for (int i=0;i<numPerPoint;i++) {
+             graph.neighbors[ofs+i] = result.decode_pointID(result.entry[i]);
+             graph.dist2[ofs+i]     = result.decode_dist2(result.entry[i]);
+           }
+           prev = curr;
+           prevMaxDist = sqrtf(maxRadius2);
+         }
+       });
+  }
+
+} // ::cpukd
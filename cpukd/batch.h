@@ -0,0 +1,91 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* batched versions of the queries, parallelized over the queries
+   (using tbb if available) */
+
+#pragma once
+
+#include "cpukd/fcp.h"
+#include "cpukd/knn.h"
+#include "cpukd/parallel_for.h"
+
+namespace cpukd {
+
+  /*! runs fcp() for each of the numQueries d_queries[], and writes
+      the results into d_results[] */
+  template<typename point_t, typename scalar_t, int numDims>
+  void fcpBatch(int *d_results,
+                const point_t *d_queries,
+                int numQueries,
+                const point_t *d_nodes,
+                int N)
+  {
+    common::parallel_for_blocked
+      (0,numQueries,1024,
+       [&](size_t begin, size_t end) {
+         for (size_t i=begin;i<end;i++)
+           d_results[i] = fcp<point_t,scalar_t,numDims>(d_queries[i],d_nodes,N);
+       });
+  }
+
+  /*! runs fcpWithHint() for each of the numQueries d_queries[], using
+      d_hints[i] as hint for query i; typically, d_hints is the
+      d_results array of the previous frame. d_hints may be the same
+      array as d_results, in which case the results get updated in
+      place. */
+  template<typename point_t, typename scalar_t, int numDims>
+  void fcpBatchWithHints(int *d_results,
+                         const int *d_hints,
+                         const point_t *d_queries,
+                         int numQueries,
+                         const point_t *d_nodes,
+                         int N)
+  {
+    common::parallel_for_blocked
+      (0,numQueries,1024,
+       [&](size_t begin, size_t end) {
+         for (size_t i=begin;i<end;i++)
+           d_results[i] = fcpWithHint<point_t,scalar_t,numDims>(d_queries[i],d_hints[i],d_nodes,N);
+       });
+  }
+
+  /*! runs knnRuntimeK() for each of the numQueries d_queries[];
+      query i's results go to d_pointIDs[i*k..i*k+k) and (if non-null)
+      d_dist2[i*k..i*k+k). Candidate list storage gets allocated once
+      per block of queries, not per query. */
+  template<typename point_t, typename scalar_t, int numDims>
+  void knnBatch(int *d_pointIDs,
+                float *d_dist2,
+                int k,
+                const point_t *d_queries,
+                int numQueries,
+                const point_t *d_nodes,
+                int N,
+                float maxRadius=std::numeric_limits<float>::infinity())
+  {
+    common::parallel_for_blocked
+      (0,numQueries,1024,
+       [&](size_t begin, size_t end) {
+         std::vector<uint64_t> storage(runtimeKStorageSize(k));
+         for (size_t i=begin;i<end;i++)
+           knnRuntimeK<point_t,scalar_t,numDims>
+             (d_pointIDs+i*k,d_dist2 ? d_dist2+i*k : nullptr,k,storage.data(),
+              d_queries[i],d_nodes,N,maxRadius);
+       });
+  }
+
+} // ::cpukd
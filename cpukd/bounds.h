@@ -0,0 +1,136 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* per-subtree bounding boxes for left-balanced trees; these are
+   _optional_ auxiliary data (the trees themselves don't need them),
+   stored in an array parallel to the tree's nodes, ie, bounds[i] is
+   the bounding box of all points in the subtree rooted at node i */
+
+#pragma once
+
+#include "cpukd/common.h"
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace cpukd {
+
+  template<typename scalar_t, int numDims>
+  struct Box {
+    inline void setEmpty()
+    {
+      for (int d=0;d<numDims;d++) {
+        lower[d] = std::numeric_limits<scalar_t>::infinity();
+        upper[d] = -std::numeric_limits<scalar_t>::infinity();
+      }
+    }
+    inline void extend(const scalar_t *point)
+    {
+      for (int d=0;d<numDims;d++) {
+        lower[d] = std::min(lower[d],point[d]);
+        upper[d] = std::max(upper[d],point[d]);
+      }
+    }
+    inline void extend(const Box &other)
+    {
+      for (int d=0;d<numDims;d++) {
+        lower[d] = std::min(lower[d],other.lower[d]);
+        upper[d] = std::max(upper[d],other.upper[d]);
+      }
+    }
+    /*! squared length of the diagonal */
+    inline scalar_t sqrDiagonal() const
+    {
+      scalar_t sum = scalar_t(0);
+      for (int d=0;d<numDims;d++)
+        sum += (upper[d]-lower[d])*(upper[d]-lower[d]);
+      return sum;
+    }
+    
+    scalar_t lower[numDims];
+    scalar_t upper[numDims];
+  };
+
+  /*! squared distance from point to (closest point in) box */
+  template<typename scalar_t, int numDims>
+  inline scalar_t sqrDistanceToBox(const scalar_t *point, const Box<scalar_t,numDims> &box)
+  {
+    scalar_t sum = scalar_t(0);
+    for (int d=0;d<numDims;d++) {
+      const scalar_t gap
+        = std::max(scalar_t(0),std::max(box.lower[d]-point[d],point[d]-box.upper[d]));
+      sum += gap*gap;
+    }
+    return sum;
+  }
+
+  /*! squared distance from point to farthest point in box */
+  template<typename scalar_t, int numDims>
+  inline scalar_t sqrMaxDistanceToBox(const scalar_t *point, const Box<scalar_t,numDims> &box)
+  {
+    scalar_t sum = scalar_t(0);
+    for (int d=0;d<numDims;d++) {
+      const scalar_t gap = std::max(point[d]-box.lower[d],box.upper[d]-point[d]);
+      sum += gap*gap;
+    }
+    return sum;
+  }
+
+  /*! both of the above, in a single pass */
+  template<typename scalar_t, int numDims>
+  inline void sqrDistanceRangeToBox(const scalar_t *point, const Box<scalar_t,numDims> &box,
+                                    scalar_t &minDist2, scalar_t &maxDist2)
+  {
+    minDist2 = maxDist2 = scalar_t(0);
+    for (int d=0;d<numDims;d++) {
+      const scalar_t toLower = point[d]-box.lower[d];
+      const scalar_t toUpper = box.upper[d]-point[d];
+      const scalar_t gap = std::max(scalar_t(0),std::max(-toLower,-toUpper));
+      const scalar_t far = std::max(toLower,toUpper);
+      minDist2 += gap*gap;
+      maxDist2 += far*far;
+    }
+  }
+
+  /*! squared distance between the two closest points of two boxes */
+  template<typename scalar_t, int numDims>
+  inline scalar_t sqrDistanceBetween(const Box<scalar_t,numDims> &a, const Box<scalar_t,numDims> &b)
+  {
+    scalar_t sum = scalar_t(0);
+    for (int d=0;d<numDims;d++) {
+      const scalar_t gap
+        = std::max(scalar_t(0),std::max(a.lower[d]-b.upper[d],b.lower[d]-a.upper[d]));
+      sum += gap*gap;
+    }
+    return sum;
+  }
+
+  /*! computes the bounding box of each subtree of the left-balanced
+      tree d_nodes, bottom-up; bounds must have space for N boxes */
+  template<typename point_t, typename scalar_t, int numDims>
+  void computeSubtreeBounds(Box<scalar_t,numDims> *bounds,
+                            const point_t *d_nodes,
+                            int N)
+  {
+    for (int n=N-1;n>=0;--n) {
+      bounds[n].setEmpty();
+      bounds[n].extend((const scalar_t*)&d_nodes[n]);
+      if (2*n+1 < N) bounds[n].extend(bounds[2*n+1]);
+      if (2*n+2 < N) bounds[n].extend(bounds[2*n+2]);
+    }
+  }
+
+} // ::cpukd
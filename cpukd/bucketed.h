@@ -0,0 +1,210 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* kd-trees over buckets of points: instead of one point per node,
+   this builds a complete, balanced, binary tree (still pointer-free,
+   with implicit 2n+1/2n+2 indexing and round-robin split dimensions)
+   whose leaves are buckets of up to B points each. The inner nodes
+   only store their split plane's position; each bucket's points are
+   stored contiguously, and their coordinates additionally in
+   structure-of-arrays form, so a bucket can be scanned with
+   (auto-)vectorized distance computations instead of the last
+   few levels of serial, dependent traversal steps. */
+
+#pragma once
+
+#include "cpukd/builder.h"
+#include "cpukd/fcp.h"
+#include <stdint.h>
+
+namespace cpukd {
+  namespace bucketed {
+
+    // ==================================================================
+    // INTERFACE SECTION
+    // ==================================================================
+
+    /*! max number of points per bucket */
+    enum { maxBucketSize = 64 };
+
+    template<typename scalar_t, int numDims>
+    struct BucketTree {
+      /*! number of leaves is (1<<depth); inner nodes are 0..(1<<depth)-2 */
+      int depth     = 0;
+      int numPoints = 0;
+      /*! split plane positions of the (1<<depth)-1 inner nodes */
+      std::vector<scalar_t> splits;
+      /*! all points' coordinates, in bucket order, as
+          coords[dim*numPoints+pointID] */
+      std::vector<scalar_t> coords;
+
+      inline int numInnerNodes() const { return (1<<depth)-1; }
+      /*! index of first point in given bucket; bucket b's points are
+          [bucketBegin(b),bucketBegin(b+1)) */
+      inline int bucketBegin(int bucketID) const
+      { return int((int64_t(bucketID)*numPoints) >> depth); }
+    };
+
+    /*! builds a bucket tree with buckets of at most 'bucketSize'
+        (<=maxBucketSize) points over the given points; d_points gets
+        re-ordered into bucket order, and all point IDs returned by
+        the queries refer to that order. */
+    template<typename point_t,
+             typename scalar_t,
+             int      numDims=sizeof(point_t)/sizeof(scalar_t)>
+    void buildTree(BucketTree<scalar_t,numDims> &tree,
+                   point_t *d_points,
+                   int numPoints,
+                   int bucketSize=16);
+
+    /*! find-closest-point query on a bucket tree; returns the ID of
+        the closest point in the (re-ordered) d_points array the tree
+        was built over, or -1 if the tree is empty */
+    template<typename point_t, typename scalar_t, int numDims>
+    int fcp(point_t queryPoint,
+            const BucketTree<scalar_t,numDims> &tree,
+            int *numBucketsVisited=nullptr);
+
+    // ==================================================================
+    // IMPLEMENTATION SECTION
+    // ==================================================================
+
+    template<typename point_t,
+             typename scalar_t,
+             int      numDims>
+    void buildTree_rec(BucketTree<scalar_t,numDims> &tree,
+                       int node, int level, int firstBucket,
+                       point_t *d_points)
+    {
+      if (level == tree.depth) return;
+
+      // this subtree covers buckets [firstBucket,firstBucket+2^(depth-level))
+      const int numBuckets = 1<<(tree.depth-level);
+      const int begin = tree.bucketBegin(firstBucket);
+      const int mid   = tree.bucketBegin(firstBucket+numBuckets/2);
+      const int end   = tree.bucketBegin(firstBucket+numBuckets);
+      const int dim   = level % numDims;
+      std::nth_element(d_points+begin,d_points+mid,d_points+end,
+                       DimCompare<point_t,scalar_t,numDims>(d_points,dim));
+      tree.splits[node] = ((const scalar_t*)&d_points[mid])[dim];
+
+      buildTree_rec<point_t,scalar_t,numDims>
+        (tree,lChild(node),level+1,firstBucket,d_points);
+      buildTree_rec<point_t,scalar_t,numDims>
+        (tree,rChild(node),level+1,firstBucket+numBuckets/2,d_points);
+    }
+
+    template<typename point_t,
+             typename scalar_t,
+             int      numDims>
+    void buildTree(BucketTree<scalar_t,numDims> &tree,
+                   point_t *d_points,
+                   int numPoints,
+                   int bucketSize)
+    {
+      if (bucketSize < 1 || bucketSize > maxBucketSize)
+        throw std::runtime_error("bucketed::buildTree: invalid bucket size "
+                                 +std::to_string(bucketSize));
+      tree.numPoints = numPoints;
+      tree.depth = 0;
+      while ((int64_t(bucketSize) << tree.depth) < numPoints)
+        tree.depth++;
+      tree.splits.resize(tree.numInnerNodes());
+      buildTree_rec<point_t,scalar_t,numDims>
+        (tree,/*node*/0,/*level*/0,/*firstBucket*/0,d_points);
+
+      tree.coords.resize(size_t(numDims)*numPoints);
+      for (int i=0;i<numPoints;i++)
+        for (int d=0;d<numDims;d++)
+          tree.coords[size_t(d)*numPoints+i] = ((const scalar_t*)&d_points[i])[d];
+    }
+
+    /*! brute-force scan of one bucket; written such that the compiler
+        can vectorize over the bucket's points */
+    template<typename scalar_t, int numDims>
+    inline void scanBucket(const BucketTree<scalar_t,numDims> &tree,
+                           int bucketID,
+                           const scalar_t *query,
+                           int      &closest_found_so_far,
+                           scalar_t &closest_dist2_found_so_far)
+    {
+      const int begin = tree.bucketBegin(bucketID);
+      const int count = tree.bucketBegin(bucketID+1)-begin;
+
+      scalar_t dist2[maxBucketSize];
+      for (int i=0;i<count;i++)
+        dist2[i] = scalar_t(0);
+      for (int d=0;d<numDims;d++) {
+        const scalar_t *coords = tree.coords.data()+size_t(d)*tree.numPoints+begin;
+        const scalar_t  q = query[d];
+        for (int i=0;i<count;i++) {
+          const scalar_t diff = coords[i]-q;
+          dist2[i] += diff*diff;
+        }
+      }
+      for (int i=0;i<count;i++)
+        if (dist2[i] < closest_dist2_found_so_far) {
+          closest_dist2_found_so_far = dist2[i];
+          closest_found_so_far       = begin+i;
+        }
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    inline int fcp(point_t queryPoint,
+                   const BucketTree<scalar_t,numDims> &tree,
+                   int *numBucketsVisited)
+    {
+      if (tree.numPoints == 0) return -1;
+
+      const scalar_t *query = (const scalar_t*)&queryPoint;
+      const int numInner = tree.numInnerNodes();
+      int      closest_found_so_far = -1;
+      scalar_t closest_dist2_found_so_far = std::numeric_limits<scalar_t>::infinity();
+
+      std::pair<int,scalar_t> stack[40];
+      int stackPtr = 0;
+
+      int curr = 0;
+      while (1) {
+        // descend to close leaf, pushing far children on the way
+        for (int level=levelOf(curr); curr < numInner; level++) {
+          const int      curr_dim = level % numDims;
+          const scalar_t curr_dim_dist = query[curr_dim] - tree.splits[curr];
+          const int      curr_side = curr_dim_dist > scalar_t(0);
+          const scalar_t far_dist2 = curr_dim_dist*curr_dim_dist;
+          if (far_dist2 < closest_dist2_found_so_far)
+            stack[stackPtr++] = { 2*curr + 2 - curr_side, far_dist2 };
+          curr = 2*curr + 1 + curr_side;
+        }
+        if (numBucketsVisited) ++*numBucketsVisited;
+        scanBucket(tree,curr-numInner,query,
+                   closest_found_so_far,closest_dist2_found_so_far);
+
+        // pop next from stack ...
+        while (1) {
+          if (stackPtr == 0)
+            return closest_found_so_far;
+          -- stackPtr;
+          if (stack[stackPtr].second > closest_dist2_found_so_far)
+            continue;
+          curr = stack[stackPtr].first;
+          break;
+        }
+      }
+    }
+
+  } // ::cpukd::bucketed
+} // ::cpukd
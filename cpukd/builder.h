@@ -17,6 +17,7 @@
 #pragma once
 
 #include "cpukd/common.h"
+#include "cpukd/buildstats.h"
 #include <vector>
 #include <algorithm>
 
@@ -50,6 +51,31 @@ namespace cpukd {
            int      numDims=sizeof(point_t)/sizeof(scalar_t)>
   void buildTree(point_t *d_points, int numPoints);
 
+  /*! same as buildTree(), but rather than cycling through all
+      dimensions in round-robin order, tree level 'l' splits in
+      dimension splitDimOfLevel[l]; this array must have one entry for
+      each level of the tree (see, eg, highdim::chooseSplitDims()), and
+      traversals have to use the same array. If 'stats' is non-null,
+      the build gets recorded there (see cpukd/buildstats.h). */
+  template<typename point_t,
+           typename scalar_t,
+           int      numDims=sizeof(point_t)/sizeof(scalar_t)>
+  void buildTree(point_t *d_points, int numPoints,
+                 const int *splitDimOfLevel,
+                 BuildStats *stats=nullptr);
+
+  /*! same as buildTree(), but uses the caller-provided array
+      d_scratch (of at least numPoints elements) as temporary storage
+      rather than allocating its own; for building many trees in a
+      row (see, eg, segmented::buildTrees()) */
+  template<typename point_t,
+           typename scalar_t,
+           int      numDims=sizeof(point_t)/sizeof(scalar_t)>
+  void buildTreeWithScratch(point_t *d_points, int numPoints,
+                            point_t *d_scratch,
+                            const int *splitDimOfLevel=nullptr,
+                            BuildStats *stats=nullptr);
+
   // ==================================================================
   // IMPLEMENTATION SECTION
   // ==================================================================
@@ -91,38 +117,83 @@ namespace cpukd {
                  int begin, int end,
                  point_t *d_points,
                  point_t *d_array,
-                 int numPoints)
+                 int numPoints,
+                 const int *splitDimOfLevel=nullptr,
+                 BuildStats::TreeRecorder *recorder=nullptr)
   {
     if (tgt >= numPoints) return;
     
     if (end - begin == 1) {
       d_points[tgt] = d_array[begin];
+      if (recorder) recorder->leaf(level,sizeof(point_t));
       return;
     }
 
-    int dim = level % numDims;
+    int dim = splitDimOfLevel ? splitDimOfLevel[level] : (level % numDims);
+    const double sortBegin = recorder ? recorder->now() : 0.;
     std::sort(d_array+begin,d_array+end,
               DimCompare<point_t,scalar_t,numDims>(d_array,dim));
     int pivot = begin+subtreeSize(lChild(tgt),numPoints);
     d_points[tgt] = d_array[pivot];
+    if (recorder) recorder->node(tgt,level,sortBegin,(end-begin)*sizeof(point_t));
     buildTree_rec<point_t,scalar_t,numDims>
-      (lChild(tgt),level+1,begin,pivot,d_points,d_array,numPoints);
+      (lChild(tgt),level+1,begin,pivot,d_points,d_array,numPoints,splitDimOfLevel,recorder);
     buildTree_rec<point_t,scalar_t,numDims>
-      (rChild(tgt),level+1,pivot+1,end,d_points,d_array,numPoints);
+      (rChild(tgt),level+1,pivot+1,end,d_points,d_array,numPoints,splitDimOfLevel,recorder);
   }
 
   template<typename point_t,
            typename scalar_t,
            int      numDims>
-  void buildTree(point_t *d_points,
-                 int numPoints)
+  void buildTreeWithScratch(point_t *d_points,
+                            int numPoints,
+                            point_t *d_scratch,
+                            const int *splitDimOfLevel,
+                            BuildStats *stats)
   {
-    std::vector<point_t> tmpArray(numPoints);
-    std::copy(d_points,d_points+numPoints,tmpArray.data());
+    if (!stats) {
+      std::copy(d_points,d_points+numPoints,d_scratch);
+      buildTree_rec<point_t,scalar_t,numDims>
+        (/* target node: */0, /* level */ 0,
+         /* range */0,numPoints,
+         d_points,d_scratch,numPoints,
+         splitDimOfLevel);
+      return;
+    }
+
+    BuildStats::TreeRecorder recorder(stats);
+    std::copy(d_points,d_points+numPoints,d_scratch);
+    recorder.copied(recorder.begin,numPoints*sizeof(point_t));
     buildTree_rec<point_t,scalar_t,numDims>
       (/* target node: */0, /* level */ 0,
        /* range */0,numPoints,
-       d_points,tmpArray.data(),numPoints);
+       d_points,d_scratch,numPoints,
+       splitDimOfLevel,&recorder);
+    recorder.finish("buildTree");
   }
-}
 
+  template<typename point_t,
+           typename scalar_t,
+           int      numDims>
+  void buildTree(point_t *d_points,
+                 int numPoints,
+                 const int *splitDimOfLevel,
+                 BuildStats *stats)
+  {
+    std::vector<point_t> tmpArray(numPoints);
+    if (stats) stats->allocatedScratch(numPoints*sizeof(point_t));
+    buildTreeWithScratch<point_t,scalar_t,numDims>
+      (d_points,numPoints,tmpArray.data(),splitDimOfLevel,stats);
+    if (stats) stats->freedScratch(numPoints*sizeof(point_t));
+  }
+
+  template<typename point_t,
+           typename scalar_t,
+           int      numDims>
+  void buildTree(point_t *d_points,
+                 int numPoints)
+  {
+    buildTree<point_t,scalar_t,numDims>
+      (d_points,numPoints,/* round-robin: */(const int *)nullptr);
+  }
+}
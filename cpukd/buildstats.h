@@ -0,0 +1,325 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* optional statistics sink for the builders: if a BuildStats is
+   passed to buildTree() (or segmented::buildTrees(),
+   sharded::ShardedForest::build()), the builder records time and bytes
+   moved per tree level, scratch allocations, memory high-water marks,
+   and each thread's busy time, which can then be written out as JSON,
+   or as a Chrome trace (chrome://tracing, or ui.perfetto.dev). With
+   no BuildStats passed (the default) the builders do not read any
+   clocks nor record anything; all they do is test a null pointer. */
+
+#pragma once
+
+#include "cpukd/common.h"
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace cpukd {
+
+  // ==================================================================
+  // INTERFACE SECTION
+  // ==================================================================
+
+  struct BuildStats {
+    /*! nodes on tree levels below this get their own trace event
+        (if they took at least minTracedSeconds); all others only show
+        up in the per-level totals */
+    enum { maxTracedLevel = 6 };
+    static constexpr double minTracedSeconds = 50e-6;
+
+    struct Level {
+      /*! number of nodes built on this level */
+      size_t numNodes   = 0;
+      /*! time spent sorting/partitioning this level's subtrees */
+      double seconds    = 0.;
+      /*! bytes of all point ranges sorted on this level */
+      size_t bytesMoved = 0;
+    };
+
+    struct Event {
+      std::string name;
+      int         threadID;
+      /*! in seconds, relative to construction of the BuildStats */
+      double      begin, end;
+    };
+
+    /*! records one single tree build (on one thread), and adds it to
+        the BuildStats once done; used by the builders */
+    struct TreeRecorder {
+      TreeRecorder(BuildStats *stats) : stats(stats), begin(stats->now()) {}
+      inline double now() const { return stats->now(); }
+      inline void copied(double copyBegin, size_t bytes);
+      inline void node(int nodeID, int level, double sortBegin, size_t bytes);
+      inline void leaf(int level, size_t bytes);
+      /*! adds everything recorded so far to the stats, as one task
+          called 'name' */
+      void finish(const char *name);
+
+      BuildStats *const  stats;
+      const double       begin;
+      std::vector<Level> levels;
+      std::vector<Event> events;
+      double             copySeconds = 0.;
+      size_t             copyBytes   = 0;
+    };
+
+    BuildStats() : t0(std::chrono::steady_clock::now()) {}
+
+    /*! seconds since this BuildStats was created */
+    inline double now() const
+    { return std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count(); }
+
+    /*! time from the first recorded task's begin to the last one's end */
+    double wallSeconds() const;
+    /*! sum of all threads' busy times, over (number of threads times
+        wallSeconds()); 1 means all threads were busy all the time */
+    double threadUtilization() const;
+
+    void writeJSON(std::ostream &out) const;
+    void writeChromeTrace(std::ostream &out) const;
+    void saveJSON(const std::string &fileName) const;
+    void saveChromeTrace(const std::string &fileName) const;
+
+    /*! the following are called by the builders (all thread-safe) */
+    int  currentThreadID();
+    /*! a task (other than a tree build) that ran on the calling
+        thread, from begin to end; counts as that thread's busy time */
+    void addTask(const std::string &name, double begin, double end);
+    void allocatedScratch(size_t bytes);
+    void freedScratch(size_t bytes);
+
+    std::vector<Level>  levels;
+    /*! copying input points to scratch memory, before sorting */
+    double              copySeconds = 0.;
+    size_t              copyBytes   = 0;
+    size_t              numScratchAllocations = 0;
+    size_t              scratchBytesAllocated = 0;
+    /*! max scratch memory of all builders alive at the same time */
+    size_t              peakScratchBytes      = 0;
+    /*! process' peak resident set size (all memory, not just the
+        builder's), as of the end of the last recorded task; 0 where
+        not available */
+    size_t              peakResidentBytes     = 0;
+    /*! per-thread (see Event::threadID) sum of recorded task times */
+    std::vector<double> threadBusySeconds;
+    std::vector<Event>  events;
+
+  private:
+    mutable std::mutex                    mutex;
+    std::map<std::thread::id,int>         threadIDs;
+    const std::chrono::steady_clock::time_point t0;
+    size_t                                liveScratchBytes = 0;
+  };
+
+  // ==================================================================
+  // IMPLEMENTATION SECTION
+  // ==================================================================
+
+  inline void BuildStats::TreeRecorder::copied(double copyBegin, size_t bytes)
+  {
+    copySeconds += now()-copyBegin;
+    copyBytes   += bytes;
+  }
+
+  inline void BuildStats::TreeRecorder::node(int nodeID, int level, double sortBegin, size_t bytes)
+  {
+    const double sortEnd = now();
+    if ((int)levels.size() <= level) levels.resize(level+1);
+    levels[level].numNodes++;
+    levels[level].seconds    += sortEnd-sortBegin;
+    levels[level].bytesMoved += bytes;
+    if (level < maxTracedLevel && sortEnd-sortBegin >= minTracedSeconds)
+      events.push_back({"level "+std::to_string(level)+" node "+std::to_string(nodeID),
+                        -1,sortBegin,sortEnd});
+  }
+
+  inline void BuildStats::TreeRecorder::leaf(int level, size_t bytes)
+  {
+    if ((int)levels.size() <= level) levels.resize(level+1);
+    levels[level].numNodes++;
+    levels[level].bytesMoved += bytes;
+  }
+
+  inline void BuildStats::TreeRecorder::finish(const char *name)
+  {
+    const double end = now();
+    const int threadID = stats->currentThreadID();
+#ifndef _WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF,&usage);
+# ifdef __APPLE__
+    const size_t peakResident = size_t(usage.ru_maxrss);
+# else
+    const size_t peakResident = size_t(usage.ru_maxrss)*1024;
+# endif
+#else
+    const size_t peakResident = 0;
+#endif
+
+    std::lock_guard<std::mutex> lock(stats->mutex);
+    if (stats->levels.size() < levels.size()) stats->levels.resize(levels.size());
+    for (size_t i=0;i<levels.size();i++) {
+      stats->levels[i].numNodes   += levels[i].numNodes;
+      stats->levels[i].seconds    += levels[i].seconds;
+      stats->levels[i].bytesMoved += levels[i].bytesMoved;
+    }
+    stats->copySeconds += copySeconds;
+    stats->copyBytes   += copyBytes;
+    stats->peakResidentBytes = std::max(stats->peakResidentBytes,peakResident);
+    stats->threadBusySeconds[threadID] += end-begin;
+    stats->events.push_back({name,threadID,begin,end});
+    for (auto &event : events) {
+      event.threadID = threadID;
+      stats->events.push_back(event);
+    }
+  }
+
+  inline int BuildStats::currentThreadID()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = threadIDs.find(std::this_thread::get_id());
+    if (it != threadIDs.end()) return it->second;
+    const int threadID = (int)threadIDs.size();
+    threadIDs[std::this_thread::get_id()] = threadID;
+    threadBusySeconds.push_back(0.);
+    return threadID;
+  }
+
+  inline void BuildStats::addTask(const std::string &name, double begin, double end)
+  {
+    const int threadID = currentThreadID();
+    std::lock_guard<std::mutex> lock(mutex);
+    threadBusySeconds[threadID] += end-begin;
+    events.push_back({name,threadID,begin,end});
+  }
+
+  inline void BuildStats::allocatedScratch(size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    numScratchAllocations++;
+    scratchBytesAllocated += bytes;
+    liveScratchBytes      += bytes;
+    peakScratchBytes = std::max(peakScratchBytes,liveScratchBytes);
+  }
+
+  inline void BuildStats::freedScratch(size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    liveScratchBytes -= bytes;
+  }
+
+  inline double BuildStats::wallSeconds() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.empty()) return 0.;
+    double begin = events[0].begin, end = events[0].end;
+    for (auto &event : events) {
+      begin = std::min(begin,event.begin);
+      end   = std::max(end,event.end);
+    }
+    return end-begin;
+  }
+
+  inline double BuildStats::threadUtilization() const
+  {
+    const double wall = wallSeconds();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (wall <= 0. || threadBusySeconds.empty()) return 0.;
+    double busy = 0.;
+    for (double b : threadBusySeconds) busy += b;
+    return busy/(wall*threadBusySeconds.size());
+  }
+
+  /*! event names are ours, but be safe anyway */
+  inline std::string jsonEscape(const std::string &s)
+  {
+    std::string escaped;
+    for (char c : s) {
+      if (c == '"' || c == '\\') escaped += '\\';
+      if ((unsigned char)c >= 0x20) escaped += c;
+    }
+    return escaped;
+  }
+
+  inline void BuildStats::writeJSON(std::ostream &out) const
+  {
+    const double wall = wallSeconds();
+    const double utilization = threadUtilization();
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "{\n";
+    out << "  \"wallSeconds\": " << wall << ",\n";
+    out << "  \"copySeconds\": " << copySeconds << ",\n";
+    out << "  \"copyBytes\": " << copyBytes << ",\n";
+    out << "  \"levels\": [";
+    for (size_t i=0;i<levels.size();i++)
+      out << (i ? ",\n" : "\n")
+          << "    { \"level\": " << i
+          << ", \"numNodes\": " << levels[i].numNodes
+          << ", \"seconds\": " << levels[i].seconds
+          << ", \"bytesMoved\": " << levels[i].bytesMoved << " }";
+    out << "\n  ],\n";
+    out << "  \"numScratchAllocations\": " << numScratchAllocations << ",\n";
+    out << "  \"scratchBytesAllocated\": " << scratchBytesAllocated << ",\n";
+    out << "  \"peakScratchBytes\": " << peakScratchBytes << ",\n";
+    out << "  \"peakResidentBytes\": " << peakResidentBytes << ",\n";
+    out << "  \"threadBusySeconds\": [";
+    for (size_t i=0;i<threadBusySeconds.size();i++)
+      out << (i ? ", " : " ") << threadBusySeconds[i];
+    out << " ],\n";
+    out << "  \"threadUtilization\": " << utilization << "\n";
+    out << "}\n";
+  }
+
+  inline void BuildStats::writeChromeTrace(std::ostream &out) const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    // "complete" events, with timestamps in microseconds
+    out << "{ \"traceEvents\": [";
+    for (size_t i=0;i<events.size();i++)
+      out << (i ? ",\n" : "\n")
+          << "  { \"name\": \"" << jsonEscape(events[i].name) << "\", \"ph\": \"X\""
+          << ", \"pid\": 0, \"tid\": " << events[i].threadID
+          << ", \"ts\": " << events[i].begin*1e6
+          << ", \"dur\": " << (events[i].end-events[i].begin)*1e6 << " }";
+    out << "\n] }\n";
+  }
+
+  inline void BuildStats::saveJSON(const std::string &fileName) const
+  {
+    std::ofstream out(fileName);
+    writeJSON(out);
+    if (!out.good())
+      throw std::runtime_error("BuildStats: error writing '"+fileName+"'");
+  }
+
+  inline void BuildStats::saveChromeTrace(const std::string &fileName) const
+  {
+    std::ofstream out(fileName);
+    writeChromeTrace(out);
+    if (!out.good())
+      throw std::runtime_error("BuildStats: error writing '"+fileName+"'");
+  }
+
+} // ::cpukd
@@ -0,0 +1,157 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* incremental nearest-neighbor cursor: returns the points of a
+   left-balanced tree one at a time, in order of increasing distance
+   to the query point, for callers that don't know up front how many
+   neighbors they need. Each call to next() only does as much
+   traversal as is needed to be sure which point is next.
+
+   The cursor keeps a single min-priority queue of both subtrees (keyed
+   by a lower bound of their distance) and points (keyed by their
+   exact distance): a point at the top of the queue is closer than
+   anything still in there. Popping a subtree walks down its path of
+   close children, pushing each node's point, and each far child
+   with its split plane distance as lower bound. The queue's storage
+   is kept across reset()s, so a cursor that gets reused for many
+   queries doesn't allocate once it has warmed up. */
+
+#pragma once
+
+#include "cpukd/builder.h"
+#include "cpukd/fcp.h"
+#include "cpukd/knn.h"
+#include <stdint.h>
+#include <functional>
+
+namespace cpukd {
+
+  // ==================================================================
+  // INTERFACE SECTION
+  // ==================================================================
+
+  template<typename point_t, typename scalar_t, int numDims>
+  class NeighborCursor {
+  public:
+    /*! largest N a cursor can handle, since the queue entries only
+        have 31 bits for the node ID (see encode()) */
+    enum { maxNumPoints = 1<<30 };
+
+    /*! throws if N is larger than maxNumPoints */
+    NeighborCursor(const point_t *d_nodes, int N);
+
+    /*! starts over with a new query; only points within maxRadius
+        will be returned */
+    void reset(point_t queryPoint,
+               float maxRadius=std::numeric_limits<float>::infinity());
+
+    /*! returns the ID of the next-closest point (and, if non-null,
+        its squared distance in dist2), or -1 once all points (within
+        maxRadius) have been returned */
+    int next(float *dist2=nullptr);
+
+  private:
+    /*! same encoding as the knn candidate lists, with (node,isPoint)
+        in the lower 32 bits */
+    inline uint64_t encode(float dist2, int node, bool isPoint)
+    { return (uint64_t(float_as_uint(dist2)) << 32) | (uint32_t(node) << 1) | uint32_t(isPoint); }
+    inline void push(uint64_t entry);
+    /*! walks down the close-child path from 'node', whose subtree is
+        at least lowerBound2 away from the query */
+    inline void expand(int node, float lowerBound2);
+
+    const point_t *const  d_nodes;
+    const int             N;
+    point_t               queryPoint;
+    float                 maxRadius2;
+    std::vector<uint64_t> queue;
+  };
+
+  // ==================================================================
+  // IMPLEMENTATION SECTION
+  // ==================================================================
+
+  template<typename point_t, typename scalar_t, int numDims>
+  NeighborCursor<point_t,scalar_t,numDims>::NeighborCursor(const point_t *d_nodes, int N)
+    : d_nodes(d_nodes), N(N)
+  {
+    if (N > maxNumPoints)
+      throw std::runtime_error("NeighborCursor: can't handle more than "
+                               +std::to_string(int(maxNumPoints))+" points");
+  }
+
+  template<typename point_t, typename scalar_t, int numDims>
+  void NeighborCursor<point_t,scalar_t,numDims>::reset(point_t queryPoint,
+                                                       float maxRadius)
+  {
+    this->queryPoint = queryPoint;
+    this->maxRadius2 = maxRadius*maxRadius;
+    // clear() keeps the capacity
+    queue.clear();
+    if (N > 0) push(encode(0.f,0,false));
+  }
+
+  template<typename point_t, typename scalar_t, int numDims>
+  inline void NeighborCursor<point_t,scalar_t,numDims>::push(uint64_t entry)
+  {
+    queue.push_back(entry);
+    std::push_heap(queue.begin(),queue.end(),std::greater<uint64_t>());
+  }
+
+  template<typename point_t, typename scalar_t, int numDims>
+  inline void NeighborCursor<point_t,scalar_t,numDims>::expand(int node, float lowerBound2)
+  {
+    const scalar_t *query = (const scalar_t*)&queryPoint;
+    while (node < N) {
+      const point_t &curr_node = d_nodes[node];
+      const float dist2 = (float)sqrDistance<point_t,scalar_t,numDims>(queryPoint,curr_node);
+      if (dist2 <= maxRadius2)
+        push(encode(dist2,node,true));
+
+      const int      curr_dim = levelOf(node) % numDims;
+      const scalar_t curr_dim_dist = query[curr_dim] - ((const scalar_t*)&curr_node)[curr_dim];
+      const int      curr_side = curr_dim_dist > scalar_t(0);
+      const int      curr_close_child = 2*node + 1 + curr_side;
+      const int      curr_far_child   = 2*node + 2 - curr_side;
+
+      const float farBound2 = std::max(lowerBound2,float(curr_dim_dist*curr_dim_dist));
+      if (curr_far_child < N && farBound2 <= maxRadius2)
+        push(encode(farBound2,curr_far_child,false));
+      node = curr_close_child;
+    }
+  }
+
+  template<typename point_t, typename scalar_t, int numDims>
+  int NeighborCursor<point_t,scalar_t,numDims>::next(float *dist2)
+  {
+    while (!queue.empty()) {
+      std::pop_heap(queue.begin(),queue.end(),std::greater<uint64_t>());
+      const uint64_t top = queue.back();
+      queue.pop_back();
+
+      const float topDist2 = uint_as_float(uint32_t(top >> 32));
+      const int   node     = int(uint32_t(top) >> 1);
+      if (top & 1) {
+        // a point that's no farther than any remaining point or subtree
+        if (dist2) *dist2 = topDist2;
+        return node;
+      }
+      expand(node,topDist2);
+    }
+    return -1;
+  }
+
+} // ::cpukd
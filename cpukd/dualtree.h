@@ -0,0 +1,405 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* dual-tree joins between two point sets: rather than running one
+   single-tree query per query point, this builds a (regular,
+   left-balanced) tree over the queries, too, and then traverses pairs
+   of (query subtree, reference subtree), culling entire pairs by the
+   distance between their subtrees' bounding boxes (see bounds.h).
+
+   Since nodes of a left-balanced tree store a point of their own, a
+   pair (Q,R) of subtrees gets split either as
+
+   {q} x R  +  Q.left x R  +  Q.right x R     ("split the query side"), or
+   Q x {r}  +  Q x R.left  +  Q x R.right     ("split the reference side"),
+
+   where {q} x R is a regular single-tree query restricted to subtree
+   R, and Q x {r} updates all queries in Q (that can still be
+   affected) with a single reference point. Parallelization is over
+   the query subtrees of one of the top levels, each of which only
+   ever touches its own queries' results. */
+
+#pragma once
+
+#include "cpukd/fcp.h"
+#include "cpukd/bounds.h"
+#include "cpukd/parallel_for.h"
+
+namespace cpukd {
+  namespace dualtree {
+
+    // ==================================================================
+    // INTERFACE SECTION
+    // ==================================================================
+
+    /*! for each of the numQueries points in the left-balanced tree
+        d_queryNodes (ie, built with buildTree()), finds the closest
+        point in the left-balanced tree d_refNodes, and writes its
+        index into d_results[] (d_results[i] is the result for
+        d_queryNodes[i], or -1 if the reference tree is empty) */
+    template<typename point_t, typename scalar_t, int numDims>
+    void fcpJoin(int *d_results,
+                 const point_t *d_queryNodes,
+                 int numQueries,
+                 const point_t *d_refNodes,
+                 int numRefs);
+
+    /*! fixed-radius join: calls processPair(queryID,refID,dist2) for
+        each pair of a query in d_queryNodes and a reference point in
+        d_refNodes that are within 'radius' of each other (both
+        trees built with buildTree()). processPair gets called from
+        multiple threads concurrently, but all calls for a given
+        queryID come from the same thread. Returns the number of pairs
+        found. */
+    template<typename point_t, typename scalar_t, int numDims, typename ProcessPair>
+    size_t radiusJoin(scalar_t radius,
+                      const point_t *d_queryNodes,
+                      int numQueries,
+                      const point_t *d_refNodes,
+                      int numRefs,
+                      ProcessPair &&processPair);
+
+    // ==================================================================
+    // IMPLEMENTATION SECTION
+    // ==================================================================
+
+    /*! the level whose query subtrees become the parallel tasks; the
+        (few) query nodes above that level get processed with plain
+        single-tree queries */
+    inline int taskLevel(int numQueries)
+    {
+      return numQueries > 0 ? std::min(6,levelOf(numQueries-1)) : 0;
+    }
+
+    /*! decides whether to split the reference side of a node pair
+        (else, the query side): split the reference side only once its
+        box is sufficiently larger than the query box (with
+        'sqrRatio' the threshold for the ratio of squared diagonals),
+        since every reference split has to touch all (not yet culled)
+        queries in the query subtree */
+    template<typename scalar_t, int numDims>
+    inline bool splitRefSide(int q, int numQueries, const Box<scalar_t,numDims> &qBounds,
+                             int r, int numRefs,    const Box<scalar_t,numDims> &rBounds,
+                             scalar_t sqrRatio)
+    {
+      if (lChild(r) >= numRefs)    return false;
+      if (lChild(q) >= numQueries) return true;
+      return rBounds.sqrDiagonal() >= sqrRatio*qBounds.sqrDiagonal();
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    struct FCPJoin {
+      /*! single-tree query for query point q, restricted to
+          subtree r, and starting with the query's current result */
+      void pointVsSubtree(int q, int r)
+      {
+        const point_t &queryPoint = queryNodes[q];
+        int      closest_found_so_far      = results[q];
+        scalar_t closest_dist2_found_so_far = bestDist2[q];
+
+        std::pair<int,scalar_t> stack[40];
+        int stackPtr = 0;
+
+        int curr = r;
+        while (1) {
+          while (curr < numRefs) {
+            const auto &curr_node = refNodes[curr];
+            const scalar_t dist2
+              = sqrDistance<point_t,scalar_t,numDims>(queryPoint,curr_node);
+            if (dist2 < closest_dist2_found_so_far) {
+              closest_dist2_found_so_far = dist2;
+              closest_found_so_far       = curr;
+            }
+            const int      curr_dim = levelOf(curr) % numDims;
+            const scalar_t curr_dim_dist
+              = ((const scalar_t*)&queryPoint)[curr_dim]
+              - ((const scalar_t*)&curr_node)[curr_dim];
+            const int      curr_side = curr_dim_dist > scalar_t(0);
+            const scalar_t far_dist2 = curr_dim_dist*curr_dim_dist;
+            if (far_dist2 < closest_dist2_found_so_far)
+              stack[stackPtr++] = { 2*curr + 2 - curr_side, far_dist2 };
+            curr = 2*curr + 1 + curr_side;
+          }
+          while (1) {
+            if (stackPtr == 0) {
+              results[q]   = closest_found_so_far;
+              bestDist2[q] = closest_dist2_found_so_far;
+              return;
+            }
+            -- stackPtr;
+            if (stack[stackPtr].second >= closest_dist2_found_so_far)
+              continue;
+            curr = stack[stackPtr].first;
+            break;
+          }
+        }
+      }
+
+      /*! initial result for query q: closest point on the path
+          from the root to the query's leaf, without any backtracking */
+      void seed(int q)
+      {
+        const point_t &queryPoint = queryNodes[q];
+        int curr = 0;
+        while (curr < numRefs) {
+          const auto &curr_node = refNodes[curr];
+          const scalar_t dist2
+            = sqrDistance<point_t,scalar_t,numDims>(queryPoint,curr_node);
+          if (dist2 < bestDist2[q]) {
+            bestDist2[q] = dist2;
+            results[q]   = curr;
+          }
+          const int curr_dim = levelOf(curr) % numDims;
+          curr = 2*curr + 1
+            + (((const scalar_t*)&queryPoint)[curr_dim] > ((const scalar_t*)&curr_node)[curr_dim]);
+        }
+      }
+
+      /*! (re-)computes the max result distance over subtree q */
+      inline void updateBound(int q)
+      {
+        scalar_t bound = bestDist2[q];
+        if (lChild(q) < numQueries) bound = std::max(bound,queryBound[lChild(q)]);
+        if (rChild(q) < numQueries) bound = std::max(bound,queryBound[rChild(q)]);
+        queryBound[q] = bound;
+      }
+
+      /*! updates all queries in subtree q with reference point r */
+      void refPointVsSubtree(int r, int q)
+      {
+        if (q >= numQueries) return;
+        const scalar_t *refPoint = (const scalar_t*)&refNodes[r];
+        if (sqrDistanceToBox(refPoint,queryBounds[q]) >= queryBound[q]) return;
+
+        const scalar_t dist2
+          = sqrDistance<point_t,scalar_t,numDims>(queryNodes[q],refNodes[r]);
+        if (dist2 < bestDist2[q]) {
+          bestDist2[q] = dist2;
+          results[q]   = r;
+        }
+        refPointVsSubtree(r,lChild(q));
+        refPointVsSubtree(r,rChild(q));
+        updateBound(q);
+      }
+
+      void traverse(int q, int r)
+      {
+        if (q >= numQueries || r >= numRefs) return;
+        if (sqrDistanceBetween(queryBounds[q],refBounds[r]) >= queryBound[q]) return;
+
+        if (splitRefSide(q,numQueries,queryBounds[q],r,numRefs,refBounds[r],scalar_t(64))) {
+          refPointVsSubtree(r,q);
+          // visit closer child first, so the bounds shrink sooner
+          int near = lChild(r), far = rChild(r);
+          if (far < numRefs &&
+              sqrDistanceBetween(queryBounds[q],refBounds[far])
+              < sqrDistanceBetween(queryBounds[q],refBounds[near]))
+            std::swap(near,far);
+          traverse(q,near);
+          traverse(q,far);
+        } else {
+          pointVsSubtree(q,r);
+          traverse(lChild(q),r);
+          traverse(rChild(q),r);
+          updateBound(q);
+        }
+      }
+
+      const point_t *queryNodes;
+      int            numQueries;
+      const Box<scalar_t,numDims> *queryBounds;
+      const point_t *refNodes;
+      int            numRefs;
+      const Box<scalar_t,numDims> *refBounds;
+      int           *results;
+      /*! current result distance of each query */
+      scalar_t      *bestDist2;
+      /*! max bestDist2 over each query subtree */
+      scalar_t      *queryBound;
+    };
+
+    template<typename point_t, typename scalar_t, int numDims>
+    void fcpJoin(int *d_results,
+                 const point_t *d_queryNodes,
+                 int numQueries,
+                 const point_t *d_refNodes,
+                 int numRefs)
+    {
+      std::vector<Box<scalar_t,numDims>> queryBounds(numQueries);
+      std::vector<Box<scalar_t,numDims>> refBounds(numRefs);
+      computeSubtreeBounds<point_t,scalar_t,numDims>(queryBounds.data(),d_queryNodes,numQueries);
+      computeSubtreeBounds<point_t,scalar_t,numDims>(refBounds.data(),d_refNodes,numRefs);
+      std::vector<scalar_t> bestDist2(numQueries,std::numeric_limits<scalar_t>::infinity());
+      std::vector<scalar_t> queryBound(numQueries,std::numeric_limits<scalar_t>::infinity());
+      for (int i=0;i<numQueries;i++) d_results[i] = -1;
+      if (numRefs == 0) return;
+
+      FCPJoin<point_t,scalar_t,numDims> join
+        = { d_queryNodes,numQueries,queryBounds.data(),
+            d_refNodes,numRefs,refBounds.data(),
+            d_results,bestDist2.data(),queryBound.data() };
+
+      // without initial results, all query bounds would be infinite,
+      // and the first reference splits would have to visit _all_
+      // queries; so give each query a cheap (but finite) seed first
+      common::parallel_for_blocked
+        (0,numQueries,1024,
+         [&](size_t begin, size_t end) {
+           for (size_t q=begin;q<end;q++)
+             join.seed((int)q);
+         });
+      for (int q=numQueries-1;q>=0;--q)
+        join.updateBound(q);
+
+      const int level      = taskLevel(numQueries);
+      const int firstTask  = (1<<level)-1;
+      const int numTasks   = 1<<level;
+      common::parallel_for_blocked
+        (0,firstTask,16,
+         [&](size_t begin, size_t end) {
+           for (size_t q=begin;q<end;q++)
+             join.pointVsSubtree((int)q,0);
+         });
+      common::parallel_for
+        (numTasks,
+         [&](size_t taskID) {
+           join.traverse(firstTask+(int)taskID,0);
+         });
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename ProcessPair>
+    struct RadiusJoin {
+      void pointVsSubtree(int q, int r)
+      {
+        const point_t &queryPoint = queryNodes[q];
+        int stack[40];
+        int stackPtr = 0;
+
+        int curr = r;
+        while (1) {
+          while (curr < numRefs) {
+            const auto &curr_node = refNodes[curr];
+            const scalar_t dist2
+              = sqrDistance<point_t,scalar_t,numDims>(queryPoint,curr_node);
+            if (dist2 <= radius2) {
+              processPair(q,curr,dist2);
+              ++numFound;
+            }
+            const int      curr_dim = levelOf(curr) % numDims;
+            const scalar_t curr_dim_dist
+              = ((const scalar_t*)&queryPoint)[curr_dim]
+              - ((const scalar_t*)&curr_node)[curr_dim];
+            const int      curr_side = curr_dim_dist > scalar_t(0);
+            const int      curr_far_child = 2*curr + 2 - curr_side;
+            if (curr_far_child < numRefs && curr_dim_dist*curr_dim_dist <= radius2)
+              stack[stackPtr++] = curr_far_child;
+            curr = 2*curr + 1 + curr_side;
+          }
+          if (stackPtr == 0)
+            return;
+          curr = stack[--stackPtr];
+        }
+      }
+
+      void refPointVsSubtree(int r, int q)
+      {
+        if (q >= numQueries) return;
+        const scalar_t *refPoint = (const scalar_t*)&refNodes[r];
+        if (sqrDistanceToBox(refPoint,queryBounds[q]) > radius2) return;
+
+        const scalar_t dist2
+          = sqrDistance<point_t,scalar_t,numDims>(queryNodes[q],refNodes[r]);
+        if (dist2 <= radius2) {
+          processPair(q,r,dist2);
+          ++numFound;
+        }
+        refPointVsSubtree(r,lChild(q));
+        refPointVsSubtree(r,rChild(q));
+      }
+
+      void traverse(int q, int r)
+      {
+        if (q >= numQueries || r >= numRefs) return;
+        if (sqrDistanceBetween(queryBounds[q],refBounds[r]) > radius2) return;
+
+        if (splitRefSide(q,numQueries,queryBounds[q],r,numRefs,refBounds[r],scalar_t(4))) {
+          refPointVsSubtree(r,q);
+          traverse(q,lChild(r));
+          traverse(q,rChild(r));
+        } else {
+          pointVsSubtree(q,r);
+          traverse(lChild(q),r);
+          traverse(rChild(q),r);
+        }
+      }
+
+      scalar_t       radius2;
+      const point_t *queryNodes;
+      int            numQueries;
+      const Box<scalar_t,numDims> *queryBounds;
+      const point_t *refNodes;
+      int            numRefs;
+      const Box<scalar_t,numDims> *refBounds;
+      ProcessPair   &processPair;
+      size_t         numFound;
+    };
+
+    template<typename point_t, typename scalar_t, int numDims, typename ProcessPair>
+    size_t radiusJoin(scalar_t radius,
+                      const point_t *d_queryNodes,
+                      int numQueries,
+                      const point_t *d_refNodes,
+                      int numRefs,
+                      ProcessPair &&processPair)
+    {
+      std::vector<Box<scalar_t,numDims>> queryBounds(numQueries);
+      std::vector<Box<scalar_t,numDims>> refBounds(numRefs);
+      computeSubtreeBounds<point_t,scalar_t,numDims>(queryBounds.data(),d_queryNodes,numQueries);
+      computeSubtreeBounds<point_t,scalar_t,numDims>(refBounds.data(),d_refNodes,numRefs);
+      if (numRefs == 0) return 0;
+
+      typedef RadiusJoin<point_t,scalar_t,numDims,
+                         typename std::remove_reference<ProcessPair>::type> Join;
+      const Join prototype
+        = { radius*radius,
+            d_queryNodes,numQueries,queryBounds.data(),
+            d_refNodes,numRefs,refBounds.data(),
+            processPair,0 };
+
+      // each task counts into its own join object; top-level query
+      // nodes are task 0
+      const int level     = taskLevel(numQueries);
+      const int firstTask = (1<<level)-1;
+      const int numTasks  = 1<<level;
+      std::vector<size_t> numFound(numTasks+1,0);
+      common::parallel_for
+        (numTasks+1,
+         [&](size_t taskID) {
+           Join join = prototype;
+           if (taskID == 0)
+             for (int q=0;q<firstTask;q++)
+               join.pointVsSubtree(q,0);
+           else
+             join.traverse(firstTask+(int)taskID-1,0);
+           numFound[taskID] = join.numFound;
+         });
+      size_t sum = 0;
+      for (auto n : numFound) sum += n;
+      return sum;
+    }
+
+  } // ::cpukd::dualtree
+} // ::cpukd
@@ -0,0 +1,341 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* micro-batching executor for single queries coming in from many
+   threads: queries get submitted one at a time (with either a future
+   or a callback for the result), and a dispatcher thread coalesces
+   them into batches that get run through one of the batched query
+   functions (eg, fcpBatch()). A batch gets dispatched as soon as it
+   is full, or once its oldest query has waited for a given max
+   delay, whichever comes first. The executor also keeps a histogram
+   of each query's latency (from submission to completion).
+
+   If runBatch throws, the exception goes to every query of that
+   batch (through its future, or its error callback); if a query's
+   result callback throws, the exception goes to that query's error
+   callback. Either way the dispatcher thread keeps going. */
+
+#pragma once
+
+#include "cpukd/common.h"
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cpukd {
+
+  // ==================================================================
+  // INTERFACE SECTION
+  // ==================================================================
+
+  /*! log-scale latency histogram, with 16 buckets per power of two
+      (ie, about 4% resolution), from 10ns to several hours */
+  struct LatencyHistogram {
+    enum { bucketsPerOctave = 16, numBuckets = 40*bucketsPerOctave };
+
+    void add(double seconds);
+    /*! latency (in seconds) below which fraction 'p' of all recorded
+        latencies are, eg, p=.99 for the 99th percentile */
+    double percentile(double p) const;
+
+    size_t count = 0;
+    double sum   = 0.;
+    size_t buckets[numBuckets] = { 0 };
+  };
+
+  /*! executor for queries of type query_t with results of type
+      result_t; runBatch(results,queries,numQueries) must run a batch
+      of queries, eg,
+
+      QueryExecutor<float3,int> executor
+        ([&](int *results, const float3 *queries, int numQueries) {
+           fcpBatch<float3,float,3>(results,queries,numQueries,d_nodes,N);
+         });
+      int closest = executor.submit(query).get();
+  */
+  template<typename query_t, typename result_t>
+  class QueryExecutor {
+  public:
+    typedef std::function<void(result_t *, const query_t *, int)> BatchFunction;
+
+    struct Config {
+      /*! max number of queries per batch */
+      int    maxBatchSize = 1024;
+      /*! max time (in seconds) a query may wait for its batch to
+          fill up before the batch gets dispatched anyway */
+      double maxDelay     = 100e-6;
+    };
+
+    struct Stats {
+      size_t numQueries;
+      size_t numBatches;
+      /*! queries that completed with an exception rather than a result */
+      size_t numFailed;
+      /*! latencies, in seconds */
+      double mean, p50, p99, p999;
+    };
+
+    QueryExecutor(const BatchFunction &runBatch,
+                  const Config &config = Config());
+    /*! finishes all queries submitted so far, then stops */
+    ~QueryExecutor();
+
+    /*! the future throws whatever runBatch threw, if it did */
+    std::future<result_t> submit(const query_t &query);
+    /*! callback gets called on the executor's dispatcher thread, so
+        should not do much work; onError (if given) gets called
+        instead if runBatch throws, and after callback if that
+        throws */
+    void submit(const query_t &query,
+                const std::function<void(const result_t &)> &callback,
+                const std::function<void(std::exception_ptr)> &onError=nullptr);
+
+    Stats stats() const;
+    void  resetStats();
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Pending {
+      query_t                                query;
+      clock::time_point                      submitTime;
+      std::function<void(const result_t &)> callback;
+      std::function<void(std::exception_ptr)> onError;
+    };
+
+    void enqueue(Pending &&pending);
+    void dispatcherLoop();
+    void runAndComplete(Pending *batch, size_t numQueries);
+
+    const BatchFunction     runBatch;
+    const Config            config;
+
+    std::mutex              mutex;
+    std::condition_variable wakeUp;
+    std::vector<Pending>    pending;
+    bool                    stopping = false;
+
+    mutable std::mutex      statsMutex;
+    LatencyHistogram        histogram;
+    size_t                  numBatches = 0;
+    size_t                  numFailed  = 0;
+
+    std::thread             dispatcher;
+  };
+
+  // ==================================================================
+  // IMPLEMENTATION SECTION
+  // ==================================================================
+
+  inline void LatencyHistogram::add(double seconds)
+  {
+    const double minLatency = 10e-9;
+    int bucket = seconds <= minLatency
+      ? 0
+      : int(log2(seconds/minLatency)*bucketsPerOctave);
+    bucket = std::min(bucket,int(numBuckets)-1);
+    buckets[bucket]++;
+    count++;
+    sum += seconds;
+  }
+
+  inline double LatencyHistogram::percentile(double p) const
+  {
+    if (count == 0) return 0.;
+    const double minLatency = 10e-9;
+    const size_t rank = std::min(count,std::max(size_t(1),size_t(ceil(p*count))));
+    size_t below = 0;
+    for (int i=0;i<numBuckets;i++) {
+      below += buckets[i];
+      if (below >= rank)
+        // geometric center of the bucket
+        return minLatency*exp2((i+.5)/bucketsPerOctave);
+    }
+    return minLatency*exp2(double(numBuckets)/bucketsPerOctave);
+  }
+
+  template<typename query_t, typename result_t>
+  QueryExecutor<query_t,result_t>::QueryExecutor(const BatchFunction &runBatch,
+                                                 const Config &config)
+    : runBatch(runBatch),
+      config(config)
+  {
+    if (config.maxBatchSize < 1)
+      throw std::runtime_error("QueryExecutor: invalid max batch size");
+    dispatcher = std::thread([this]() { dispatcherLoop(); });
+  }
+
+  template<typename query_t, typename result_t>
+  QueryExecutor<query_t,result_t>::~QueryExecutor()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeUp.notify_one();
+    dispatcher.join();
+  }
+
+  template<typename query_t, typename result_t>
+  void QueryExecutor<query_t,result_t>::enqueue(Pending &&newPending)
+  {
+    newPending.submitTime = clock::now();
+    bool notify;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending.push_back(std::move(newPending));
+      // dispatcher needs to know when there's a new oldest query
+      // (to set its deadline), or when a batch is full
+      notify = pending.size() == 1 || int(pending.size()) == config.maxBatchSize;
+    }
+    if (notify) wakeUp.notify_one();
+  }
+
+  template<typename query_t, typename result_t>
+  std::future<result_t> QueryExecutor<query_t,result_t>::submit(const query_t &query)
+  {
+    std::shared_ptr<std::promise<result_t>> promise
+      = std::make_shared<std::promise<result_t>>();
+    Pending newPending;
+    newPending.query    = query;
+    newPending.callback = [promise](const result_t &result) { promise->set_value(result); };
+    newPending.onError  = [promise](std::exception_ptr error) { promise->set_exception(error); };
+    enqueue(std::move(newPending));
+    return promise->get_future();
+  }
+
+  template<typename query_t, typename result_t>
+  void QueryExecutor<query_t,result_t>::submit(const query_t &query,
+                                               const std::function<void(const result_t &)> &callback,
+                                               const std::function<void(std::exception_ptr)> &onError)
+  {
+    Pending newPending;
+    newPending.query    = query;
+    newPending.callback = callback;
+    newPending.onError  = onError;
+    enqueue(std::move(newPending));
+  }
+
+  template<typename query_t, typename result_t>
+  void QueryExecutor<query_t,result_t>::dispatcherLoop()
+  {
+    const auto maxDelay
+      = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(config.maxDelay));
+    std::vector<Pending> batch;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (1) {
+      if (pending.empty()) {
+        if (stopping) return;
+        wakeUp.wait(lock);
+        continue;
+      }
+      if (int(pending.size()) < config.maxBatchSize && !stopping) {
+        const clock::time_point deadline = pending.front().submitTime + maxDelay;
+        if (clock::now() < deadline) {
+          wakeUp.wait_until(lock,deadline);
+          continue;
+        }
+      }
+      // take everything that's pending; if we have fallen behind
+      // that's more than one batch, but then all of them are due
+      batch.clear();
+      std::swap(batch,pending);
+
+      lock.unlock();
+      for (size_t begin=0;begin<batch.size();begin+=config.maxBatchSize)
+        runAndComplete(batch.data()+begin,
+                       std::min(batch.size()-begin,size_t(config.maxBatchSize)));
+      lock.lock();
+    }
+  }
+
+  template<typename query_t, typename result_t>
+  void QueryExecutor<query_t,result_t>::runAndComplete(Pending *batch, size_t numQueries)
+  {
+    std::vector<query_t>  queries(numQueries);
+    std::vector<result_t> results(numQueries);
+    for (size_t i=0;i<numQueries;i++)
+      queries[i] = batch[i].query;
+    // nothing may escape the dispatcher thread (that'd terminate),
+    // and every query has to get completed one way or another
+    std::exception_ptr batchError;
+    try {
+      runBatch(results.data(),queries.data(),(int)numQueries);
+    } catch (...) {
+      batchError = std::current_exception();
+    }
+
+    size_t batchFailed = 0;
+    auto fail = [&](Pending &query, std::exception_ptr error) {
+      batchFailed++;
+      if (!query.onError) return;
+      try {
+        query.onError(error);
+      } catch (...) {
+        // nowhere left to report this to
+      }
+    };
+    for (size_t i=0;i<numQueries;i++) {
+      if (batchError) {
+        fail(batch[i],batchError);
+        continue;
+      }
+      try {
+        batch[i].callback(results[i]);
+      } catch (...) {
+        fail(batch[i],std::current_exception());
+      }
+    }
+
+    const clock::time_point completed = clock::now();
+    std::lock_guard<std::mutex> lock(statsMutex);
+    for (size_t i=0;i<numQueries;i++)
+      histogram.add(std::chrono::duration<double>(completed-batch[i].submitTime).count());
+    numBatches++;
+    numFailed += batchFailed;
+  }
+
+  template<typename query_t, typename result_t>
+  typename QueryExecutor<query_t,result_t>::Stats
+  QueryExecutor<query_t,result_t>::stats() const
+  {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    Stats stats;
+    stats.numQueries = histogram.count;
+    stats.numBatches = numBatches;
+    stats.numFailed  = numFailed;
+    stats.mean = histogram.count ? histogram.sum/histogram.count : 0.;
+    stats.p50  = histogram.percentile(.5);
+    stats.p99  = histogram.percentile(.99);
+    stats.p999 = histogram.percentile(.999);
+    return stats;
+  }
+
+  template<typename query_t, typename result_t>
+  void QueryExecutor<query_t,result_t>::resetStats()
+  {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    histogram  = LatencyHistogram();
+    numBatches = 0;
+    numFailed  = 0;
+  }
+
+} // ::cpukd
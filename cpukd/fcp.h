@@ -16,7 +16,8 @@
 
 #pragma once
 
-#include "cpukd/common.h"
+#include "cpukd/metrics.h"
+#include <limits>
 
 namespace cpukd {
 
@@ -35,7 +36,7 @@ namespace cpukd {
   template<> double sqrt(double v) { return ::sqrt(v); }
   
   template<typename point_t, typename scalar_t, int numDims>
-  inline scalar_t distance(const point_t &a, const point_t &b)
+  inline scalar_t sqrDistance(const point_t &a, const point_t &b)
   {
     scalar_t dot = scalar_t(0);
     for (int i=0;i<numDims;i++) {
@@ -43,45 +44,70 @@ namespace cpukd {
       scalar_t b_i = ((const scalar_t*)&b)[i];
       dot += (b_i-a_i)*(b_i-a_i);
     }
-    return sqrt<scalar_t>(dot);
+    return dot;
+  }
+
+  template<typename point_t, typename scalar_t, int numDims>
+  inline scalar_t distance(const point_t &a, const point_t &b)
+  {
+    return sqrt<scalar_t>(sqrDistance<point_t,scalar_t,numDims>(a,b));
   }
 
+  /*! default predicate for the filtered queries (see
+      cpukd/filtered.h); accepts every point */
+  struct AcceptAll {
+    template<typename point_t>
+    inline bool operator()(int /*pointID*/, const point_t &/*point*/) const { return true; }
+  };
+  
+  /*! the actual fcp traversal; starts out with the given closest
+      point and distance (-1 and infinity for a regular, "cold"
+      query), and only looks for points closer than that, and for
+      which accept(pointID,point) returns true. All distances are in
+      the metric's "reduced" form (ie, squared distances for the
+      default L2 metric; see cpukd/metrics.h) */
 #if 1
     /*! manual stack based implementation */
-  template<typename point_t, typename scalar_t, int numDims>
+  template<typename point_t, typename scalar_t, int numDims,
+           typename Metric=metrics::L2<scalar_t,numDims>,
+           typename Predicate=AcceptAll>
   inline
-  int fcp(point_t queryPoint,
-          const point_t *d_nodes,
-          int N)
+  int fcpSeeded(point_t queryPoint,
+                const point_t *d_nodes,
+                int N,
+                int      closest_found_so_far,
+                scalar_t closest_dist_found_so_far,
+                int *numNodesVisited,
+                const Predicate &accept=Predicate(),
+                const Metric &metric=Metric())
   {
-    if (N == 0) return -1;
+    if (N == 0) return closest_found_so_far;
 
-    int   closest_found_so_far = -1;
-    float closest_dist_found_so_far = std::numeric_limits<float>::infinity();
-    
-    std::pair<int,float> stack[40];
+    std::pair<int,scalar_t> stack[40];
     int stackPtr = 0;
     
     int curr = 0;
     while (1) {
       while (curr < N) {
-        float dist = distance<point_t,scalar_t,numDims>(queryPoint,d_nodes[curr]);
-        if (dist < closest_dist_found_so_far) {
+        if (numNodesVisited) ++*numNodesVisited;
+        const auto &curr_node = d_nodes[curr];
+        scalar_t dist = metric.reducedDistance((const scalar_t*)&queryPoint,
+                                               (const scalar_t*)&curr_node);
+        if (dist < closest_dist_found_so_far && accept(curr,curr_node)) {
           closest_dist_found_so_far = dist;
           closest_found_so_far      = curr;
         }
         
-        const auto &curr_node = d_nodes[curr];
-        const int   curr_dim = levelOf(curr) % numDims;
-        const float curr_dim_dist = ((scalar_t*)&queryPoint)[curr_dim] - ((scalar_t*)&curr_node)[curr_dim];
-        const int   curr_side = curr_dim_dist > 0.f;
-        const int   curr_close_child = 2*curr + 1 + curr_side;
-        const int   curr_far_child   = 2*curr + 2 - curr_side;
+        const int      curr_dim = levelOf(curr) % numDims;
+        const scalar_t curr_dim_dist = ((scalar_t*)&queryPoint)[curr_dim] - ((scalar_t*)&curr_node)[curr_dim];
+        const int      curr_side = curr_dim_dist > scalar_t(0);
+        const int      curr_close_child = 2*curr + 1 + curr_side;
+        const int      curr_far_child   = 2*curr + 2 - curr_side;
 
-        const float abs_dim_dist = fabsf(curr_dim_dist);
+        const scalar_t far_dist = metric.reducedPlaneDistance(curr_dim_dist,curr_dim);
 
-        if ((curr_far_child<N) && (abs_dim_dist < closest_dist_found_so_far)) {
-          stack[stackPtr++] = { curr_far_child, abs_dim_dist };
+        if ((curr_far_child<N) && (far_dist < closest_dist_found_so_far)) {
+          stack[stackPtr++] = { curr_far_child, far_dist };
         }
 
         curr = curr_close_child;
@@ -100,15 +126,21 @@ namespace cpukd {
   }
 #else
     /*! stack-less implementation */
-  template<typename point_t, typename scalar_t, int numDims>
+  template<typename point_t, typename scalar_t, int numDims,
+           typename Metric=metrics::L2<scalar_t,numDims>,
+           typename Predicate=AcceptAll>
   inline
-  int fcp(point_t queryPoint,
-          const point_t *d_nodes,
-          int N)
+  int fcpSeeded(point_t queryPoint,
+                const point_t *d_nodes,
+                int N,
+                int      closest_found_so_far,
+                scalar_t closest_dist_found_so_far,
+                int *numNodesVisited,
+                const Predicate &accept=Predicate(),
+                const Metric &metric=Metric())
   {
-    int   closest_found_so_far = -1;
-    float closest_dist_found_so_far = std::numeric_limits<float>::infinity();
-    
+    if (N == 0) return closest_found_so_far;
+
     int prev = -1;
     int curr = 0;
 
@@ -129,8 +161,10 @@ namespace cpukd {
       const int  child = 2*curr+1;
       const bool from_child = (prev >= child);
       if (!from_child) {
-        float dist = distance<point_t,scalar_t,numDims>(queryPoint,d_nodes[curr]);
-        if (dist < closest_dist_found_so_far) {
+        if (numNodesVisited) ++*numNodesVisited;
+        scalar_t dist = metric.reducedDistance((const scalar_t*)&queryPoint,
+                                               (const scalar_t*)&d_nodes[curr]);
+        if (dist < closest_dist_found_so_far && accept(curr,d_nodes[curr])) {
           closest_dist_found_so_far = dist;
           closest_found_so_far      = curr;
         }
@@ -149,7 +183,8 @@ namespace cpukd {
         // the far side - but only if this exists, and if far half of
         // current space if even within search radius.
         next
-          = ((curr_far_child<N) && (fabsf(curr_dim_dist) < closest_dist_found_so_far))
+          = ((curr_far_child<N)
+             && (metric.reducedPlaneDistance(curr_dim_dist,curr_dim) < closest_dist_found_so_far))
           ? curr_far_child
           : parent;
       else if (prev == curr_far_child)
@@ -182,6 +217,159 @@ namespace cpukd {
       curr = next;
     }
   }
-#endif  
+#endif
+
+  /*! find-closest-point query: returns the index of the point in
+      (left-balanced) tree d_nodes that is closest to queryPoint
+      (under the given metric, see cpukd/metrics.h), or -1 if N==0 */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename Metric=metrics::L2<scalar_t,numDims>>
+  inline
+  int fcp(point_t queryPoint,
+          const point_t *d_nodes,
+          int N,
+          int *numNodesVisited=nullptr,
+          const Metric &metric=Metric())
+  {
+    return fcpSeeded<point_t,scalar_t,numDims,Metric>
+      (queryPoint,d_nodes,N,
+       -1,std::numeric_limits<scalar_t>::infinity(),
+       numNodesVisited,AcceptAll(),metric);
+  }
+
+  /*! fcp with a warm start: 'hintPointID' is the index of a point
+      that is likely (but doesn't have to be) close to the query -
+      typically last frame's result for the same, slightly moved,
+      query. The search then starts out with that point's distance as
+      max radius, and culls everything farther away right from the
+      start. A hint of -1 means "no hint". Result is the same as that of
+      fcp() (modulo ties, where the hinted point wins). */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename Metric=metrics::L2<scalar_t,numDims>>
+  inline
+  int fcpWithHint(point_t queryPoint,
+                  int hintPointID,
+                  const point_t *d_nodes,
+                  int N,
+                  int *numNodesVisited=nullptr,
+                  const Metric &metric=Metric())
+  {
+    if (hintPointID < 0 || hintPointID >= N)
+      return fcp<point_t,scalar_t,numDims,Metric>(queryPoint,d_nodes,N,numNodesVisited,metric);
+    return fcpSeeded<point_t,scalar_t,numDims,Metric>
+      (queryPoint,d_nodes,N,
+       hintPointID,
+       metric.reducedDistance((const scalar_t*)&queryPoint,
+                              (const scalar_t*)&d_nodes[hintPointID]),
+       numNodesVisited,AcceptAll(),metric);
+  }
+
+  /*! fcp that only considers points closer than 'maxSearchRadius'
+      (eg, an upper bound known from a previous frame); returns -1 if
+      there is no such point */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename Metric=metrics::L2<scalar_t,numDims>>
+  inline
+  int fcpInRadius(point_t queryPoint,
+                  scalar_t maxSearchRadius,
+                  const point_t *d_nodes,
+                  int N,
+                  int *numNodesVisited=nullptr,
+                  const Metric &metric=Metric())
+  {
+    return fcpSeeded<point_t,scalar_t,numDims,Metric>
+      (queryPoint,d_nodes,N,-1,metric.toReduced(maxSearchRadius),
+       numNodesVisited,AcceptAll(),metric);
+  }
+
+  namespace cct {
+    /*! "closest corner tracking" variant of fcp: rather than culling
+      the far child with only the distance to its splitting plane,
+      this tracks, per dimension, the distance from the query to the
+      current subtree's cell (Arya/Mount-style incremental distance),
+      and culls subtrees by the (squared) distance to that cell's
+      closest corner. Each stack entry has to carry its own copy of
+      those per-dimension offsets, so this pays off mostly for deeper
+      trees and higher dimensions, where plane-only culling gets
+      increasingly loose. */
+    template<typename point_t, typename scalar_t, int numDims>
+    inline
+    int fcp(point_t queryPoint,
+            const point_t *d_nodes,
+            int N,
+            int *numNodesVisited=nullptr)
+    {
+      if (N == 0) return -1;
+
+      int      closest_found_so_far = -1;
+      scalar_t closest_dist2_found_so_far = std::numeric_limits<scalar_t>::infinity();
+
+      struct StackEntry {
+        int      node;
+        /*! squared distance from query to this subtree's cell */
+        scalar_t cellDist2;
+        /*! per-dimension distance from query to this subtree's cell */
+        scalar_t cellOffset[numDims];
+      };
+      StackEntry stack[40];
+      int stackPtr = 0;
+
+      scalar_t cellOffset[numDims];
+      for (int d=0;d<numDims;d++) cellOffset[d] = scalar_t(0);
+      scalar_t cellDist2 = scalar_t(0);
+    
+      int curr = 0;
+      while (1) {
+        while (curr < N) {
+          if (numNodesVisited) ++*numNodesVisited;
+          const auto &curr_node = d_nodes[curr];
+          scalar_t dist2 = sqrDistance<point_t,scalar_t,numDims>(queryPoint,curr_node);
+          if (dist2 < closest_dist2_found_so_far) {
+            closest_dist2_found_so_far = dist2;
+            closest_found_so_far       = curr;
+          }
+        
+          const int      curr_dim = levelOf(curr) % numDims;
+          const scalar_t curr_dim_dist
+            = ((const scalar_t*)&queryPoint)[curr_dim]
+            - ((const scalar_t*)&curr_node)[curr_dim];
+          const int      curr_side = curr_dim_dist > scalar_t(0);
+          const int      curr_close_child = 2*curr + 1 + curr_side;
+          const int      curr_far_child   = 2*curr + 2 - curr_side;
+
+          if (curr_far_child<N) {
+            // far cell is the same as ours except in curr_dim, where
+            // it now starts at the splitting plane
+            const scalar_t far_dist2
+              = cellDist2
+              - cellOffset[curr_dim]*cellOffset[curr_dim]
+              + curr_dim_dist*curr_dim_dist;
+            if (far_dist2 < closest_dist2_found_so_far) {
+              StackEntry &entry = stack[stackPtr++];
+              entry.node      = curr_far_child;
+              entry.cellDist2 = far_dist2;
+              for (int d=0;d<numDims;d++) entry.cellOffset[d] = cellOffset[d];
+              entry.cellOffset[curr_dim] = curr_dim_dist;
+            }
+          }
+          // close cell has the same offsets as ours, nothing to update
+          curr = curr_close_child;
+        }
+        // pop next from stack ...
+        while (1) {
+          if (stackPtr == 0) 
+            return closest_found_so_far;
+          -- stackPtr;
+          const StackEntry &entry = stack[stackPtr];
+          if (entry.cellDist2 > closest_dist2_found_so_far)
+            continue;
+          curr      = entry.node;
+          cellDist2 = entry.cellDist2;
+          for (int d=0;d<numDims;d++) cellOffset[d] = entry.cellOffset[d];
+          break;
+        }
+      }
+    }
+  } // ::cpukd::cct
 } // ::cpukd
 
@@ -0,0 +1,92 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* filtered queries: same as the regular fcp/knn/radius queries, but
+   with a predicate 'accept(pointID,point)' that gets evaluated
+   (inlined) inside the traversal, for each candidate point that is
+   within the current search radius. Rejected points are treated as if
+   they weren't in the tree at all, so they never shrink the search
+   radius. Typical uses are "exclude the query point itself", or
+   "closest point with a different label", where the label is stored
+   in the point's payload; eg, for a buildTree<float4,float,3>() tree
+   with labels in float4::w:
+
+   filtered::fcp<float4,float,3>
+     (query,d_nodes,N,
+      [&](int pointID, const float4 &point) { return point.w != query.w; });
+*/
+
+#pragma once
+
+#include "cpukd/knn.h"
+#include "cpukd/radius.h"
+
+namespace cpukd {
+  namespace filtered {
+
+    /*! fcp(), but only considering points for which
+        accept(pointID,point) returns true; returns -1 if there are
+        none */
+    template<typename point_t, typename scalar_t, int numDims, typename Predicate>
+    inline int fcp(point_t queryPoint,
+                   const point_t *d_nodes,
+                   int N,
+                   const Predicate &accept)
+    {
+      return fcpSeeded<point_t,scalar_t,numDims>
+        (queryPoint,d_nodes,N,
+         -1,std::numeric_limits<scalar_t>::infinity(),
+         nullptr,accept);
+    }
+
+    /*! knn(), but only considering points for which
+        accept(pointID,point) returns true */
+    template<typename point_t, typename scalar_t, int numDims,
+             typename CandidateList, typename Predicate>
+    inline float knn(CandidateList &currentlyClosest,
+                     point_t queryPoint,
+                     const point_t *d_nodes,
+                     int N,
+                     const Predicate &accept)
+    {
+      return cpukd::knn<point_t,scalar_t,numDims>
+        (currentlyClosest,queryPoint,d_nodes,N,accept);
+    }
+
+    /*! radiusQuery(), but only reporting (and counting) points for
+        which accept(pointID,point) returns true */
+    template<typename point_t, typename scalar_t, int numDims,
+             typename Predicate, typename ProcessPoint>
+    inline int radiusQuery(point_t queryPoint,
+                           scalar_t radius,
+                           const point_t *d_nodes,
+                           int N,
+                           const Predicate &accept,
+                           ProcessPoint &&processPoint)
+    {
+      int numAccepted = 0;
+      cpukd::radiusQuery<point_t,scalar_t,numDims>
+        (queryPoint,radius,d_nodes,N,
+         [&](int pointID, scalar_t dist2) {
+           if (!accept(pointID,d_nodes[pointID])) return;
+           processPoint(pointID,dist2);
+           ++numAccepted;
+         });
+      return numAccepted;
+    }
+    
+  } // ::cpukd::filtered
+} // ::cpukd
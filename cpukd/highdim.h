@@ -0,0 +1,216 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* helpers for high-dimensional (say, 16 to 128-dimensional) data,
+   where the per-node distance computation dominates the query cost,
+   and where a tree is way less deep than there are dimensions:
+
+   - a distance kernel that keeps several independent partial sums
+     (so the compiler can vectorize across dimensions), and that stops
+     as soon as the partial sum exceeds the current closest distance;
+
+   - chooseSplitDims(), which picks per-level split dimensions from the
+     widest dimensions of the data, for use with the
+     buildTree(points,N,splitDimOfLevel) builder;
+
+   - fcp() and bruteForceFCP() that use both of these.
+*/
+
+#pragma once
+
+#include "cpukd/builder.h"
+#include "cpukd/fcp.h"
+
+namespace cpukd {
+  namespace highdim {
+
+    // ==================================================================
+    // INTERFACE SECTION
+    // ==================================================================
+
+    /*! squared distance between a and b, or _some_ value greater
+        than 'bound' if that distance is greater than 'bound' */
+    template<typename scalar_t, int numDims>
+    scalar_t sqrDistanceBounded(const scalar_t *a, const scalar_t *b, scalar_t bound);
+
+    /*! picks the split dimension for each tree level (for a tree over
+        numPoints points) by repeatedly picking the dimension with the
+        widest remaining extent, then assuming that split halves the
+        extent in that dimension. Returns one dimension per level,
+        ready to be passed to buildTree() and fcp() */
+    template<typename point_t, typename scalar_t, int numDims>
+    std::vector<int> chooseSplitDims(const point_t *d_points, int numPoints);
+
+    /*! fcp on a tree built with buildTree(points,N,splitDimOfLevel);
+        passing nullptr for splitDimOfLevel means round-robin, as in a
+        tree built by regular buildTree(points,N) */
+    template<typename point_t, typename scalar_t, int numDims>
+    int fcp(point_t queryPoint,
+            const point_t *d_nodes,
+            int N,
+            const int *splitDimOfLevel,
+            int *numNodesVisited=nullptr);
+
+    /*! reference closest point via linear scan (with the same
+        early-exit distance kernel); for high dimensions this can be
+        competitive with - or faster than - any tree traversal */
+    template<typename point_t, typename scalar_t, int numDims>
+    int bruteForceFCP(point_t queryPoint,
+                      const point_t *d_points,
+                      int N);
+
+    // ==================================================================
+    // IMPLEMENTATION SECTION
+    // ==================================================================
+
+    template<typename scalar_t, int numDims>
+    inline scalar_t sqrDistanceBounded(const scalar_t *a, const scalar_t *b, scalar_t bound)
+    {
+      // independent partial sums, so adding up the dimensions is not
+      // one long dependency chain, and can be vectorized
+      enum { numLanes = 8, blockSize = 16 };
+      scalar_t lane[numLanes];
+      for (int l=0;l<numLanes;l++) lane[l] = scalar_t(0);
+
+      int d = 0;
+      for (;d+blockSize<=numDims;d+=blockSize) {
+        for (int j=0;j<blockSize;j+=numLanes)
+          for (int l=0;l<numLanes;l++) {
+            const scalar_t diff = a[d+j+l]-b[d+j+l];
+            lane[l] += diff*diff;
+          }
+        // early exit: partial sum can only grow
+        scalar_t partial = scalar_t(0);
+        for (int l=0;l<numLanes;l++) partial += lane[l];
+        if (partial > bound) return partial;
+      }
+      for (;d+numLanes<=numDims;d+=numLanes)
+        for (int l=0;l<numLanes;l++) {
+          const scalar_t diff = a[d+l]-b[d+l];
+          lane[l] += diff*diff;
+        }
+      scalar_t sum = scalar_t(0);
+      for (;d<numDims;d++) {
+        const scalar_t diff = a[d]-b[d];
+        sum += diff*diff;
+      }
+      for (int l=0;l<numLanes;l++) sum += lane[l];
+      return sum;
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    std::vector<int> chooseSplitDims(const point_t *d_points, int numPoints)
+    {
+      scalar_t extent[numDims];
+      for (int d=0;d<numDims;d++) {
+        scalar_t lo = std::numeric_limits<scalar_t>::infinity();
+        scalar_t hi = -std::numeric_limits<scalar_t>::infinity();
+        for (int i=0;i<numPoints;i++) {
+          const scalar_t x = ((const scalar_t*)&d_points[i])[d];
+          lo = std::min(lo,x);
+          hi = std::max(hi,x);
+        }
+        extent[d] = (numPoints > 0) ? (hi-lo) : scalar_t(0);
+      }
+
+      std::vector<int> splitDimOfLevel;
+      for (int level=0;numPoints > 0 && level<=levelOf(numPoints-1);level++) {
+        int widest = 0;
+        for (int d=1;d<numDims;d++)
+          if (extent[d] > extent[widest]) widest = d;
+        splitDimOfLevel.push_back(widest);
+        extent[widest] *= scalar_t(.5);
+      }
+      return splitDimOfLevel;
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    inline int fcp(point_t queryPoint,
+                   const point_t *d_nodes,
+                   int N,
+                   const int *splitDimOfLevel,
+                   int *numNodesVisited)
+    {
+      if (N == 0) return -1;
+
+      const scalar_t *query = (const scalar_t*)&queryPoint;
+      int      closest_found_so_far = -1;
+      scalar_t closest_dist2_found_so_far = std::numeric_limits<scalar_t>::infinity();
+
+      std::pair<int,scalar_t> stack[40];
+      int stackPtr = 0;
+
+      int curr = 0;
+      while (1) {
+        while (curr < N) {
+          if (numNodesVisited) ++*numNodesVisited;
+          const scalar_t *curr_node = (const scalar_t*)&d_nodes[curr];
+          const scalar_t  dist2
+            = sqrDistanceBounded<scalar_t,numDims>(query,curr_node,closest_dist2_found_so_far);
+          if (dist2 < closest_dist2_found_so_far) {
+            closest_dist2_found_so_far = dist2;
+            closest_found_so_far       = curr;
+          }
+
+          const int      curr_level = levelOf(curr);
+          const int      curr_dim
+            = splitDimOfLevel ? splitDimOfLevel[curr_level] : (curr_level % numDims);
+          const scalar_t curr_dim_dist = query[curr_dim] - curr_node[curr_dim];
+          const int      curr_side = curr_dim_dist > scalar_t(0);
+          const int      curr_close_child = 2*curr + 1 + curr_side;
+          const int      curr_far_child   = 2*curr + 2 - curr_side;
+          const scalar_t far_dist2 = curr_dim_dist*curr_dim_dist;
+
+          if ((curr_far_child<N) && (far_dist2 < closest_dist2_found_so_far))
+            stack[stackPtr++] = { curr_far_child, far_dist2 };
+
+          curr = curr_close_child;
+        }
+        // pop next from stack ...
+        while (1) {
+          if (stackPtr == 0)
+            return closest_found_so_far;
+          -- stackPtr;
+          if (stack[stackPtr].second > closest_dist2_found_so_far)
+            continue;
+          curr = stack[stackPtr].first;
+          break;
+        }
+      }
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    inline int bruteForceFCP(point_t queryPoint,
+                             const point_t *d_points,
+                             int N)
+    {
+      const scalar_t *query = (const scalar_t*)&queryPoint;
+      int      closest_found_so_far = -1;
+      scalar_t closest_dist2_found_so_far = std::numeric_limits<scalar_t>::infinity();
+      for (int i=0;i<N;i++) {
+        const scalar_t dist2
+          = sqrDistanceBounded<scalar_t,numDims>(query,(const scalar_t*)&d_points[i],
+                                                 closest_dist2_found_so_far);
+        if (dist2 < closest_dist2_found_so_far) {
+          closest_dist2_found_so_far = dist2;
+          closest_found_so_far       = i;
+        }
+      }
+      return closest_found_so_far;
+    }
+    
+  } // ::cpukd::highdim
+} // ::cpukd
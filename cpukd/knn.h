@@ -16,43 +16,51 @@
 
 #pragma once
 
-#include "cukd/fcp.h"
+#include "cpukd/fcp.h"
+#include <stdint.h>
+#include <string.h>
+
+namespace cpukd {
+
+  inline uint32_t float_as_uint(float f)
+  { uint32_t u; memcpy(&u,&f,sizeof(u)); return u; }
+  inline float uint_as_float(uint32_t u)
+  { float f; memcpy(&f,&u,sizeof(f)); return f; }
 
-namespace cukd {
 
   template<int k>
   struct FixedCandidateList
   {
-    inline __device__ uint64_t encode(float f, int i)
+    inline uint64_t encode(float f, int i)
     {
-      return (uint64_t(__float_as_uint(f)) << 32) | uint32_t(i);
+      return (uint64_t(float_as_uint(f)) << 32) | uint32_t(i);
     }
     
-    inline __device__ FixedCandidateList(float maxQueryDist)
+    /*! 'maxDist2' is the max search radius in the metric's reduced
+        form (ie, squared for L2; see cpukd/metrics.h) */
+    inline FixedCandidateList(float maxDist2)
     {
-#pragma unroll
       for (int i=0;i<k;i++)
-        entry[i] = encode(maxQueryDist*maxQueryDist,-1);
+        entry[i] = encode(maxDist2,-1);
     }
 
-    inline __device__ void push(float dist, int pointID)
+    inline void push(float dist, int pointID)
     {
       uint64_t v = encode(dist,pointID);
-#pragma unroll
       for (int i=0;i<k;i++) {
-        uint64_t vmax = max(entry[i],v);
-        uint64_t vmin = min(entry[i],v);
+        uint64_t vmax = std::max(entry[i],v);
+        uint64_t vmin = std::min(entry[i],v);
         entry[i] = vmin;
         v = vmax;
       }
     }
 
-    inline __device__ float maxRadius2()
+    inline float maxRadius2()
     { return decode_dist2(entry[k-1]); }
 
-    inline __device__ float decode_dist2(uint64_t v)
-    { return __uint_as_float(v >> 32); }
-    inline __device__ int decode_pointID(uint64_t v)
+    inline float decode_dist2(uint64_t v)
+    { return uint_as_float(v >> 32); }
+    inline int decode_pointID(uint64_t v)
     { return int(v); }
 
     uint64_t entry[k];
@@ -61,19 +69,20 @@ namespace cukd {
   template<int k>
   struct HeapCandidateList
   {
-    inline __device__ uint64_t encode(float f, int i)
+    inline uint64_t encode(float f, int i)
     {
-      return (uint64_t(__float_as_uint(f)) << 32) | uint32_t(i);
+      return (uint64_t(float_as_uint(f)) << 32) | uint32_t(i);
     }
     
-    inline __device__ HeapCandidateList(float maxRange)
+    /*! 'maxDist2' is the max search radius in the metric's reduced
+        form, as for FixedCandidateList */
+    inline HeapCandidateList(float maxDist2)
     {
-#pragma unroll
       for (int i=0;i<k;i++)
-        entry[i] = encode(maxRange*maxRange,-1);
+        entry[i] = encode(maxDist2,-1);
     }
 
-    inline __device__ void push(float dist, int pointID)
+    inline void push(float dist, int pointID)
     {
       uint64_t e = encode(dist,pointID);
       if (e >= entry[0]) return;
@@ -104,17 +113,169 @@ namespace cukd {
       }
     }
     
-    inline __device__ float maxRadius2()
+    inline float maxRadius2()
     { return decode_dist2(entry[0]); }
     
-    inline __device__ float decode_dist2(uint64_t v)
-    { return __uint_as_float(v >> 32); }
-    inline __device__ int decode_pointID(uint64_t v)
+    inline float decode_dist2(uint64_t v)
+    { return uint_as_float(v >> 32); }
+    inline int decode_pointID(uint64_t v)
     { return int(v); }
 
     uint64_t entry[k];
   };
 
+  /* candidate lists with k chosen at runtime, over caller-provided
+     storage (so queries don't allocate anything); they use the same
+     (dist2,pointID) encoding as the lists above, and all three can be
+     passed to knn(). Which one is fastest depends on k, see
+     knnRuntimeK(), which picks one. As for the lists above, their
+     cut-off 'maxDist2' is in the metric's reduced form (ie, squared
+     for L2, but not for, eg, L1; see cpukd/metrics.h). */
+
+  /*! number of uint64_t's of storage any of the runtime-k lists below
+      may need for a given k */
+  inline int runtimeKStorageSize(int k) { return 2*k; }
+
+  /*! decodes the first 'count' of a sorted list's entries into
+      pointIDs[0..k) and dist2[0..k) (either may be null); unused
+      entries get ID -1 and distance infinity. Returns the number of
+      valid entries */
+  inline int decodeCandidates(const uint64_t *entries, int count, int k,
+                              int *pointIDs, float *dist2)
+  {
+    int numValid = 0;
+    for (int i=0;i<k;i++) {
+      const bool valid = i < count && uint32_t(entries[i]) != uint32_t(-1);
+      numValid += valid;
+      if (pointIDs) pointIDs[i] = valid ? int(uint32_t(entries[i])) : -1;
+      if (dist2)
+        dist2[i] = valid
+          ? uint_as_float(uint32_t(entries[i] >> 32))
+          : std::numeric_limits<float>::infinity();
+    }
+    return numValid;
+  }
+
+  /*! for small k: array kept sorted at all times; the insert position
+      is found by counting smaller entries (a branch-free loop the
+      compiler vectorizes), and larger entries get shifted up */
+  struct SortedCandidateList
+  {
+    inline SortedCandidateList(uint64_t *storage, int k, float maxDist2)
+      : entry(storage), k(k)
+    {
+      const uint64_t init = (uint64_t(float_as_uint(maxDist2)) << 32) | uint32_t(-1);
+      for (int i=0;i<k;i++) entry[i] = init;
+    }
+
+    inline void push(float dist, int pointID)
+    {
+      const uint64_t e = (uint64_t(float_as_uint(dist)) << 32) | uint32_t(pointID);
+      if (e >= entry[k-1]) return;
+      int pos = 0;
+      for (int i=0;i<k;i++) pos += (entry[i] < e);
+      memmove(entry+pos+1,entry+pos,(k-1-pos)*sizeof(uint64_t));
+      entry[pos] = e;
+    }
+
+    inline float maxRadius2() const
+    { return uint_as_float(uint32_t(entry[k-1] >> 32)); }
+
+    inline int finish(int *pointIDs, float *dist2)
+    { return decodeCandidates(entry,k,k,pointIDs,dist2); }
+
+    uint64_t *const entry;
+    const int       k;
+  };
+
+  /*! for medium k: max-heap, as in HeapCandidateList */
+  struct RuntimeHeapCandidateList
+  {
+    inline RuntimeHeapCandidateList(uint64_t *storage, int k, float maxDist2)
+      : entry(storage), k(k)
+    {
+      const uint64_t init = (uint64_t(float_as_uint(maxDist2)) << 32) | uint32_t(-1);
+      for (int i=0;i<k;i++) entry[i] = init;
+    }
+
+    inline void push(float dist, int pointID)
+    {
+      const uint64_t e = (uint64_t(float_as_uint(dist)) << 32) | uint32_t(pointID);
+      if (e >= entry[0]) return;
+      // replace the current max, and sift down
+      int pos = 0;
+      while (1) {
+        int child = 2*pos+1;
+        if (child >= k) break;
+        if (child+1 < k && entry[child+1] > entry[child]) child++;
+        if (entry[child] < e) break;
+        entry[pos] = entry[child];
+        pos = child;
+      }
+      entry[pos] = e;
+    }
+
+    inline float maxRadius2() const
+    { return uint_as_float(uint32_t(entry[0] >> 32)); }
+
+    /*! sorts the heap (in place), then decodes it */
+    inline int finish(int *pointIDs, float *dist2)
+    {
+      std::sort(entry,entry+k);
+      return decodeCandidates(entry,k,k,pointIDs,dist2);
+    }
+
+    uint64_t *const entry;
+    const int       k;
+  };
+
+  /*! for large k: unsorted buffer of up to 2k entries; once full, a
+      quickselect (std::nth_element) keeps the k closest, and the k-th
+      closest becomes the new cut-off. Storage must have 2k entries. */
+  struct BufferedCandidateList
+  {
+    inline BufferedCandidateList(uint64_t *storage, int k, float maxDist2)
+      : entry(storage), k(k),
+        cutOff((uint64_t(float_as_uint(maxDist2)) << 32) | uint32_t(-1))
+    {}
+
+    inline void push(float dist, int pointID)
+    {
+      const uint64_t e = (uint64_t(float_as_uint(dist)) << 32) | uint32_t(pointID);
+      if (e >= cutOff) return;
+      entry[count++] = e;
+      if (count == k && !haveK) {
+        // the largest of the first k candidates is a valid cut-off
+        // already, no need to wait for the first quickselect
+        cutOff = *std::max_element(entry,entry+k);
+        haveK  = true;
+      } else if (count == 2*k) {
+        std::nth_element(entry,entry+k-1,entry+2*k);
+        cutOff = entry[k-1];
+        count  = k;
+      }
+    }
+
+    inline float maxRadius2() const
+    { return uint_as_float(uint32_t(cutOff >> 32)); }
+
+    /*! sorts the k closest candidates (in place), then decodes them */
+    inline int finish(int *pointIDs, float *dist2)
+    {
+      const int numKept = std::min(count,k);
+      if (count > k)
+        std::nth_element(entry,entry+k-1,entry+count);
+      std::sort(entry,entry+numKept);
+      return decodeCandidates(entry,numKept,k,pointIDs,dist2);
+    }
+
+    uint64_t *const entry;
+    const int       k;
+    int             count = 0;
+    bool            haveK = false;
+    uint64_t        cutOff;
+  };
+
   /*! runs a k-nearest neighbor operation that tries to fill the
       'currentlyClosest' candidate list (using the number of elemnt k
       and max radius as provided by this class), using the provided
@@ -125,13 +286,22 @@ namespace cukd {
       a point ID of -1. Return value of the function is the _square_
       of the maximum distance among the k closest elements, if at k
       were found; or the _square_ of the max search radius provided
-      for the query */
-  template<typename point_t, typename CandidateList>
-  inline __device__
+      for the query. If a predicate is provided, only points for which
+      accept(pointID,point) returns true are considered (see
+      cpukd/filtered.h). For metrics other than the default L2, all
+      "squared" distances above (including those stored in the
+      candidate list) are in that metric's reduced form instead (see
+      cpukd/metrics.h). */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename Metric=metrics::L2<scalar_t,numDims>,
+           typename CandidateList, typename Predicate=AcceptAll>
+  inline
   float knn(CandidateList &currentlyClosest,
             point_t queryPoint,
             const point_t *d_nodes,
-            int N)
+            int N,
+            const Predicate &accept=Predicate(),
+            const Metric &metric=Metric())
   {
     float maxRadius2 = currentlyClosest.maxRadius2();
 
@@ -155,16 +325,17 @@ namespace cukd {
       const int  child = 2*curr+1;
       const bool from_child = (prev >= child);
       if (!from_child) {
-        float dist2 = sqr_distance(queryPoint,d_nodes[curr]);
-        if (dist2 <= maxRadius2) {
+        float dist2 = metric.reducedDistance((const scalar_t*)&queryPoint,
+                                             (const scalar_t*)&d_nodes[curr]);
+        if (dist2 <= maxRadius2 && accept(curr,d_nodes[curr])) {
           currentlyClosest.push(dist2,curr);
           maxRadius2 = currentlyClosest.maxRadius2();
         }
       }
 
       const auto &curr_node = d_nodes[curr];
-      const int   curr_dim = BinaryTree::levelOf(curr) % point_traits<point_t>::numDims;
-      const float curr_dim_dist = (&queryPoint.x)[curr_dim] - (&curr_node.x)[curr_dim];
+      const int   curr_dim = levelOf(curr) % numDims;
+      const float curr_dim_dist = ((scalar_t*)&queryPoint)[curr_dim] - ((scalar_t*)&curr_node)[curr_dim];
       const int   curr_side = curr_dim_dist > 0.f;
       const int   curr_close_child = 2*curr + 1 + curr_side;
       const int   curr_far_child   = 2*curr + 2 - curr_side;
@@ -175,7 +346,8 @@ namespace cukd {
         // the far side - but only if this exists, and if far half of
         // current space if even within search radius.
         next
-          = ((curr_far_child<N) && ((curr_dim_dist*curr_dim_dist) <= maxRadius2))
+          = ((curr_far_child<N)
+             && (metric.reducedPlaneDistance(curr_dim_dist,curr_dim) <= maxRadius2))
           ? curr_far_child
           : parent;
       else if (prev == curr_far_child)
@@ -208,6 +380,72 @@ namespace cukd {
       curr = next;
     }
   }
-  
-} // ::cukd
+
+  /*! largest k for which knnRuntimeK() uses a SortedCandidateList,
+      and a RuntimeHeapCandidateList, respectively; larger k use a
+      BufferedCandidateList (see testing/float3-largek.cpp) */
+  enum { maxSortedListK = 32, maxHeapListK = 64 };
+
+  /*! same as knnRuntimeK() (below), but with the max search radius
+      given in the metric's reduced form (eg, as passed around between
+      processes by cpukd/shardworkers.h) */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename Metric=metrics::L2<scalar_t,numDims>,
+           typename Predicate=AcceptAll>
+  inline
+  int knnRuntimeKReduced(int *d_pointIDs,
+                         float *d_dist2,
+                         int k,
+                         uint64_t *d_storage,
+                         point_t queryPoint,
+                         const point_t *d_nodes,
+                         int N,
+                         float maxDist2,
+                         const Predicate &accept=Predicate(),
+                         const Metric &metric=Metric())
+  {
+    if (k <= 0) return 0;
+    if (k <= maxSortedListK) {
+      SortedCandidateList list(d_storage,k,maxDist2);
+      knn<point_t,scalar_t,numDims,Metric>(list,queryPoint,d_nodes,N,accept,metric);
+      return list.finish(d_pointIDs,d_dist2);
+    } else if (k <= maxHeapListK) {
+      RuntimeHeapCandidateList list(d_storage,k,maxDist2);
+      knn<point_t,scalar_t,numDims,Metric>(list,queryPoint,d_nodes,N,accept,metric);
+      return list.finish(d_pointIDs,d_dist2);
+    } else {
+      BufferedCandidateList list(d_storage,k,maxDist2);
+      knn<point_t,scalar_t,numDims,Metric>(list,queryPoint,d_nodes,N,accept,metric);
+      return list.finish(d_pointIDs,d_dist2);
+    }
+  }
+
+  /*! knn() with k chosen at runtime: writes the (up to) k points
+      closest to the query point and within maxRadius (a regular,
+      non-reduced distance) into d_pointIDs[0..k) and, if non-null,
+      their squared (or reduced) distances into d_dist2[0..k), sorted
+      by distance; unused entries get ID -1. d_storage must have
+      runtimeKStorageSize(k) entries. Returns the number of points
+      found. */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename Metric=metrics::L2<scalar_t,numDims>,
+           typename Predicate=AcceptAll>
+  inline
+  int knnRuntimeK(int *d_pointIDs,
+                  float *d_dist2,
+                  int k,
+                  uint64_t *d_storage,
+                  point_t queryPoint,
+                  const point_t *d_nodes,
+                  int N,
+                  float maxRadius=std::numeric_limits<float>::infinity(),
+                  const Predicate &accept=Predicate(),
+                  const Metric &metric=Metric())
+  {
+    return knnRuntimeKReduced<point_t,scalar_t,numDims,Metric>
+      (d_pointIDs,d_dist2,k,d_storage,queryPoint,d_nodes,N,
+       (float)metric.toReduced((scalar_t)maxRadius),accept,metric);
+  }
+
+} // ::cpukd
 
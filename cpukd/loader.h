@@ -0,0 +1,509 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* loading point clouds from files, directly into an array of point_t
+   that can then be handed to buildTree() as is. Files get memory
+   mapped, and parsed in parallel chunks. Supported formats are
+
+   - raw binary: the file is a plain array of point_t's;
+
+   - ASCII XYZ: one point per line, with whitespace- or
+     comma-separated numbers; the first numbers of each line fill the
+     point_t's scalars in order (eg, "x y z" for a float3, or "x y z
+     intensity" for a float4), missing values are zero, extra ones
+     get ignored, and anything that's not a number throws (naming the
+     line). Empty lines and lines starting with '#' are skipped;
+
+   - binary (little-endian) PLY: the given 'vertex' properties (by
+     default, "x", "y", "z") fill the point_t's scalars, in order;
+     properties can be of any of the PLY scalar types.
+
+   As everywhere else in this library, point_t is assumed to be an
+   array of scalar_t's (coordinates first, then payload). */
+
+#pragma once
+
+#include "cpukd/common.h"
+#include "cpukd/parallel_for.h"
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#ifdef _WIN32
+# include <fstream>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace cpukd {
+  namespace loader {
+
+    // ==================================================================
+    // INTERFACE SECTION
+    // ==================================================================
+
+    /*! a file's content, read-only, memory-mapped where available */
+    struct MappedFile {
+      MappedFile(const std::string &fileName);
+      ~MappedFile();
+      MappedFile(const MappedFile &) = delete;
+      MappedFile &operator=(const MappedFile &) = delete;
+
+      const char *data = nullptr;
+      size_t      size = 0;
+#ifdef _WIN32
+      std::vector<char> buffer;
+#endif
+    };
+
+    /*! loads a raw binary file of point_t's */
+    template<typename point_t, typename scalar_t=float>
+    void loadRaw(std::vector<point_t> &points,
+                 const std::string &fileName);
+
+    /*! loads an ASCII XYZ file (see above) */
+    template<typename point_t, typename scalar_t=float>
+    void loadXYZ(std::vector<point_t> &points,
+                 const std::string &fileName);
+
+    /*! loads the given vertex properties from a binary PLY file; at
+        most sizeof(point_t)/sizeof(scalar_t) of them */
+    template<typename point_t, typename scalar_t=float>
+    void loadPLY(std::vector<point_t> &points,
+                 const std::string &fileName,
+                 const std::vector<std::string> &properties = { "x","y","z" });
+
+    /*! loads a file in whichever of the above formats its extension
+        says (".xyz", ".ply", anything else is raw) */
+    template<typename point_t, typename scalar_t=float>
+    void loadPoints(std::vector<point_t> &points,
+                    const std::string &fileName);
+
+    // ==================================================================
+    // IMPLEMENTATION SECTION
+    // ==================================================================
+
+#ifdef _WIN32
+    inline MappedFile::MappedFile(const std::string &fileName)
+    {
+      std::ifstream in(fileName,std::ios::binary|std::ios::ate);
+      if (!in.good())
+        throw std::runtime_error("loader: could not open '"+fileName+"'");
+      buffer.resize((size_t)in.tellg());
+      in.seekg(0);
+      in.read(buffer.data(),buffer.size());
+      data = buffer.data();
+      size = buffer.size();
+    }
+    inline MappedFile::~MappedFile() {}
+#else
+    inline MappedFile::MappedFile(const std::string &fileName)
+    {
+      int fd = open(fileName.c_str(),O_RDONLY);
+      if (fd < 0)
+        throw std::runtime_error("loader: could not open '"+fileName+"'");
+      struct stat st;
+      if (fstat(fd,&st) != 0) {
+        close(fd);
+        throw std::runtime_error("loader: could not stat '"+fileName+"'");
+      }
+      size = (size_t)st.st_size;
+      if (size > 0) {
+        void *mem = mmap(nullptr,size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (mem == MAP_FAILED) {
+          close(fd);
+          throw std::runtime_error("loader: could not mmap '"+fileName+"'");
+        }
+        madvise(mem,size,MADV_SEQUENTIAL);
+        data = (const char *)mem;
+      }
+      close(fd);
+    }
+    inline MappedFile::~MappedFile()
+    {
+      if (data) munmap((void*)data,size);
+    }
+#endif
+
+    /*! size of the chunks the input gets split into for parallel
+        processing */
+    enum { chunkSize = 4<<20 };
+
+    template<typename point_t, typename scalar_t>
+    void loadRaw(std::vector<point_t> &points,
+                 const std::string &fileName)
+    {
+      MappedFile file(fileName);
+      if (file.size % sizeof(point_t))
+        throw std::runtime_error("loader: size of '"+fileName
+                                 +"' is not a multiple of the point size");
+      points.resize(file.size / sizeof(point_t));
+      common::parallel_for_blocked
+        (0,file.size,chunkSize,
+         [&](size_t begin, size_t end) {
+           memcpy((char*)points.data()+begin,file.data+begin,end-begin);
+         });
+    }
+
+    // ------------------------------------------------------------------
+    // ascii xyz
+    // ------------------------------------------------------------------
+
+    inline bool isBlank(char c)
+    { return c == ' ' || c == '\t' || c == '\r' || c == ','; }
+
+    /*! parses a decimal floating point number starting at 'p', and
+        advances 'p' past it; returns false (without advancing) if
+        there isn't any. Computes the value from (at most 19 digits of)
+        its decimal mantissa and exponent in double precision, which is
+        much faster than strtod(), and for float results exact in all
+        but (extremely) rare double-rounding cases */
+    inline bool parseNumber(const char *&p, const char *end, double &value)
+    {
+      static const double powersOf10[]
+        = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+      const char *s = p;
+      bool negative = false;
+      if (s < end && (*s == '-' || *s == '+')) negative = (*s++ == '-');
+      uint64_t mantissa  = 0;
+      int      numDigits = 0;
+      int      exponent  = 0;
+      bool     anyDigits = false;
+      for (;s < end && *s >= '0' && *s <= '9';s++) {
+        anyDigits = true;
+        if (numDigits < 19) { mantissa = 10*mantissa+(*s-'0'); if (mantissa) numDigits++; }
+        else exponent++;
+      }
+      if (s < end && *s == '.')
+        for (++s;s < end && *s >= '0' && *s <= '9';s++) {
+          anyDigits = true;
+          if (numDigits < 19) { mantissa = 10*mantissa+(*s-'0'); if (mantissa) numDigits++; exponent--; }
+        }
+      if (!anyDigits) return false;
+      if (s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s+1;
+        bool negExp = false;
+        if (e < end && (*e == '-' || *e == '+')) negExp = (*e++ == '-');
+        if (e < end && *e >= '0' && *e <= '9') {
+          int exp = 0;
+          for (;e < end && *e >= '0' && *e <= '9';e++)
+            exp = std::min(10*exp+(*e-'0'),100000);
+          exponent += negExp ? -exp : exp;
+          s = e;
+        }
+      }
+      value = (double)mantissa;
+      if (exponent < 0 && exponent >= -22)
+        value /= powersOf10[-exponent];
+      else if (exponent > 0 && exponent <= 22)
+        value *= powersOf10[exponent];
+      else if (exponent != 0)
+        value *= pow(10.,exponent);
+      if (negative) value = -value;
+      p = s;
+      return true;
+    }
+
+    /*! finds end of the line starting at 'p', and whether that line
+        has a point on it (ie, is neither empty nor a comment) */
+    inline const char *scanLine(const char *p, const char *end, bool &isPoint)
+    {
+      while (p < end && isBlank(*p)) p++;
+      isPoint = (p < end && *p != '\n' && *p != '#');
+      const char *eol = (const char *)memchr(p,'\n',end-p);
+      return eol ? eol : end;
+    }
+
+    template<typename point_t, typename scalar_t>
+    void loadXYZ(std::vector<point_t> &points,
+                 const std::string &fileName)
+    {
+      enum { numScalars = sizeof(point_t)/sizeof(scalar_t) };
+      MappedFile file(fileName);
+      const char *const fileEnd = file.data+file.size;
+
+      // chunk boundaries, each moved to the beginning of a line
+      const size_t numChunks = std::max(size_t(1),common::divRoundUp(file.size,size_t(chunkSize)));
+      std::vector<const char *> chunkBegin(numChunks+1);
+      chunkBegin[0] = file.data;
+      chunkBegin[numChunks] = fileEnd;
+      for (size_t i=1;i<numChunks;i++) {
+        const char *p = file.data+i*chunkSize-1;
+        const char *eol = (const char *)memchr(p,'\n',fileEnd-p);
+        chunkBegin[i] = std::max(chunkBegin[i-1],eol ? eol+1 : fileEnd);
+      }
+
+      // pass 1: count points and lines per chunk, and compute each
+      // chunk's first point and (for error messages) first line
+      std::vector<size_t> chunkOffset(numChunks+1,0);
+      std::vector<size_t> chunkFirstLine(numChunks+1,0);
+      common::parallel_for
+        (numChunks,
+         [&](size_t chunkID) {
+           size_t count = 0, numLines = 0;
+           for (const char *p = chunkBegin[chunkID];p < chunkBegin[chunkID+1];numLines++) {
+             bool isPoint;
+             p = scanLine(p,chunkBegin[chunkID+1],isPoint)+1;
+             count += isPoint;
+           }
+           chunkOffset[chunkID+1]    = count;
+           chunkFirstLine[chunkID+1] = numLines;
+         });
+      for (size_t i=0;i<numChunks;i++) {
+        chunkOffset[i+1]    += chunkOffset[i];
+        chunkFirstLine[i+1] += chunkFirstLine[i];
+      }
+      points.resize(chunkOffset[numChunks]);
+
+      // pass 2: parse each chunk's points right into place; a chunk
+      // stops at its first malformed line, and we report the first
+      // one of all chunks' (0 meaning none; lines count from 1)
+      std::atomic<size_t> firstBadLine(0);
+      common::parallel_for
+        (numChunks,
+         [&](size_t chunkID) {
+           point_t *out = points.data()+chunkOffset[chunkID];
+           const char *const end = chunkBegin[chunkID+1];
+           size_t line = chunkFirstLine[chunkID];
+           for (const char *p = chunkBegin[chunkID];p < end;) {
+             ++line;
+             bool isPoint;
+             const char *eol = scanLine(p,end,isPoint);
+             if (isPoint) {
+               scalar_t *scalars = (scalar_t *)out++;
+               int numParsed = 0;
+               while (numParsed < numScalars) {
+                 while (p < eol && isBlank(*p)) p++;
+                 if (p == eol || *p == '#') break;
+                 double value;
+                 // a number has to be followed by a separator (or
+                 // the end of the line) to count as one
+                 if (!parseNumber(p,eol,value) || (p < eol && !isBlank(*p) && *p != '#')) {
+                   size_t prev = firstBadLine.load();
+                   while ((prev == 0 || line < prev)
+                          && !firstBadLine.compare_exchange_weak(prev,line))
+                     ;
+                   return;
+                 }
+                 scalars[numParsed++] = (scalar_t)value;
+               }
+               for (;numParsed < numScalars;numParsed++)
+                 scalars[numParsed] = scalar_t(0);
+             }
+             p = eol+1;
+           }
+         });
+      if (firstBadLine)
+        throw std::runtime_error("loader: malformed number on line "
+                                 +std::to_string(firstBadLine.load())
+                                 +" of '"+fileName+"'");
+    }
+
+    // ------------------------------------------------------------------
+    // binary ply
+    // ------------------------------------------------------------------
+
+    enum PLYType { PLY_INVALID=0, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16,
+                   PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+    inline PLYType plyType(const std::string &type)
+    {
+      if (type == "char"   || type == "int8")    return PLY_INT8;
+      if (type == "uchar"  || type == "uint8")   return PLY_UINT8;
+      if (type == "short"  || type == "int16")   return PLY_INT16;
+      if (type == "ushort" || type == "uint16")  return PLY_UINT16;
+      if (type == "int"    || type == "int32")   return PLY_INT32;
+      if (type == "uint"   || type == "uint32")  return PLY_UINT32;
+      if (type == "float"  || type == "float32") return PLY_FLOAT32;
+      if (type == "double" || type == "float64") return PLY_FLOAT64;
+      return PLY_INVALID;
+    }
+
+    inline int plyTypeSize(PLYType type)
+    {
+      switch (type) {
+      case PLY_INT8:    case PLY_UINT8:   return 1;
+      case PLY_INT16:   case PLY_UINT16:  return 2;
+      case PLY_INT32:   case PLY_UINT32:
+      case PLY_FLOAT32:                   return 4;
+      case PLY_FLOAT64:                   return 8;
+      default:                            return 0;
+      }
+    }
+
+    template<typename T, typename scalar_t>
+    inline scalar_t readAs(const char *p)
+    { T t; memcpy(&t,p,sizeof(t)); return (scalar_t)t; }
+
+    template<typename scalar_t>
+    inline scalar_t readPLYScalar(const char *p, PLYType type)
+    {
+      switch (type) {
+      case PLY_INT8:    return readAs<int8_t,  scalar_t>(p);
+      case PLY_UINT8:   return readAs<uint8_t, scalar_t>(p);
+      case PLY_INT16:   return readAs<int16_t, scalar_t>(p);
+      case PLY_UINT16:  return readAs<uint16_t,scalar_t>(p);
+      case PLY_INT32:   return readAs<int32_t, scalar_t>(p);
+      case PLY_UINT32:  return readAs<uint32_t,scalar_t>(p);
+      case PLY_FLOAT32: return readAs<float,   scalar_t>(p);
+      default:          return readAs<double,  scalar_t>(p);
+      }
+    }
+
+    template<typename point_t, typename scalar_t>
+    void loadPLY(std::vector<point_t> &points,
+                 const std::string &fileName,
+                 const std::vector<std::string> &properties)
+    {
+      enum { numScalars = sizeof(point_t)/sizeof(scalar_t) };
+      if (properties.size() > numScalars)
+        throw std::runtime_error("loader: more PLY properties requested than point_t has scalars");
+      MappedFile file(fileName);
+      const char *const fileEnd = file.data+file.size;
+
+      // parse the header
+      const char *p = file.data;
+      auto nextLine = [&]() {
+        const char *eol = (const char *)memchr(p,'\n',fileEnd-p);
+        if (!eol) throw std::runtime_error("loader: truncated PLY header in '"+fileName+"'");
+        std::string line(p,eol);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        p = eol+1;
+        return line;
+      };
+      if (nextLine() != "ply")
+        throw std::runtime_error("loader: '"+fileName+"' is not a PLY file");
+
+      struct Element {
+        std::string name;
+        size_t      count  = 0;
+        size_t      stride = 0;
+        bool        hasLists = false;
+        std::vector<std::pair<std::string,PLYType>> properties;
+      };
+      std::vector<Element> elements;
+      while (1) {
+        std::stringstream line(nextLine());
+        std::string keyword;
+        line >> keyword;
+        if (keyword == "end_header") break;
+        if (keyword == "format") {
+          std::string format;
+          line >> format;
+          if (format != "binary_little_endian")
+            throw std::runtime_error("loader: unsupported PLY format '"+format+"'"
+                                     " (only binary_little_endian is supported)");
+        } else if (keyword == "element") {
+          elements.push_back(Element());
+          line >> elements.back().name >> elements.back().count;
+        } else if (keyword == "property") {
+          if (elements.empty())
+            throw std::runtime_error("loader: PLY property outside of element");
+          std::string type, name;
+          line >> type;
+          if (type == "list") {
+            elements.back().hasLists = true;
+            continue;
+          }
+          line >> name;
+          if (!plyType(type))
+            throw std::runtime_error("loader: unknown PLY type '"+type+"'");
+          elements.back().properties.push_back({name,plyType(type)});
+          elements.back().stride += plyTypeSize(plyType(type));
+        }
+        // everything else (comment, obj_info, ...) gets ignored
+      }
+
+      // find the vertices; elements in front of them must be of fixed
+      // size. Sizes get checked against the bytes left in the file
+      // _before_ moving any pointers (and without overflowing)
+      const char *vertexData = p;
+      const Element *vertices = nullptr;
+      auto fits = [&](const Element &element) {
+        const size_t remaining = size_t(fileEnd-vertexData);
+        return element.stride == 0 || element.count <= remaining/element.stride;
+      };
+      for (auto &element : elements) {
+        if (element.name == "vertex") { vertices = &element; break; }
+        if (element.hasLists)
+          throw std::runtime_error("loader: cannot skip PLY element '"+element.name
+                                   +"' with list properties in front of vertices");
+        if (!fits(element))
+          throw std::runtime_error("loader: truncated PLY file '"+fileName+"'");
+        vertexData += element.count*element.stride;
+      }
+      if (!vertices || vertices->hasLists)
+        throw std::runtime_error("loader: no (list-free) vertex element in '"+fileName+"'");
+      if (!fits(*vertices))
+        throw std::runtime_error("loader: truncated PLY file '"+fileName+"'");
+
+      // offsets and types of the requested properties
+      std::vector<size_t>  offsets;
+      std::vector<PLYType> types;
+      for (auto &requested : properties) {
+        size_t offset = 0;
+        bool found = false;
+        for (auto &prop : vertices->properties) {
+          if (prop.first == requested) {
+            offsets.push_back(offset);
+            types.push_back(prop.second);
+            found = true;
+            break;
+          }
+          offset += plyTypeSize(prop.second);
+        }
+        if (!found)
+          throw std::runtime_error("loader: no vertex property '"+requested+"' in '"+fileName+"'");
+      }
+
+      const size_t stride = vertices->stride;
+      points.resize(vertices->count);
+      common::parallel_for_blocked
+        (0,points.size(),chunkSize/stride+1,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++) {
+             const char *in = vertexData+i*stride;
+             scalar_t *scalars = (scalar_t *)&points[i];
+             for (size_t j=0;j<offsets.size();j++)
+               scalars[j] = readPLYScalar<scalar_t>(in+offsets[j],types[j]);
+             for (size_t j=offsets.size();j<numScalars;j++)
+               scalars[j] = scalar_t(0);
+           }
+         });
+    }
+
+    template<typename point_t, typename scalar_t>
+    void loadPoints(std::vector<point_t> &points,
+                    const std::string &fileName)
+    {
+      auto hasExtension = [&](const std::string &ext) {
+        return fileName.size() >= ext.size()
+          &&   fileName.compare(fileName.size()-ext.size(),ext.size(),ext) == 0;
+      };
+      if (hasExtension(".xyz"))
+        loadXYZ<point_t,scalar_t>(points,fileName);
+      else if (hasExtension(".ply"))
+        loadPLY<point_t,scalar_t>(points,fileName);
+      else
+        loadRaw<point_t,scalar_t>(points,fileName);
+    }
+
+  } // ::cpukd::loader
+} // ::cpukd
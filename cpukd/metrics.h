@@ -0,0 +1,123 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* distance metrics that fcp(), knn(), and radiusQuery() can be
+   templated over. Each metric works on a monotone "reduced" form of
+   its distance (eg, squared distance for L2), so the traversal never
+   has to compute any sqrt's (or pow's); a metric has to provide
+
+   - reducedDistance(a,b): the reduced distance between two points,
+     given as pointers to their numDims coordinates;
+
+   - reducedPlaneDistance(dimDist,dim): a lower bound for the reduced
+     distance to any point on the far side of a splitting plane, given
+     the (signed) distance to that plane in dimension dim;
+
+   - toReduced(dist)/fromReduced(reduced): conversion between the
+     reduced form and the actual distance.
+
+   The default metric everywhere is L2.
+*/
+
+#pragma once
+
+#include "cpukd/common.h"
+
+namespace cpukd {
+  namespace metrics {
+
+    /*! regular euclidean distance; reduced form is squared distance */
+    template<typename scalar_t, int numDims>
+    struct L2 {
+      inline scalar_t reducedDistance(const scalar_t *a, const scalar_t *b) const
+      {
+        scalar_t sum = scalar_t(0);
+        for (int i=0;i<numDims;i++) {
+          const scalar_t d = b[i]-a[i];
+          sum += d*d;
+        }
+        return sum;
+      }
+      inline scalar_t reducedPlaneDistance(scalar_t dimDist, int /*dim*/) const
+      { return dimDist*dimDist; }
+      inline scalar_t toReduced(scalar_t dist) const
+      { return dist*dist; }
+      inline scalar_t fromReduced(scalar_t reduced) const
+      { return common::polymorphic::sqrt(reduced); }
+    };
+
+    /*! euclidean distance with a (non-negative) weight per dimension,
+        ie, sqrt(sum_i weight[i]*(a[i]-b[i])^2) */
+    template<typename scalar_t, int numDims>
+    struct WeightedL2 {
+      inline scalar_t reducedDistance(const scalar_t *a, const scalar_t *b) const
+      {
+        scalar_t sum = scalar_t(0);
+        for (int i=0;i<numDims;i++) {
+          const scalar_t d = b[i]-a[i];
+          sum += weight[i]*d*d;
+        }
+        return sum;
+      }
+      inline scalar_t reducedPlaneDistance(scalar_t dimDist, int dim) const
+      { return weight[dim]*dimDist*dimDist; }
+      inline scalar_t toReduced(scalar_t dist) const
+      { return dist*dist; }
+      inline scalar_t fromReduced(scalar_t reduced) const
+      { return common::polymorphic::sqrt(reduced); }
+
+      scalar_t weight[numDims];
+    };
+
+    /*! manhattan distance; already monotone, so reduced is the same
+        as the actual distance */
+    template<typename scalar_t, int numDims>
+    struct L1 {
+      inline scalar_t reducedDistance(const scalar_t *a, const scalar_t *b) const
+      {
+        scalar_t sum = scalar_t(0);
+        for (int i=0;i<numDims;i++)
+          sum += std::abs(b[i]-a[i]);
+        return sum;
+      }
+      inline scalar_t reducedPlaneDistance(scalar_t dimDist, int /*dim*/) const
+      { return std::abs(dimDist); }
+      inline scalar_t toReduced(scalar_t dist) const
+      { return dist; }
+      inline scalar_t fromReduced(scalar_t reduced) const
+      { return reduced; }
+    };
+
+    /*! chebyshev (L-infinity) distance, ie, max over all dimensions */
+    template<typename scalar_t, int numDims>
+    struct LInf {
+      inline scalar_t reducedDistance(const scalar_t *a, const scalar_t *b) const
+      {
+        scalar_t dist = scalar_t(0);
+        for (int i=0;i<numDims;i++)
+          dist = std::max(dist,std::abs(b[i]-a[i]));
+        return dist;
+      }
+      inline scalar_t reducedPlaneDistance(scalar_t dimDist, int /*dim*/) const
+      { return std::abs(dimDist); }
+      inline scalar_t toReduced(scalar_t dist) const
+      { return dist; }
+      inline scalar_t fromReduced(scalar_t reduced) const
+      { return reduced; }
+    };
+    
+  } // ::cpukd::metrics
+} // ::cpukd
@@ -0,0 +1,279 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* queries in periodic (toroidal) domains: points live in a box that
+   wraps around in every dimension, and all distances are
+   minimum-image distances. The tree itself is a regular tree built
+   with buildTree() - only the traversal needs to know about the
+   wrapping */
+
+#pragma once
+
+#include "cpukd/knn.h"
+
+namespace cpukd {
+  namespace periodic {
+
+    // ==================================================================
+    // INTERFACE SECTION
+    // ==================================================================
+
+    /*! the periodic domain; all data points must lie inside
+        [lower,upper) in each dimension. Query points can be anywhere,
+        they get wrapped into the box */
+    template<typename scalar_t, int numDims>
+    struct PeriodicBox {
+      scalar_t lower[numDims];
+      scalar_t upper[numDims];
+    };
+
+    /*! minimum-image (squared) distance between two points; both
+        points must be inside the box (see wrap()) */
+    template<typename point_t, typename scalar_t, int numDims>
+    scalar_t sqrDistance(const point_t &a, const point_t &b,
+                         const PeriodicBox<scalar_t,numDims> &box);
+
+    /*! periodic version of cpukd::fcp() */
+    template<typename point_t, typename scalar_t, int numDims>
+    int fcp(point_t queryPoint,
+            const PeriodicBox<scalar_t,numDims> &box,
+            const point_t *d_nodes,
+            int N);
+
+    /*! periodic version of cpukd::knn(); same candidate lists, same
+        return value */
+    template<typename point_t, typename scalar_t, int numDims, typename CandidateList>
+    float knn(CandidateList &currentlyClosest,
+              point_t queryPoint,
+              const PeriodicBox<scalar_t,numDims> &box,
+              const point_t *d_nodes,
+              int N);
+
+    /*! periodic version of cpukd::radiusQuery(); radius must be less
+        than half the box size (else a point could be within radius
+        via more than one image, and would get reported only once) */
+    template<typename point_t, typename scalar_t, int numDims, typename ProcessPoint>
+    int radiusQuery(point_t queryPoint,
+                    scalar_t radius,
+                    const PeriodicBox<scalar_t,numDims> &box,
+                    const point_t *d_nodes,
+                    int N,
+                    ProcessPoint &&processPoint);
+
+    // ==================================================================
+    // IMPLEMENTATION SECTION
+    // ==================================================================
+
+    template<typename scalar_t, int numDims>
+    inline scalar_t wrap(scalar_t x, int dim,
+                         const PeriodicBox<scalar_t,numDims> &box)
+    {
+      const scalar_t size = box.upper[dim]-box.lower[dim];
+      x = box.lower[dim] + fmod(x-box.lower[dim],size);
+      if (x <  box.lower[dim]) x += size;
+      if (x >= box.upper[dim]) x -= size;
+      return x;
+    }
+
+    /*! minimum-image distance between (already wrapped) query
+        coordinate q and the interval [lo,hi] in given dimension */
+    template<typename scalar_t, int numDims>
+    inline scalar_t intervalDistance(scalar_t q, scalar_t lo, scalar_t hi, int dim,
+                                     const PeriodicBox<scalar_t,numDims> &box)
+    {
+      const scalar_t size = box.upper[dim]-box.lower[dim];
+      if (q < lo) return std::min(lo-q,size-(hi-q));
+      if (q > hi) return std::min(q-hi,size-(q-lo));
+      return scalar_t(0);
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    inline scalar_t sqrDistance(const point_t &a, const point_t &b,
+                                const PeriodicBox<scalar_t,numDims> &box)
+    {
+      scalar_t dist2 = scalar_t(0);
+      for (int d=0;d<numDims;d++) {
+        const scalar_t size = box.upper[d]-box.lower[d];
+        scalar_t dd = fabs(((const scalar_t*)&a)[d]-((const scalar_t*)&b)[d]);
+        dd = std::min(dd,size-dd);
+        dist2 += dd*dd;
+      }
+      return dist2;
+    }
+
+    /*! generic shrinking-radius traversal for periodic domains. Since
+        a split plane's far side may be closer through the wrap-around
+        than directly, this tracks the full cell bounds of each
+        subtree (initially the box), and culls subtrees by the
+        minimum-image distance to that cell. processPoint(pointID,dist2)
+        gets called for every point within the current max radius, and
+        returns the (possibly smaller) new squared max radius. */
+    template<typename point_t, typename scalar_t, int numDims, typename ProcessPoint>
+    inline void traverse(point_t queryPoint,
+                         scalar_t maxDist2,
+                         const PeriodicBox<scalar_t,numDims> &box,
+                         const point_t *d_nodes,
+                         int N,
+                         ProcessPoint &&processPoint)
+    {
+      if (N == 0) return;
+
+      scalar_t *query = (scalar_t*)&queryPoint;
+      for (int d=0;d<numDims;d++)
+        query[d] = wrap(query[d],d,box);
+
+      struct StackEntry {
+        int      node;
+        scalar_t cellDist2;
+        scalar_t cellLower[numDims];
+        scalar_t cellUpper[numDims];
+      };
+      StackEntry stack[40];
+      int stackPtr = 0;
+
+      scalar_t cellLower[numDims], cellUpper[numDims];
+      for (int d=0;d<numDims;d++) {
+        cellLower[d] = box.lower[d];
+        cellUpper[d] = box.upper[d];
+      }
+      scalar_t cellDist2 = scalar_t(0);
+
+      int curr = 0;
+      while (1) {
+        while (curr < N) {
+          const auto &curr_node = d_nodes[curr];
+          scalar_t dist2 = sqrDistance<point_t,scalar_t,numDims>(queryPoint,curr_node,box);
+          if (dist2 <= maxDist2)
+            maxDist2 = processPoint(curr,dist2);
+
+          const int      curr_dim = levelOf(curr) % numDims;
+          const scalar_t curr_pos = ((const scalar_t*)&curr_node)[curr_dim];
+          const int      curr_side = query[curr_dim] > curr_pos;
+          const int      curr_close_child = 2*curr + 1 + curr_side;
+          const int      curr_far_child   = 2*curr + 2 - curr_side;
+
+          if (curr_far_child<N) {
+            scalar_t far_lower = curr_side ? cellLower[curr_dim] : curr_pos;
+            scalar_t far_upper = curr_side ? curr_pos : cellUpper[curr_dim];
+            scalar_t old_dist
+              = intervalDistance(query[curr_dim],cellLower[curr_dim],cellUpper[curr_dim],curr_dim,box);
+            scalar_t far_dist
+              = intervalDistance(query[curr_dim],far_lower,far_upper,curr_dim,box);
+            scalar_t far_dist2 = cellDist2 - old_dist*old_dist + far_dist*far_dist;
+            if (far_dist2 <= maxDist2) {
+              StackEntry &entry = stack[stackPtr++];
+              entry.node = curr_far_child;
+              entry.cellDist2 = far_dist2;
+              for (int d=0;d<numDims;d++) {
+                entry.cellLower[d] = cellLower[d];
+                entry.cellUpper[d] = cellUpper[d];
+              }
+              entry.cellLower[curr_dim] = far_lower;
+              entry.cellUpper[curr_dim] = far_upper;
+            }
+          }
+
+          // close child: unlike in the non-periodic case, the query
+          // can be outside its own (wrapped) cell, so update the cell
+          // distance, too
+          scalar_t old_dist
+            = intervalDistance(query[curr_dim],cellLower[curr_dim],cellUpper[curr_dim],curr_dim,box);
+          if (curr_side) cellLower[curr_dim] = curr_pos;
+          else           cellUpper[curr_dim] = curr_pos;
+          scalar_t new_dist
+            = intervalDistance(query[curr_dim],cellLower[curr_dim],cellUpper[curr_dim],curr_dim,box);
+          cellDist2 = cellDist2 - old_dist*old_dist + new_dist*new_dist;
+          curr = curr_close_child;
+        }
+        // pop next from stack ...
+        while (1) {
+          if (stackPtr == 0)
+            return;
+          -- stackPtr;
+          const StackEntry &entry = stack[stackPtr];
+          if (entry.cellDist2 > maxDist2)
+            continue;
+          curr      = entry.node;
+          cellDist2 = entry.cellDist2;
+          for (int d=0;d<numDims;d++) {
+            cellLower[d] = entry.cellLower[d];
+            cellUpper[d] = entry.cellUpper[d];
+          }
+          break;
+        }
+      }
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    inline int fcp(point_t queryPoint,
+                   const PeriodicBox<scalar_t,numDims> &box,
+                   const point_t *d_nodes,
+                   int N)
+    {
+      int      closest_found_so_far = -1;
+      scalar_t closest_dist2_found_so_far = std::numeric_limits<scalar_t>::infinity();
+      traverse<point_t,scalar_t,numDims>
+        (queryPoint,closest_dist2_found_so_far,box,d_nodes,N,
+         [&](int pointID, scalar_t dist2) {
+           if (dist2 < closest_dist2_found_so_far) {
+             closest_dist2_found_so_far = dist2;
+             closest_found_so_far       = pointID;
+           }
+           return closest_dist2_found_so_far;
+         });
+      return closest_found_so_far;
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename CandidateList>
+    inline float knn(CandidateList &currentlyClosest,
+                     point_t queryPoint,
+                     const PeriodicBox<scalar_t,numDims> &box,
+                     const point_t *d_nodes,
+                     int N)
+    {
+      float maxRadius2 = currentlyClosest.maxRadius2();
+      traverse<point_t,scalar_t,numDims>
+        (queryPoint,maxRadius2,box,d_nodes,N,
+         [&](int pointID, scalar_t dist2) {
+           currentlyClosest.push(dist2,pointID);
+           maxRadius2 = currentlyClosest.maxRadius2();
+           return maxRadius2;
+         });
+      return maxRadius2;
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename ProcessPoint>
+    inline int radiusQuery(point_t queryPoint,
+                           scalar_t radius,
+                           const PeriodicBox<scalar_t,numDims> &box,
+                           const point_t *d_nodes,
+                           int N,
+                           ProcessPoint &&processPoint)
+    {
+      const scalar_t radius2 = radius*radius;
+      int numFound = 0;
+      traverse<point_t,scalar_t,numDims>
+        (queryPoint,radius2,box,d_nodes,N,
+         [&](int pointID, scalar_t dist2) {
+           processPoint(pointID,dist2);
+           ++numFound;
+           return radius2;
+         });
+      return numFound;
+    }
+
+  } // ::cpukd::periodic
+} // ::cpukd
@@ -0,0 +1,202 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+#include "cpukd/fcp.h"
+#include <stdint.h>
+
+namespace cpukd {
+  namespace quantized {
+
+    // ==================================================================
+    // INTERFACE SECTION
+    // ==================================================================
+
+    /*! a point's coordinates, quantized to 16-bit fixed point relative
+        to the bounds of the entire tree (see QuantizedDomain) */
+    template<int numDims>
+    struct QuantizedPoint { uint16_t bits[numDims]; };
+
+    /*! the mapping between quantized and full-precision coordinates;
+        quantized value 'q' in dimension 'd' stands for the interval
+        [decode(d,q),decode(d,q+1)], and the original coordinate is
+        guaranteed to lie within that interval */
+    template<typename scalar_t, int numDims>
+    struct QuantizedDomain {
+      inline scalar_t decode(int dim, int q) const
+      { return lower[dim] + scalar_t(q) * cellWidth[dim]; }
+
+      scalar_t lower[numDims];
+      scalar_t cellWidth[numDims];
+    };
+
+    /*! creates a compressed, 16-bit fixed-point mirror of the given
+        tree's coordinates (in the same, left-balanced order as
+        d_nodes, so d_quantized[i] is the quantized version of
+        d_nodes[i]), and returns the domain required to decode it. Payload
+        data (ie, anything beyond the first numDims scalars) is not
+        stored in the mirror. d_quantized must have space for N
+        points. */
+    template<typename point_t,
+             typename scalar_t,
+             int      numDims=sizeof(point_t)/sizeof(scalar_t)>
+    QuantizedDomain<scalar_t,numDims>
+    quantizeTree(QuantizedPoint<numDims> *d_quantized,
+                 const point_t *d_nodes,
+                 int N);
+
+    /*! find-closest-point query that traverses the quantized mirror
+        (which is much smaller than d_nodes), using conservative
+        distance bounds derived from the quantization intervals; a
+        point's full-precision coordinates in d_nodes are only
+        fetched if its quantized lower-bound distance beats the
+        current closest distance. Result is exact, ie, the same as
+        cpukd::fcp() on d_nodes (modulo ties). */
+    template<typename point_t, typename scalar_t, int numDims>
+    int fcp(point_t queryPoint,
+            const QuantizedDomain<scalar_t,numDims> &domain,
+            const QuantizedPoint<numDims> *d_quantized,
+            const point_t *d_nodes,
+            int N,
+            int *numPointsRefined=nullptr);
+
+    // ==================================================================
+    // IMPLEMENTATION SECTION
+    // ==================================================================
+
+    template<typename point_t,
+             typename scalar_t,
+             int      numDims>
+    QuantizedDomain<scalar_t,numDims>
+    quantizeTree(QuantizedPoint<numDims> *d_quantized,
+                 const point_t *d_nodes,
+                 int N)
+    {
+      // leave some slack at the upper end, so float rounding in
+      // decode() can never push the last interval below the largest
+      // coordinate
+      const int maxQuantized = 65000;
+
+      QuantizedDomain<scalar_t,numDims> domain;
+      for (int d=0;d<numDims;d++) {
+        scalar_t lo = std::numeric_limits<scalar_t>::infinity();
+        scalar_t hi = -std::numeric_limits<scalar_t>::infinity();
+        for (int i=0;i<N;i++) {
+          scalar_t x = ((const scalar_t*)&d_nodes[i])[d];
+          lo = std::min(lo,x);
+          hi = std::max(hi,x);
+        }
+        if (N == 0) lo = hi = scalar_t(0);
+        domain.lower[d]     = lo;
+        domain.cellWidth[d] = (hi-lo)/scalar_t(maxQuantized);
+      }
+
+      for (int i=0;i<N;i++)
+        for (int d=0;d<numDims;d++) {
+          const scalar_t x  = ((const scalar_t*)&d_nodes[i])[d];
+          const scalar_t w  = domain.cellWidth[d];
+          int q = (w > scalar_t(0)) ? int((x-domain.lower[d])/w) : 0;
+          q = std::max(0,std::min(q,65534));
+          // fix up rounding, using the exact same float ops as the
+          // traversal will use for decoding
+          while (q > 0     && domain.decode(d,q)   > x) --q;
+          while (q < 65534 && domain.decode(d,q+1) < x) ++q;
+          assert(domain.decode(d,q) <= x && x <= domain.decode(d,q+1));
+          d_quantized[i].bits[d] = (uint16_t)q;
+        }
+      return domain;
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    inline
+    int fcp(point_t queryPoint,
+            const QuantizedDomain<scalar_t,numDims> &domain,
+            const QuantizedPoint<numDims> *d_quantized,
+            const point_t *d_nodes,
+            int N,
+            int *numPointsRefined)
+    {
+      if (N == 0) return -1;
+
+      // lower bounds get computed with float rounding, too; scale
+      // them down a tiny bit so we never cull anything that's only
+      // rounding-error away from the closest distance
+      const scalar_t conservative
+        = scalar_t(1) - scalar_t(16)*std::numeric_limits<scalar_t>::epsilon();
+      const scalar_t *query = (const scalar_t*)&queryPoint;
+
+      int      closest_found_so_far = -1;
+      scalar_t closest_dist2_found_so_far = std::numeric_limits<scalar_t>::infinity();
+
+      std::pair<int,scalar_t> stack[40];
+      int stackPtr = 0;
+
+      int curr = 0;
+      while (1) {
+        while (curr < N) {
+          const QuantizedPoint<numDims> &curr_node = d_quantized[curr];
+
+          scalar_t lowerBound2 = scalar_t(0);
+          for (int d=0;d<numDims;d++) {
+            const scalar_t lo = domain.decode(d,curr_node.bits[d]);
+            const scalar_t hi = domain.decode(d,curr_node.bits[d]+1);
+            const scalar_t gap
+              = std::max(scalar_t(0),std::max(lo-query[d],query[d]-hi));
+            lowerBound2 += gap*gap;
+          }
+          if (lowerBound2*conservative < closest_dist2_found_so_far) {
+            if (numPointsRefined) ++*numPointsRefined;
+            scalar_t dist2 = sqrDistance<point_t,scalar_t,numDims>(queryPoint,d_nodes[curr]);
+            if (dist2 < closest_dist2_found_so_far) {
+              closest_dist2_found_so_far = dist2;
+              closest_found_so_far       = curr;
+            }
+          }
+
+          // the true splitting plane lies somewhere in [lo,hi]; pick
+          // the close side based on the center, and bound the
+          // distance to the far side by the interval end on that side
+          const int      curr_dim = levelOf(curr) % numDims;
+          const scalar_t lo = domain.decode(curr_dim,curr_node.bits[curr_dim]);
+          const scalar_t hi = domain.decode(curr_dim,curr_node.bits[curr_dim]+1);
+          const int      curr_side = query[curr_dim] > scalar_t(0.5)*(lo+hi);
+          const int      curr_close_child = 2*curr + 1 + curr_side;
+          const int      curr_far_child   = 2*curr + 2 - curr_side;
+          const scalar_t far_dist
+            = std::max(scalar_t(0),curr_side ? (query[curr_dim]-hi) : (lo-query[curr_dim]));
+          const scalar_t far_dist2 = far_dist*far_dist*conservative;
+
+          if ((curr_far_child<N) && (far_dist2 < closest_dist2_found_so_far))
+            stack[stackPtr++] = { curr_far_child, far_dist2 };
+
+          curr = curr_close_child;
+        }
+        // pop next from stack ...
+        while (1) {
+          if (stackPtr == 0)
+            return closest_found_so_far;
+          -- stackPtr;
+          if (stack[stackPtr].second > closest_dist2_found_so_far)
+            continue;
+          curr = stack[stackPtr].first;
+          break;
+        }
+      }
+    }
+
+  } // ::cpukd::quantized
+} // ::cpukd
@@ -0,0 +1,79 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+#include "cpukd/fcp.h"
+
+namespace cpukd {
+
+  /*! fixed-radius range query: calls 'processPoint(pointID,dist2)'
+      for each point in the left-balanced tree d_nodes that is within
+      'radius' of the query point (with dist2 being that point's
+      _squared_ distance to the query - or, for metrics other than
+      L2, the metric's reduced distance), in no particular
+      order. Returns the number of points found. */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename Metric=metrics::L2<scalar_t,numDims>,
+           typename ProcessPoint>
+  inline
+  int radiusQuery(point_t queryPoint,
+                  scalar_t radius,
+                  const point_t *d_nodes,
+                  int N,
+                  ProcessPoint &&processPoint,
+                  const Metric &metric=Metric())
+  {
+    const scalar_t radius2 = metric.toReduced(radius);
+    int numFound = 0;
+
+    int stack[40];
+    int stackPtr = 0;
+
+    int curr = 0;
+    while (1) {
+      while (curr < N) {
+        const auto &curr_node = d_nodes[curr];
+        scalar_t dist2 = metric.reducedDistance((const scalar_t*)&queryPoint,
+                                                (const scalar_t*)&curr_node);
+        if (dist2 <= radius2) {
+          processPoint(curr,dist2);
+          ++numFound;
+        }
+
+        const int      curr_dim = levelOf(curr) % numDims;
+        const scalar_t curr_dim_dist
+          = ((const scalar_t*)&queryPoint)[curr_dim]
+          - ((const scalar_t*)&curr_node)[curr_dim];
+        const int      curr_side = curr_dim_dist > scalar_t(0);
+        const int      curr_close_child = 2*curr + 1 + curr_side;
+        const int      curr_far_child   = 2*curr + 2 - curr_side;
+
+        // radius doesn't shrink, so can decide on far child right
+        // away, no need to store its distance
+        if ((curr_far_child<N)
+            && (metric.reducedPlaneDistance(curr_dim_dist,curr_dim) <= radius2))
+          stack[stackPtr++] = curr_far_child;
+
+        curr = curr_close_child;
+      }
+      if (stackPtr == 0)
+        return numFound;
+      curr = stack[--stackPtr];
+    }
+  }
+
+} // ::cpukd
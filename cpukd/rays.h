@@ -0,0 +1,326 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* ray and segment proximity queries: all points within a given radius
+   of a ray (or segment), and the first point along a ray, where
+   "first" means the first one whose radius-sized sphere the ray
+   enters (ie, picking points rendered as spheres).
+
+   The traversal keeps the ray's parameter interval [t0,t1] for each
+   subtree, and clips it against the subtree's side of each split
+   plane, with the plane moved outwards by the radius (all points of a
+   subtree are on its side of the plane, so all their spheres are
+   within that padded half-space). Subtrees whose interval becomes
+   empty get skipped; for first-hit queries children get visited front
+   to back, and subtrees that start behind the current hit get
+   skipped, too.
+
+   For floating-point scalar types only. */
+
+#pragma once
+
+#include "cpukd/builder.h"
+#include "cpukd/fcp.h"
+#include "cpukd/parallel_for.h"
+
+namespace cpukd {
+
+  // ==================================================================
+  // INTERFACE SECTION
+  // ==================================================================
+
+  /*! the points origin+t*direction for t in [tMin,tMax]; a segment
+      from A to B is origin=A, direction=B-A, [0,1]. Only the first
+      numDims coordinates of origin and direction get used. */
+  template<typename point_t, typename scalar_t>
+  struct Ray {
+    point_t  origin;
+    point_t  direction;
+    scalar_t tMin = scalar_t(0);
+    scalar_t tMax = std::numeric_limits<scalar_t>::infinity();
+  };
+
+  /*! calls processPoint(pointID,t,dist2) for each point within
+      'radius' of the ray, with t the ray parameter of the point's
+      closest approach (clamped to [tMin,tMax]), and dist2 the
+      squared distance at that t; in no particular order. Returns the
+      number of points found. */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename ProcessPoint>
+  int pointsNearRay(const Ray<point_t,scalar_t> &ray,
+                    scalar_t radius,
+                    const point_t *d_nodes,
+                    int N,
+                    ProcessPoint &&processPoint);
+
+  /*! returns the ID of the point whose sphere of given radius the ray
+      enters first (or -1 if none), and that entry point's ray
+      parameter in tHit; a ray starting inside a sphere enters it at
+      tMin. */
+  template<typename point_t, typename scalar_t, int numDims>
+  int firstPointAlongRay(const Ray<point_t,scalar_t> &ray,
+                         scalar_t radius,
+                         const point_t *d_nodes,
+                         int N,
+                         scalar_t *tHit=nullptr);
+
+  /*! runs pointsNearRay() for each of numRays rays, in parallel;
+      processPoint(rayID,pointID,t,dist2) gets called concurrently
+      from different threads (but for any one ray always from the same
+      thread). d_counts[i] (if non-null) gets ray i's number of points */
+  template<typename point_t, typename scalar_t, int numDims,
+           typename ProcessPoint>
+  void pointsNearRayBatch(int *d_counts,
+                          const Ray<point_t,scalar_t> *d_rays,
+                          int numRays,
+                          scalar_t radius,
+                          const point_t *d_nodes,
+                          int N,
+                          ProcessPoint &&processPoint);
+
+  /*! runs firstPointAlongRay() for each of numRays rays, in parallel;
+      d_tHit may be null */
+  template<typename point_t, typename scalar_t, int numDims>
+  void firstPointAlongRayBatch(int *d_results,
+                               scalar_t *d_tHit,
+                               const Ray<point_t,scalar_t> *d_rays,
+                               int numRays,
+                               scalar_t radius,
+                               const point_t *d_nodes,
+                               int N);
+
+  // ==================================================================
+  // IMPLEMENTATION SECTION
+  // ==================================================================
+
+  namespace rays {
+
+    template<typename point_t, typename scalar_t, int numDims>
+    inline scalar_t sqrDistanceAt(const Ray<point_t,scalar_t> &ray,
+                                  const point_t &point,
+                                  scalar_t t)
+    {
+      const scalar_t *org = (const scalar_t*)&ray.origin;
+      const scalar_t *dir = (const scalar_t*)&ray.direction;
+      const scalar_t *p   = (const scalar_t*)&point;
+      scalar_t dist2 = 0;
+      for (int d=0;d<numDims;d++) {
+        const scalar_t diff = p[d]-(org[d]+t*dir[d]);
+        dist2 += diff*diff;
+      }
+      return dist2;
+    }
+
+    /*! ray parameter of the point's closest approach (unclamped), and
+        the squared distance of the point from the (infinite) line;
+        the latter gets computed from the difference vector rather
+        than as |p-o|^2-t^2|d|^2, which would lose all precision for
+        far-away points and small radii */
+    template<typename point_t, typename scalar_t, int numDims>
+    inline void closestApproach(const Ray<point_t,scalar_t> &ray,
+                                const point_t &point,
+                                scalar_t &t,
+                                scalar_t &lineDist2)
+    {
+      const scalar_t *org = (const scalar_t*)&ray.origin;
+      const scalar_t *dir = (const scalar_t*)&ray.direction;
+      const scalar_t *p   = (const scalar_t*)&point;
+      scalar_t dd = 0, pd = 0;
+      for (int d=0;d<numDims;d++) {
+        dd += dir[d]*dir[d];
+        pd += (p[d]-org[d])*dir[d];
+      }
+      t = dd > scalar_t(0) ? pd/dd : scalar_t(0);
+      lineDist2 = sqrDistanceAt<point_t,scalar_t,numDims>(ray,point,t);
+    }
+
+    /*! clips [t0,t1] to where the ray is on the lower (side=0) or
+        upper (side=1) side of plane 'pos' in dimension dim, with the
+        plane moved outwards by radius */
+    template<typename scalar_t>
+    inline void clip(scalar_t org, scalar_t dir, scalar_t pos, scalar_t radius,
+                     int side, scalar_t &t0, scalar_t &t1)
+    {
+      // lower side: x <= pos+radius; upper side: x >= pos-radius
+      const scalar_t bound = side ? pos-radius : pos+radius;
+      if (dir == scalar_t(0)) {
+        if (side ? org < bound : org > bound) {
+          t0 = std::numeric_limits<scalar_t>::infinity();
+          t1 = -t0;
+        }
+        return;
+      }
+      const scalar_t t = (bound-org)/dir;
+      if ((dir > scalar_t(0)) == (side == 0))
+        t1 = std::min(t1,t);
+      else
+        t0 = std::max(t0,t);
+    }
+
+    template<typename scalar_t>
+    struct StackEntry { int node; scalar_t t0, t1; };
+
+    /*! generic traversal: calls processPoint(node,t0,t1) for each node
+        whose (clipped) interval is non-empty, and that 'cull(t0)'
+        doesn't reject; children get visited front to back */
+    template<typename point_t, typename scalar_t, int numDims,
+             typename ProcessNode, typename Cull>
+    inline void traverse(const Ray<point_t,scalar_t> &ray,
+                         scalar_t radius,
+                         const point_t *d_nodes,
+                         int N,
+                         ProcessNode &&processNode,
+                         Cull &&cull)
+    {
+      const scalar_t *org = (const scalar_t*)&ray.origin;
+      const scalar_t *dir = (const scalar_t*)&ray.direction;
+
+      StackEntry<scalar_t> stack[64];
+      int stackPtr = 0;
+      if (N > 0 && ray.tMin <= ray.tMax)
+        stack[stackPtr++] = { 0, ray.tMin, ray.tMax };
+      while (stackPtr > 0) {
+        StackEntry<scalar_t> curr = stack[--stackPtr];
+        while (curr.node < N) {
+          if (curr.t0 > curr.t1 || cull(curr.t0)) break;
+          const point_t &curr_node = d_nodes[curr.node];
+          processNode(curr.node);
+
+          const int      dim = levelOf(curr.node) % numDims;
+          const scalar_t pos = ((const scalar_t*)&curr_node)[dim];
+          // front = the side the ray is on at the start of the interval
+          const int front = (org[dim]+curr.t0*dir[dim]) > pos;
+          StackEntry<scalar_t> frontChild = { 2*curr.node+1+front,   curr.t0, curr.t1 };
+          StackEntry<scalar_t> backChild  = { 2*curr.node+2-front,   curr.t0, curr.t1 };
+          clip(org[dim],dir[dim],pos,radius,front,  frontChild.t0,frontChild.t1);
+          clip(org[dim],dir[dim],pos,radius,1-front,backChild.t0, backChild.t1);
+          if (backChild.node < N && backChild.t0 <= backChild.t1)
+            stack[stackPtr++] = backChild;
+          curr = frontChild;
+        }
+      }
+    }
+
+  } // ::cpukd::rays
+
+  template<typename point_t, typename scalar_t, int numDims,
+           typename ProcessPoint>
+  inline int pointsNearRay(const Ray<point_t,scalar_t> &ray,
+                           scalar_t radius,
+                           const point_t *d_nodes,
+                           int N,
+                           ProcessPoint &&processPoint)
+  {
+    const scalar_t radius2 = radius*radius;
+    int numFound = 0;
+    rays::traverse<point_t,scalar_t,numDims>
+      (ray,radius,d_nodes,N,
+       [&](int node) {
+         scalar_t t, lineDist2;
+         rays::closestApproach<point_t,scalar_t,numDims>(ray,d_nodes[node],t,lineDist2);
+         if (lineDist2 > radius2) return;
+         scalar_t dist2 = lineDist2;
+         if (t < ray.tMin || t > ray.tMax) {
+           t = std::min(std::max(t,ray.tMin),ray.tMax);
+           dist2 = rays::sqrDistanceAt<point_t,scalar_t,numDims>(ray,d_nodes[node],t);
+           if (dist2 > radius2) return;
+         }
+         processPoint(node,t,dist2);
+         ++numFound;
+       },
+       [](scalar_t) { return false; });
+    return numFound;
+  }
+
+  template<typename point_t, typename scalar_t, int numDims>
+  inline int firstPointAlongRay(const Ray<point_t,scalar_t> &ray,
+                                scalar_t radius,
+                                const point_t *d_nodes,
+                                int N,
+                                scalar_t *tHit)
+  {
+    const scalar_t radius2 = radius*radius;
+    const scalar_t *dir = (const scalar_t*)&ray.direction;
+    scalar_t dd = 0;
+    for (int d=0;d<numDims;d++) dd += dir[d]*dir[d];
+
+    int      closest  = -1;
+    scalar_t closestT = ray.tMax;
+    rays::traverse<point_t,scalar_t,numDims>
+      (ray,radius,d_nodes,N,
+       [&](int node) {
+         scalar_t t, lineDist2;
+         rays::closestApproach<point_t,scalar_t,numDims>(ray,d_nodes[node],t,lineDist2);
+         if (lineDist2 > radius2) return;
+         // sphere is entered at t-halfChord, and left at t+halfChord
+         const scalar_t halfChord
+           = dd > scalar_t(0) ? std::sqrt((radius2-lineDist2)/dd) : scalar_t(0);
+         if (t+halfChord < ray.tMin) return;
+         const scalar_t tEnter = std::max(ray.tMin,t-halfChord);
+         if (tEnter > closestT || (tEnter == closestT && closest >= 0 && node > closest))
+           return;
+         closest  = node;
+         closestT = tEnter;
+       },
+       [&](scalar_t t0) { return t0 > closestT; });
+    if (tHit) *tHit = closestT;
+    return closest;
+  }
+
+  template<typename point_t, typename scalar_t, int numDims,
+           typename ProcessPoint>
+  void pointsNearRayBatch(int *d_counts,
+                          const Ray<point_t,scalar_t> *d_rays,
+                          int numRays,
+                          scalar_t radius,
+                          const point_t *d_nodes,
+                          int N,
+                          ProcessPoint &&processPoint)
+  {
+    common::parallel_for_blocked
+      (0,numRays,64,
+       [&](size_t begin, size_t end) {
+         for (size_t i=begin;i<end;i++) {
+           const int rayID = (int)i;
+           const int count = pointsNearRay<point_t,scalar_t,numDims>
+             (d_rays[i],radius,d_nodes,N,
+              [&](int pointID, scalar_t t, scalar_t dist2) {
+                processPoint(rayID,pointID,t,dist2);
+              });
+           if (d_counts) d_counts[i] = count;
+         }
+       });
+  }
+
+  template<typename point_t, typename scalar_t, int numDims>
+  void firstPointAlongRayBatch(int *d_results,
+                               scalar_t *d_tHit,
+                               const Ray<point_t,scalar_t> *d_rays,
+                               int numRays,
+                               scalar_t radius,
+                               const point_t *d_nodes,
+                               int N)
+  {
+    common::parallel_for_blocked
+      (0,numRays,256,
+       [&](size_t begin, size_t end) {
+         for (size_t i=begin;i<end;i++)
+           d_results[i] = firstPointAlongRay<point_t,scalar_t,numDims>
+             (d_rays[i],radius,d_nodes,N,d_tHit ? d_tHit+i : nullptr);
+       });
+  }
+
+} // ::cpukd
@@ -0,0 +1,328 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* brute-force reference results for fcp, knn, and radius queries, to
+   check the trees' traversals against (see testing/differential.cpp).
+
+   The points' coordinates get copied into one array per dimension,
+   and each query computes the distances to a block of points at a
+   time, in a loop over that block that the compiler can vectorize;
+   the batch versions then run many queries in parallel. Distances
+   are summed up in the same order (and with the same rounding) as
+   sqrDistance() does, so results can be compared exactly; ties are
+   broken by lower point ID, as in the knn candidate lists.
+
+   Other metrics (see cpukd/metrics.h; or anything else with a
+   reducedDistance(a,b) and toReduced(r)) get computed with the
+   metric's own reducedDistance(), one point at a time, so they also
+   match the traversals exactly, but don't get vectorized. All
+   distances are then in the metric's reduced form. */
+
+#pragma once
+
+#include "cpukd/fcp.h"
+#include "cpukd/metrics.h"
+#include "cpukd/parallel_for.h"
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace cpukd {
+  namespace reference {
+
+    // ==================================================================
+    // INTERFACE SECTION
+    // ==================================================================
+
+    template<typename point_t, typename scalar_t, int numDims,
+             typename Metric=metrics::L2<scalar_t,numDims>>
+    class BruteForce {
+    public:
+      /*! number of points whose distances get computed in one go */
+      enum { blockSize = 1024 };
+
+      /*! copies the coordinates of the N given points (in any order;
+          all IDs returned refer to that array) */
+      BruteForce(const point_t *d_points, int N,
+                 const Metric &metric=Metric());
+
+      /*! returns the ID of the closest point (the lowest such ID, on
+          ties), or -1 if there are no points; its (reduced) distance
+          goes to *dist2 if non-null */
+      int fcp(point_t queryPoint, scalar_t *dist2=nullptr) const;
+
+      /*! writes the (up to) k points closest to the query point and
+          within maxRadius to d_pointIDs[0..k) and, if non-null, their
+          (reduced) distances to d_dist2[0..k), sorted by distance, then
+          ID; unused entries get ID -1. Returns the number found. */
+      int knn(int *d_pointIDs,
+              scalar_t *d_dist2,
+              int k,
+              point_t queryPoint,
+              scalar_t maxRadius=std::numeric_limits<scalar_t>::infinity()) const;
+
+      /*! returns the number of points within 'radius' of the query
+          point, and (if non-null) appends their IDs, in increasing
+          order, to *pointIDs */
+      int radiusQuery(point_t queryPoint,
+                      scalar_t radius,
+                      std::vector<int> *pointIDs=nullptr) const;
+
+      /*! fcp() for each of the numQueries d_queries[], in parallel;
+          d_dist2 may be null */
+      void fcpBatch(int *d_results,
+                    scalar_t *d_dist2,
+                    const point_t *d_queries,
+                    int numQueries) const;
+
+      /*! knn() for each of the numQueries d_queries[], in parallel;
+          query i's results go to d_pointIDs[i*k..i*k+k) and (if
+          non-null) d_dist2[i*k..i*k+k) */
+      void knnBatch(int *d_pointIDs,
+                    scalar_t *d_dist2,
+                    int k,
+                    const point_t *d_queries,
+                    int numQueries,
+                    scalar_t maxRadius=std::numeric_limits<scalar_t>::infinity()) const;
+
+      /*! radiusQuery() for each of the numQueries d_queries[], in
+          parallel; writes the counts to d_counts[] */
+      void countBatch(int *d_counts,
+                      scalar_t radius,
+                      const point_t *d_queries,
+                      int numQueries) const;
+
+      const int numPoints;
+
+    private:
+      /*! (reduced) distances of points [begin,end) (at most blockSize
+          of them) to the query, into d_dist2[0..end-begin) */
+      inline void blockDistances(scalar_t *d_dist2,
+                                 const scalar_t *query,
+                                 int begin, int end) const
+      { blockDistances(d_dist2,query,begin,end,metric); }
+      /*! L2: one dimension at a time, vectorizable */
+      inline void blockDistances(scalar_t *d_dist2,
+                                 const scalar_t *query,
+                                 int begin, int end,
+                                 const metrics::L2<scalar_t,numDims> &) const;
+      /*! any other metric: one point at a time */
+      template<typename OtherMetric>
+      inline void blockDistances(scalar_t *d_dist2,
+                                 const scalar_t *query,
+                                 int begin, int end,
+                                 const OtherMetric &other) const;
+
+      const Metric          metric;
+      /*! coords[dim*numPoints+pointID] */
+      std::vector<scalar_t> coords;
+    };
+
+    // ==================================================================
+    // IMPLEMENTATION SECTION
+    // ==================================================================
+
+    template<typename point_t, typename scalar_t, int numDims, typename Metric>
+    BruteForce<point_t,scalar_t,numDims,Metric>::BruteForce(const point_t *d_points, int N,
+                                                            const Metric &metric)
+      : numPoints(N),
+        metric(metric),
+        coords(size_t(N)*numDims)
+    {
+      common::parallel_for_blocked
+        (0,N,16*1024,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++)
+             for (int d=0;d<numDims;d++)
+               coords[d*size_t(N)+i] = ((const scalar_t*)&d_points[i])[d];
+         });
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename Metric>
+    inline void BruteForce<point_t,scalar_t,numDims,Metric>
+    ::blockDistances(scalar_t *d_dist2,
+                     const scalar_t *query,
+                     int begin, int end,
+                     const metrics::L2<scalar_t,numDims> &) const
+    {
+      const int count = end-begin;
+      for (int i=0;i<count;i++)
+        d_dist2[i] = scalar_t(0);
+      // one dimension at a time, so the inner loops are plain
+      // streams over contiguous arrays
+      for (int d=0;d<numDims;d++) {
+        const scalar_t *coord = coords.data()+d*size_t(numPoints)+begin;
+        const scalar_t  q     = query[d];
+        for (int i=0;i<count;i++) {
+          const scalar_t diff = coord[i]-q;
+          d_dist2[i] += diff*diff;
+        }
+      }
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename Metric>
+    template<typename OtherMetric>
+    inline void BruteForce<point_t,scalar_t,numDims,Metric>
+    ::blockDistances(scalar_t *d_dist2,
+                     const scalar_t *query,
+                     int begin, int end,
+                     const OtherMetric &other) const
+    {
+      for (int i=0;i<end-begin;i++) {
+        scalar_t point[numDims];
+        for (int d=0;d<numDims;d++)
+          point[d] = coords[d*size_t(numPoints)+begin+i];
+        // same argument order as the traversals
+        d_dist2[i] = other.reducedDistance(query,point);
+      }
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename Metric>
+    int BruteForce<point_t,scalar_t,numDims,Metric>::fcp(point_t queryPoint, scalar_t *dist2) const
+    {
+      const scalar_t *query = (const scalar_t*)&queryPoint;
+      scalar_t blockDist2[blockSize];
+      scalar_t closestDist2 = std::numeric_limits<scalar_t>::infinity();
+      int      closestID    = -1;
+      for (int begin=0;begin<numPoints;begin+=blockSize) {
+        const int end = std::min(numPoints,begin+blockSize);
+        blockDistances(blockDist2,query,begin,end);
+        // min first (vectorizable), then find the first point at that
+        // distance only if the block has anything closer
+        scalar_t blockMin = blockDist2[0];
+        for (int i=1;i<end-begin;i++)
+          blockMin = std::min(blockMin,blockDist2[i]);
+        if (blockMin >= closestDist2 && closestID >= 0)
+          continue;
+        for (int i=0;i<end-begin;i++)
+          if (blockDist2[i] == blockMin) {
+            closestID = begin+i;
+            break;
+          }
+        closestDist2 = blockMin;
+      }
+      if (dist2) *dist2 = closestDist2;
+      return closestID;
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename Metric>
+    int BruteForce<point_t,scalar_t,numDims,Metric>::knn(int *d_pointIDs,
+                                                  scalar_t *d_dist2,
+                                                  int k,
+                                                  point_t queryPoint,
+                                                  scalar_t maxRadius) const
+    {
+      if (k <= 0) return 0;
+      const scalar_t *query = (const scalar_t*)&queryPoint;
+      scalar_t blockDist2[blockSize];
+      // same idea as BufferedCandidateList: collect everything no
+      // farther than the current k-th closest, and cut back to k
+      // whenever there are 2k candidates
+      std::vector<std::pair<scalar_t,int>> candidates;
+      candidates.reserve(2*k+blockSize);
+      scalar_t threshold = metric.toReduced(maxRadius);
+      for (int begin=0;begin<numPoints;begin+=blockSize) {
+        const int end = std::min(numPoints,begin+blockSize);
+        blockDistances(blockDist2,query,begin,end);
+        for (int i=0;i<end-begin;i++)
+          if (blockDist2[i] <= threshold)
+            candidates.push_back({blockDist2[i],begin+i});
+        if ((int)candidates.size() >= 2*k) {
+          std::nth_element(candidates.begin(),candidates.begin()+(k-1),candidates.end());
+          candidates.resize(k);
+          threshold = candidates[k-1].first;
+        }
+      }
+      std::sort(candidates.begin(),candidates.end());
+      const int numFound = std::min(k,(int)candidates.size());
+      for (int i=0;i<k;i++) {
+        d_pointIDs[i] = i < numFound ? candidates[i].second : -1;
+        if (d_dist2)
+          d_dist2[i] = i < numFound ? candidates[i].first : threshold;
+      }
+      return numFound;
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename Metric>
+    int BruteForce<point_t,scalar_t,numDims,Metric>::radiusQuery(point_t queryPoint,
+                                                          scalar_t radius,
+                                                          std::vector<int> *pointIDs) const
+    {
+      const scalar_t *query = (const scalar_t*)&queryPoint;
+      const scalar_t radius2 = metric.toReduced(radius);
+      scalar_t blockDist2[blockSize];
+      int numFound = 0;
+      for (int begin=0;begin<numPoints;begin+=blockSize) {
+        const int end = std::min(numPoints,begin+blockSize);
+        blockDistances(blockDist2,query,begin,end);
+        int blockCount = 0;
+        for (int i=0;i<end-begin;i++)
+          blockCount += (blockDist2[i] <= radius2);
+        numFound += blockCount;
+        if (pointIDs && blockCount)
+          for (int i=0;i<end-begin;i++)
+            if (blockDist2[i] <= radius2)
+              pointIDs->push_back(begin+i);
+      }
+      return numFound;
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename Metric>
+    void BruteForce<point_t,scalar_t,numDims,Metric>::fcpBatch(int *d_results,
+                                                        scalar_t *d_dist2,
+                                                        const point_t *d_queries,
+                                                        int numQueries) const
+    {
+      common::parallel_for_blocked
+        (0,numQueries,16,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++)
+             d_results[i] = fcp(d_queries[i],d_dist2 ? d_dist2+i : nullptr);
+         });
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename Metric>
+    void BruteForce<point_t,scalar_t,numDims,Metric>::knnBatch(int *d_pointIDs,
+                                                        scalar_t *d_dist2,
+                                                        int k,
+                                                        const point_t *d_queries,
+                                                        int numQueries,
+                                                        scalar_t maxRadius) const
+    {
+      common::parallel_for_blocked
+        (0,numQueries,16,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++)
+             knn(d_pointIDs+i*k,d_dist2 ? d_dist2+i*k : nullptr,k,d_queries[i],maxRadius);
+         });
+    }
+
+    template<typename point_t, typename scalar_t, int numDims, typename Metric>
+    void BruteForce<point_t,scalar_t,numDims,Metric>::countBatch(int *d_counts,
+                                                          scalar_t radius,
+                                                          const point_t *d_queries,
+                                                          int numQueries) const
+    {
+      common::parallel_for_blocked
+        (0,numQueries,16,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++)
+             d_counts[i] = radiusQuery(d_queries[i],radius);
+         });
+    }
+
+  } // ::cpukd::reference
+} // ::cpukd
@@ -0,0 +1,142 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* many small, independent trees over one segmented point array: tree
+   i is a regular left-balanced tree over the points
+   d_points[d_offsets[i]..d_offsets[i+1]), built in place, so each
+   segment can also be used with all the regular (single-tree)
+   traversals by simply passing d_points+d_offsets[i] */
+
+#pragma once
+
+#include "cpukd/builder.h"
+#include "cpukd/fcp.h"
+#include "cpukd/parallel_for.h"
+
+namespace cpukd {
+  namespace segmented {
+
+    // ==================================================================
+    // INTERFACE SECTION
+    // ==================================================================
+
+    /*! builds one tree for each of the numTrees segments of d_points;
+        d_offsets must have numTrees+1 entries, with d_offsets[0]=0
+        and d_offsets[numTrees] the total number of points. All trees
+        get built in parallel, with larger segments scheduled first,
+        and scratch memory shared by all segments of a task. If
+        'stats' is non-null, each tree's build gets recorded there. */
+    template<typename point_t,
+             typename scalar_t,
+             int      numDims=sizeof(point_t)/sizeof(scalar_t)>
+    void buildTrees(point_t *d_points,
+                    const int *d_offsets,
+                    int numTrees,
+                    BuildStats *stats=nullptr);
+
+    /*! runs fcp() for each of the numQueries d_queries[], in tree
+        d_treeIDs[i]; d_results[i] is the index of the closest point
+        in the (entire) d_points array, or -1 if that tree is empty */
+    template<typename point_t, typename scalar_t, int numDims>
+    void fcpBatch(int *d_results,
+                  const point_t *d_queries,
+                  const int *d_treeIDs,
+                  int numQueries,
+                  const point_t *d_points,
+                  const int *d_offsets);
+
+    // ==================================================================
+    // IMPLEMENTATION SECTION
+    // ==================================================================
+
+    /*! min number of points per build task; segments get grouped
+        into tasks of (at least) that many points, so tiny segments
+        don't pay for a task (and scratch allocation) each */
+    enum { minPointsPerBuildTask = 64*1024 };
+
+    template<typename point_t,
+             typename scalar_t,
+             int      numDims>
+    void buildTrees(point_t *d_points,
+                    const int *d_offsets,
+                    int numTrees,
+                    BuildStats *stats)
+    {
+      // schedule by decreasing size, so the big segments don't end
+      // up being the last tasks to get started
+      std::vector<int> order(numTrees);
+      for (int i=0;i<numTrees;i++) order[i] = i;
+      std::sort(order.begin(),order.end(),
+                [&](int a, int b) {
+                  return d_offsets[a+1]-d_offsets[a] > d_offsets[b+1]-d_offsets[b];
+                });
+
+      // group consecutive segments (in that order) into tasks
+      std::vector<int> taskBegin;
+      int64_t numPointsInTask = minPointsPerBuildTask;
+      for (int i=0;i<numTrees;i++) {
+        if (numPointsInTask >= minPointsPerBuildTask) {
+          taskBegin.push_back(i);
+          numPointsInTask = 0;
+        }
+        numPointsInTask += d_offsets[order[i]+1]-d_offsets[order[i]];
+      }
+      taskBegin.push_back(numTrees);
+
+      common::parallel_for
+        (taskBegin.size()-1,
+         [&](size_t taskID) {
+           const int begin = taskBegin[taskID];
+           const int end   = taskBegin[taskID+1];
+           // first segment of each task is its largest
+           const int maxSize = d_offsets[order[begin]+1]-d_offsets[order[begin]];
+           std::vector<point_t> scratch(maxSize);
+           if (stats) stats->allocatedScratch(maxSize*sizeof(point_t));
+           for (int i=begin;i<end;i++) {
+             const int treeID = order[i];
+             buildTreeWithScratch<point_t,scalar_t,numDims>
+               (d_points+d_offsets[treeID],
+                d_offsets[treeID+1]-d_offsets[treeID],
+                scratch.data(),nullptr,stats);
+           }
+           if (stats) stats->freedScratch(maxSize*sizeof(point_t));
+         });
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    void fcpBatch(int *d_results,
+                  const point_t *d_queries,
+                  const int *d_treeIDs,
+                  int numQueries,
+                  const point_t *d_points,
+                  const int *d_offsets)
+    {
+      common::parallel_for_blocked
+        (0,numQueries,1024,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++) {
+             const int treeID = d_treeIDs[i];
+             const int offset = d_offsets[treeID];
+             const int result
+               = fcp<point_t,scalar_t,numDims>(d_queries[i],d_points+offset,
+                                               d_offsets[treeID+1]-offset);
+             d_results[i] = result < 0 ? -1 : offset+result;
+           }
+         });
+    }
+
+  } // ::cpukd::segmented
+} // ::cpukd
@@ -0,0 +1,381 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* sharded forests: the points get partitioned into 2^depth spatial
+   shards by a coarse, top-level median split (round-robin dimensions,
+   as in the regular trees), and each shard gets its own, regular,
+   left-balanced tree (built with buildTree()), which can be built,
+   stored, and loaded independently of all others. A small 'router'
+   (the top-level split planes, plus each shard's bounding box) sends
+   each query to its home shard first, and then only to those other
+   shards whose box is still within the current search radius, with
+   that radius shrinking from shard to shard.
+
+   Point IDs returned by all queries are "global" IDs, ie, the
+   shard's offset (see ShardRouter::offsets) plus the point's index
+   within that shard's tree.
+
+   See cpukd/shardworkers.h for serving the shards of a forest from
+   separate worker processes. */
+
+#pragma once
+
+#include "cpukd/builder.h"
+#include "cpukd/bounds.h"
+#include "cpukd/knn.h"
+#include "cpukd/radius.h"
+#include "cpukd/parallel_for.h"
+#include <fstream>
+
+namespace cpukd {
+  namespace sharded {
+
+    // ==================================================================
+    // INTERFACE SECTION
+    // ==================================================================
+
+    template<typename scalar_t, int numDims>
+    struct ShardRouter {
+      /*! at most 2^maxDepth shards, so that the queries' per-shard
+          scratch fits on the stack */
+      enum { maxDepth = 10, maxShards = 1<<maxDepth };
+
+      inline int numShards() const { return 1<<depth; }
+      /*! the shard whose region contains the given point */
+      int homeShard(const scalar_t *point) const;
+
+      /*! number of shards is 2^depth */
+      int depth = 0;
+      /*! split plane positions of the top-level (implicit, 2n+1/2n+2)
+          tree's (2^depth)-1 inner nodes */
+      std::vector<scalar_t> splits;
+      /*! bounding box of each shard's points */
+      std::vector<Box<scalar_t,numDims>> bounds;
+      /*! global ID of each shard's first point; numShards+1 entries */
+      std::vector<int> offsets;
+    };
+
+    template<typename point_t, typename scalar_t, int numDims>
+    struct ShardedForest {
+      /*! partitions the points into 2^depth shards, and builds each
+          shard's tree (in parallel); if 'stats' is non-null, the
+          partitioning and each shard's build get recorded there */
+      void build(const point_t *d_points, int numPoints, int depth,
+                 BuildStats *stats=nullptr);
+
+      /*! writes router to <baseName>.router, and shard i to
+          <baseName>.shard<i> */
+      void save(const std::string &baseName) const;
+      /*! loads a forest saved with save() */
+      void load(const std::string &baseName);
+
+      /*! global ID of the closest point, or -1 if forest is empty */
+      int fcp(point_t queryPoint) const;
+      /*! same semantics as cpukd::knn(), with global IDs */
+      template<typename CandidateList>
+      float knn(CandidateList &currentlyClosest, point_t queryPoint) const;
+      /*! same semantics as cpukd::radiusQuery(), with global IDs */
+      template<typename ProcessPoint>
+      int radiusQuery(point_t queryPoint, scalar_t radius,
+                      ProcessPoint &&processPoint) const;
+
+      ShardRouter<scalar_t,numDims>       router;
+      std::vector<std::vector<point_t>>   shards;
+    };
+
+    /*! writes/reads the router, or a single shard, to/from a file;
+        all of these throw a std::runtime_error on failure */
+    template<typename scalar_t, int numDims>
+    void saveRouter(const ShardRouter<scalar_t,numDims> &router, const std::string &fileName);
+    template<typename scalar_t, int numDims>
+    void loadRouter(ShardRouter<scalar_t,numDims> &router, const std::string &fileName);
+    template<typename point_t>
+    void saveShard(const std::vector<point_t> &shard, const std::string &fileName);
+    template<typename point_t>
+    void loadShard(std::vector<point_t> &shard, const std::string &fileName);
+
+    inline std::string shardFileName(const std::string &baseName, int shardID)
+    { return baseName+".shard"+std::to_string(shardID); }
+    inline std::string routerFileName(const std::string &baseName)
+    { return baseName+".router"; }
+
+    // ==================================================================
+    // IMPLEMENTATION SECTION
+    // ==================================================================
+
+    template<typename scalar_t, int numDims>
+    int ShardRouter<scalar_t,numDims>::homeShard(const scalar_t *point) const
+    {
+      int node = 0;
+      for (int level=0;level<depth;level++)
+        node = 2*node + 1 + (point[level % numDims] > splits[node]);
+      return node - ((1<<depth)-1);
+    }
+
+    /*! a shard, and its (box) distance to a query; no constructor, so
+        arrays of these cost nothing to set up */
+    template<typename scalar_t>
+    struct OrderedShard {
+      inline bool operator<(const OrderedShard &other) const
+      { return dist2 < other.dist2 || (dist2 == other.dist2 && shardID < other.shardID); }
+      scalar_t dist2;
+      int      shardID;
+    };
+
+    /*! order in which to visit the shards for a given query: all
+        shards whose box is within maxDist2, home shard first, then by
+        increasing box distance. 'order' must have space for
+        router.numShards() entries; returns the number of entries
+        written */
+    template<typename scalar_t, int numDims>
+    inline int shardOrder(OrderedShard<scalar_t> *order,
+                          const ShardRouter<scalar_t,numDims> &router,
+                          const scalar_t *query,
+                          scalar_t maxDist2)
+    {
+      int count = 0;
+      const int home = router.homeShard(query);
+      for (int s=0;s<router.numShards();s++) {
+        if (router.offsets[s+1] == router.offsets[s]) continue;
+        const scalar_t dist2 = sqrDistanceToBox(query,router.bounds[s]);
+        if (dist2 <= maxDist2)
+          order[count++] = { s == home ? scalar_t(-1) : dist2, s };
+      }
+      std::sort(order,order+count);
+      return count;
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    void partition_rec(ShardRouter<scalar_t,numDims> &router,
+                       int node, int level, int firstShard,
+                       point_t *d_points)
+    {
+      if (level == router.depth) return;
+      const int numShards = 1<<(router.depth-level);
+      const int begin = router.offsets[firstShard];
+      const int mid   = router.offsets[firstShard+numShards/2];
+      const int end   = router.offsets[firstShard+numShards];
+      const int dim   = level % numDims;
+      std::nth_element(d_points+begin,d_points+mid,d_points+end,
+                       DimCompare<point_t,scalar_t,numDims>(d_points,dim));
+      router.splits[node]
+        = (mid < end) ? ((const scalar_t*)&d_points[mid])[dim] : scalar_t(0);
+      partition_rec<point_t,scalar_t,numDims>
+        (router,lChild(node),level+1,firstShard,d_points);
+      partition_rec<point_t,scalar_t,numDims>
+        (router,rChild(node),level+1,firstShard+numShards/2,d_points);
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    void ShardedForest<point_t,scalar_t,numDims>::build(const point_t *d_points,
+                                                        int numPoints,
+                                                        int depth,
+                                                        BuildStats *stats)
+    {
+      if (depth < 0 || depth > ShardRouter<scalar_t,numDims>::maxDepth)
+        throw std::runtime_error("ShardedForest: invalid depth "+std::to_string(depth));
+      router.depth = depth;
+      const int numShards = router.numShards();
+      router.splits.resize(numShards-1);
+      router.bounds.resize(numShards);
+      router.offsets.resize(numShards+1);
+      for (int s=0;s<=numShards;s++)
+        router.offsets[s] = int((int64_t(s)*numPoints) >> depth);
+
+      const double partitionBegin = stats ? stats->now() : 0.;
+      std::vector<point_t> partitioned(d_points,d_points+numPoints);
+      partition_rec<point_t,scalar_t,numDims>(router,0,0,0,partitioned.data());
+      if (stats) stats->addTask("partition into shards",partitionBegin,stats->now());
+
+      shards.resize(numShards);
+      common::parallel_for
+        (numShards,
+         [&](int s) {
+           std::vector<point_t> &shard = shards[s];
+           shard.assign(partitioned.begin()+router.offsets[s],
+                        partitioned.begin()+router.offsets[s+1]);
+           buildTree<point_t,scalar_t,numDims>(shard.data(),(int)shard.size(),nullptr,stats);
+           router.bounds[s].setEmpty();
+           for (auto &p : shard)
+             router.bounds[s].extend((const scalar_t*)&p);
+         });
+    }
+
+    enum { routerMagic = 0x52646b63 /* "ckdR" */, shardMagic = 0x53646b63 /* "ckdS" */ };
+
+    template<typename T>
+    inline void writeOrThrow(std::ofstream &out, const T *data, size_t count,
+                             const std::string &fileName)
+    {
+      out.write((const char *)data,count*sizeof(T));
+      if (!out.good())
+        throw std::runtime_error("sharded: error writing '"+fileName+"'");
+    }
+
+    template<typename T>
+    inline void readOrThrow(std::ifstream &in, T *data, size_t count,
+                            const std::string &fileName)
+    {
+      in.read((char *)data,count*sizeof(T));
+      if (!in.good())
+        throw std::runtime_error("sharded: error reading '"+fileName+"'");
+    }
+
+    template<typename scalar_t, int numDims>
+    void saveRouter(const ShardRouter<scalar_t,numDims> &router, const std::string &fileName)
+    {
+      std::ofstream out(fileName,std::ios::binary);
+      const int header[4] = { routerMagic, int(sizeof(scalar_t)), numDims, router.depth };
+      writeOrThrow(out,header,4,fileName);
+      writeOrThrow(out,router.splits.data(),router.splits.size(),fileName);
+      writeOrThrow(out,router.bounds.data(),router.bounds.size(),fileName);
+      writeOrThrow(out,router.offsets.data(),router.offsets.size(),fileName);
+    }
+
+    template<typename scalar_t, int numDims>
+    void loadRouter(ShardRouter<scalar_t,numDims> &router, const std::string &fileName)
+    {
+      std::ifstream in(fileName,std::ios::binary);
+      int header[4];
+      readOrThrow(in,header,4,fileName);
+      if (header[0] != routerMagic || header[1] != int(sizeof(scalar_t)) || header[2] != numDims
+          || header[3] < 0 || header[3] > ShardRouter<scalar_t,numDims>::maxDepth)
+        throw std::runtime_error("sharded: '"+fileName+"' is not a matching router file");
+      router.depth = header[3];
+      router.splits.resize(router.numShards()-1);
+      router.bounds.resize(router.numShards());
+      router.offsets.resize(router.numShards()+1);
+      readOrThrow(in,router.splits.data(),router.splits.size(),fileName);
+      readOrThrow(in,router.bounds.data(),router.bounds.size(),fileName);
+      readOrThrow(in,router.offsets.data(),router.offsets.size(),fileName);
+    }
+
+    template<typename point_t>
+    void saveShard(const std::vector<point_t> &shard, const std::string &fileName)
+    {
+      std::ofstream out(fileName,std::ios::binary);
+      const int header[3] = { shardMagic, int(sizeof(point_t)), int(shard.size()) };
+      writeOrThrow(out,header,3,fileName);
+      writeOrThrow(out,shard.data(),shard.size(),fileName);
+    }
+
+    template<typename point_t>
+    void loadShard(std::vector<point_t> &shard, const std::string &fileName)
+    {
+      std::ifstream in(fileName,std::ios::binary);
+      int header[3];
+      readOrThrow(in,header,3,fileName);
+      if (header[0] != shardMagic || header[1] != int(sizeof(point_t)) || header[2] < 0)
+        throw std::runtime_error("sharded: '"+fileName+"' is not a matching shard file");
+      shard.resize(header[2]);
+      readOrThrow(in,shard.data(),shard.size(),fileName);
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    void ShardedForest<point_t,scalar_t,numDims>::save(const std::string &baseName) const
+    {
+      saveRouter(router,routerFileName(baseName));
+      for (int s=0;s<router.numShards();s++)
+        saveShard(shards[s],shardFileName(baseName,s));
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    void ShardedForest<point_t,scalar_t,numDims>::load(const std::string &baseName)
+    {
+      loadRouter(router,routerFileName(baseName));
+      shards.resize(router.numShards());
+      for (int s=0;s<router.numShards();s++) {
+        loadShard(shards[s],shardFileName(baseName,s));
+        if ((int)shards[s].size() != router.offsets[s+1]-router.offsets[s])
+          throw std::runtime_error("sharded: size of shard "+std::to_string(s)
+                                   +" does not match router");
+      }
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    int ShardedForest<point_t,scalar_t,numDims>::fcp(point_t queryPoint) const
+    {
+      const scalar_t *query = (const scalar_t*)&queryPoint;
+      int      closest = -1;
+      scalar_t closestDist2 = std::numeric_limits<scalar_t>::infinity();
+      OrderedShard<scalar_t> order[ShardRouter<scalar_t,numDims>::maxShards];
+      const int numOrdered = shardOrder(order,router,query,closestDist2);
+      for (int i=0;i<numOrdered;i++) {
+        const auto &entry = order[i];
+        // the radius shrinks from shard to shard, so re-check
+        if (entry.dist2 >= closestDist2) continue;
+        const int s = entry.shardID;
+        const int local
+          = fcpSeeded<point_t,scalar_t,numDims>(queryPoint,shards[s].data(),(int)shards[s].size(),
+                                                -1,closestDist2,nullptr);
+        if (local >= 0) {
+          closest      = router.offsets[s]+local;
+          closestDist2 = sqrDistance<point_t,scalar_t,numDims>(queryPoint,shards[s][local]);
+        }
+      }
+      return closest;
+    }
+
+    /*! adapter that lets a per-shard knn() push global point IDs into
+        a shared candidate list */
+    template<typename CandidateList>
+    struct OffsetCandidateList {
+      inline void  push(float dist2, int pointID) { list.push(dist2,offset+pointID); }
+      inline float maxRadius2() { return list.maxRadius2(); }
+      CandidateList &list;
+      const int      offset;
+    };
+
+    template<typename point_t, typename scalar_t, int numDims>
+    template<typename CandidateList>
+    float ShardedForest<point_t,scalar_t,numDims>::knn(CandidateList &currentlyClosest,
+                                                       point_t queryPoint) const
+    {
+      const scalar_t *query = (const scalar_t*)&queryPoint;
+      OrderedShard<scalar_t> order[ShardRouter<scalar_t,numDims>::maxShards];
+      const int numOrdered = shardOrder(order,router,query,(scalar_t)currentlyClosest.maxRadius2());
+      for (int i=0;i<numOrdered;i++) {
+        const auto &entry = order[i];
+        if (entry.dist2 > currentlyClosest.maxRadius2()) continue;
+        const int s = entry.shardID;
+        OffsetCandidateList<CandidateList> list = { currentlyClosest, router.offsets[s] };
+        cpukd::knn<point_t,scalar_t,numDims>(list,queryPoint,shards[s].data(),(int)shards[s].size());
+      }
+      return currentlyClosest.maxRadius2();
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    template<typename ProcessPoint>
+    int ShardedForest<point_t,scalar_t,numDims>::radiusQuery(point_t queryPoint,
+                                                             scalar_t radius,
+                                                             ProcessPoint &&processPoint) const
+    {
+      const scalar_t *query = (const scalar_t*)&queryPoint;
+      OrderedShard<scalar_t> order[ShardRouter<scalar_t,numDims>::maxShards];
+      const int numOrdered = shardOrder(order,router,query,radius*radius);
+      int numFound = 0;
+      for (int i=0;i<numOrdered;i++) {
+        const int s = order[i].shardID;
+        const int offset = router.offsets[s];
+        numFound += cpukd::radiusQuery<point_t,scalar_t,numDims>
+          (queryPoint,radius,shards[s].data(),(int)shards[s].size(),
+           [&](int pointID, scalar_t dist2) { processPoint(offset+pointID,dist2); });
+      }
+      return numFound;
+    }
+
+  } // ::cpukd::sharded
+} // ::cpukd
@@ -0,0 +1,395 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* serves the shards of a saved ShardedForest (see cpukd/sharded.h)
+   from local worker processes, one per shard: each worker loads only
+   its own shard file, and talks to the parent over a unix domain
+   socket. Queries get answered in batches, in two rounds: first each
+   query goes to its home shard only, and then - with the radius found
+   there - to all other shards whose box is still within that radius.
+
+   The message format is deliberately simple (fixed-size records, no
+   versioning, same binary on both sides), so the same protocol could
+   be used over a network, but this file only does local processes.
+   POSIX only. */
+
+#pragma once
+
+#include "cpukd/sharded.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace cpukd {
+  namespace sharded {
+
+    // ==================================================================
+    // INTERFACE SECTION
+    // ==================================================================
+
+    /*! wire format: a request is a header {op,numQueries,k} plus
+        numQueries ShardRequest's; its response is the total number
+        of results, then numQueries per-query result counts, then all
+        the results (with shard-local point IDs), query by query */
+    enum ShardOp { SHARD_FCP, SHARD_KNN, SHARD_RADIUS };
+    /*! param is the squared max distance for fcp and knn, and the
+        radius for radius queries */
+    template<typename point_t>
+    struct ShardRequest { point_t point; float param; };
+    struct ShardResult  { int pointID; float dist2; };
+
+    template<typename point_t, typename scalar_t, int numDims>
+    class ShardWorkerPool {
+    public:
+      /*! loads <baseName>.router, and starts one worker process per
+          shard, which then loads its <baseName>.shard<i> file */
+      ShardWorkerPool(const std::string &baseName);
+      /*! shuts down (and waits for) all workers */
+      ~ShardWorkerPool();
+
+      /*! d_results[i] is the global ID of the point closest to
+          d_queries[i], or -1 if there is none */
+      void fcpBatch(int *d_results,
+                    const point_t *d_queries,
+                    int numQueries);
+      /*! d_results[i*k+j] is the global ID of the j-th closest point
+          to d_queries[i] (or -1 if fewer than j+1 points are within
+          maxRadius); if non-null, d_dist2 gets the squared distances */
+      void knnBatch(int *d_results,
+                    float *d_dist2,
+                    const point_t *d_queries,
+                    int numQueries,
+                    int k,
+                    float maxRadius=std::numeric_limits<float>::infinity());
+      /*! calls processPoint(queryID,pointID,dist2) for every (global)
+          point within radius of d_queries[queryID]; all calls are made
+          from the calling thread, in no particular order */
+      template<typename ProcessPoint>
+      void radiusBatch(const point_t *d_queries,
+                       int numQueries,
+                       scalar_t radius,
+                       ProcessPoint &&processPoint);
+
+      ShardRouter<scalar_t,numDims> router;
+
+    private:
+      typedef ShardRequest<point_t> Request;
+      typedef ShardResult           Entry;
+
+      /*! sends each query in queriesOfShard[s] to worker s (with
+          param(queryID) as its bound/radius), and calls
+          processResult(queryID,shard,entries,numEntries) for each of
+          their results */
+      template<typename Param, typename ProcessResult>
+      void runRound(int op, int k,
+                    const std::vector<std::vector<int>> &queriesOfShard,
+                    const point_t *d_queries,
+                    Param &&param,
+                    ProcessResult &&processResult);
+
+      std::vector<int>   sockets;
+      std::vector<pid_t> workers;
+    };
+
+    // ==================================================================
+    // IMPLEMENTATION SECTION
+    // ==================================================================
+
+    inline void sendAll(int fd, const void *data, size_t size)
+    {
+      const char *ptr = (const char *)data;
+      while (size > 0) {
+        ssize_t sent = ::send(fd,ptr,size,MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0)
+          throw std::runtime_error("ShardWorkerPool: lost connection to worker");
+        ptr += sent; size -= sent;
+      }
+    }
+
+    /*! returns false on a clean end-of-stream before the first byte */
+    inline bool recvAll(int fd, void *data, size_t size)
+    {
+      char *ptr = (char *)data;
+      const size_t wanted = size;
+      while (size > 0) {
+        ssize_t got = ::recv(fd,ptr,size,0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got == 0 && size == wanted) return false;
+        if (got <= 0)
+          throw std::runtime_error("ShardWorkerPool: lost connection to worker");
+        ptr += got; size -= got;
+      }
+      return true;
+    }
+
+    /*! main loop of a worker process; returns once the parent closes
+        its end of the socket */
+    template<typename point_t, typename scalar_t, int numDims>
+    void workerLoop(int fd, const std::vector<point_t> &shard)
+    {
+      typedef ShardRequest<point_t> Request;
+      typedef ShardResult           Entry;
+      const point_t *d_nodes = shard.data();
+      const int N = (int)shard.size();
+
+      std::vector<Request>  requests;
+      std::vector<int>      counts;
+      std::vector<Entry>    entries;
+      std::vector<int>      knnIDs;
+      std::vector<float>    knnDist2;
+      std::vector<uint64_t> knnStorage;
+      int header[3];
+      while (recvAll(fd,header,sizeof(header))) {
+        const int op = header[0], numQueries = header[1], k = header[2];
+        requests.resize(numQueries);
+        recvAll(fd,requests.data(),numQueries*sizeof(Request));
+        counts.resize(numQueries);
+        entries.clear();
+        for (int i=0;i<numQueries;i++) {
+          const point_t &q = requests[i].point;
+          const size_t before = entries.size();
+          if (op == SHARD_FCP) {
+            const int closest
+              = fcpSeeded<point_t,scalar_t,numDims>(q,d_nodes,N,-1,requests[i].param,nullptr);
+            if (closest >= 0)
+              entries.push_back({closest,(float)sqrDistance<point_t,scalar_t,numDims>(q,d_nodes[closest])});
+          } else if (op == SHARD_KNN) {
+            knnIDs.resize(k);
+            knnDist2.resize(k);
+            knnStorage.resize(runtimeKStorageSize(k));
+            const int numFound
+              = knnRuntimeKReduced<point_t,scalar_t,numDims>(knnIDs.data(),knnDist2.data(),k,
+                                                             knnStorage.data(),q,d_nodes,N,
+                                                             requests[i].param);
+            for (int j=0;j<numFound;j++)
+              entries.push_back({knnIDs[j],knnDist2[j]});
+          } else {
+            cpukd::radiusQuery<point_t,scalar_t,numDims>
+              (q,(scalar_t)requests[i].param,d_nodes,N,
+               [&](int pointID, scalar_t dist2) { entries.push_back({pointID,(float)dist2}); });
+          }
+          counts[i] = int(entries.size()-before);
+        }
+        const int numEntries = (int)entries.size();
+        sendAll(fd,&numEntries,sizeof(numEntries));
+        sendAll(fd,counts.data(),numQueries*sizeof(int));
+        sendAll(fd,entries.data(),numEntries*sizeof(Entry));
+      }
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    ShardWorkerPool<point_t,scalar_t,numDims>::ShardWorkerPool(const std::string &baseName)
+    {
+      loadRouter(router,routerFileName(baseName));
+      for (int s=0;s<router.numShards();s++) {
+        int fds[2];
+        if (socketpair(AF_UNIX,SOCK_STREAM,0,fds) != 0)
+          throw std::runtime_error("ShardWorkerPool: could not create socket pair");
+        const pid_t pid = fork();
+        if (pid < 0)
+          throw std::runtime_error("ShardWorkerPool: could not fork worker");
+        if (pid == 0) {
+          // worker: only keep our own end of our own socket, so every
+          // worker sees end-of-stream as soon as the parent closes.
+          // Workers are single-threaded (no tbb after a fork).
+          ::close(fds[0]);
+          for (int fd : sockets) ::close(fd);
+          int exitCode = 0;
+          try {
+            std::vector<point_t> shard;
+            loadShard(shard,shardFileName(baseName,s));
+            workerLoop<point_t,scalar_t,numDims>(fds[1],shard);
+          } catch (const std::exception &e) {
+            fprintf(stderr,"cpukd shard worker %i: %s\n",s,e.what());
+            exitCode = 1;
+          }
+          ::close(fds[1]);
+          _exit(exitCode);
+        }
+        ::close(fds[1]);
+        sockets.push_back(fds[0]);
+        workers.push_back(pid);
+      }
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    ShardWorkerPool<point_t,scalar_t,numDims>::~ShardWorkerPool()
+    {
+      for (int fd : sockets) ::close(fd);
+      for (pid_t pid : workers) waitpid(pid,nullptr,0);
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    template<typename Param, typename ProcessResult>
+    void ShardWorkerPool<point_t,scalar_t,numDims>::runRound(int op, int k,
+                                                             const std::vector<std::vector<int>> &queriesOfShard,
+                                                             const point_t *d_queries,
+                                                             Param &&param,
+                                                             ProcessResult &&processResult)
+    {
+      // send all requests before reading any results, so all workers
+      // run concurrently; a worker reads its entire request before it
+      // starts writing, so this cannot deadlock on full buffers
+      std::vector<Request> requests;
+      for (int s=0;s<router.numShards();s++) {
+        const std::vector<int> &queryIDs = queriesOfShard[s];
+        if (queryIDs.empty()) continue;
+        requests.resize(queryIDs.size());
+        for (size_t i=0;i<queryIDs.size();i++)
+          requests[i] = { d_queries[queryIDs[i]], (float)param(queryIDs[i]) };
+        const int header[3] = { op, (int)queryIDs.size(), k };
+        sendAll(sockets[s],header,sizeof(header));
+        sendAll(sockets[s],requests.data(),requests.size()*sizeof(Request));
+      }
+
+      std::vector<int>   counts;
+      std::vector<Entry> entries;
+      for (int s=0;s<router.numShards();s++) {
+        const std::vector<int> &queryIDs = queriesOfShard[s];
+        if (queryIDs.empty()) continue;
+        int numEntries;
+        if (!recvAll(sockets[s],&numEntries,sizeof(numEntries)))
+          throw std::runtime_error("ShardWorkerPool: worker "+std::to_string(s)+" died");
+        counts.resize(queryIDs.size());
+        entries.resize(numEntries);
+        recvAll(sockets[s],counts.data(),counts.size()*sizeof(int));
+        recvAll(sockets[s],entries.data(),numEntries*sizeof(Entry));
+        Entry *entry = entries.data();
+        for (size_t i=0;i<queryIDs.size();i++) {
+          for (int j=0;j<counts[i];j++)
+            entry[j].pointID += router.offsets[s];
+          processResult(queryIDs[i],s,entry,counts[i]);
+          entry += counts[i];
+        }
+      }
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    void ShardWorkerPool<point_t,scalar_t,numDims>::fcpBatch(int *d_results,
+                                                             const point_t *d_queries,
+                                                             int numQueries)
+    {
+      const int numShards = router.numShards();
+      std::vector<float> bestDist2(numQueries,std::numeric_limits<float>::infinity());
+      for (int i=0;i<numQueries;i++) d_results[i] = -1;
+      auto keepClosest = [&](int queryID, int, const Entry *entries, int count) {
+        if (count && entries[0].dist2 < bestDist2[queryID]) {
+          bestDist2[queryID]  = entries[0].dist2;
+          d_results[queryID] = entries[0].pointID;
+        }
+      };
+      auto bound = [&](int queryID) { return bestDist2[queryID]; };
+
+      // round 1: home shards
+      std::vector<std::vector<int>> queriesOfShard(numShards);
+      std::vector<int> homeOf(numQueries);
+      for (int i=0;i<numQueries;i++) {
+        homeOf[i] = router.homeShard((const scalar_t*)&d_queries[i]);
+        queriesOfShard[homeOf[i]].push_back(i);
+      }
+      runRound(SHARD_FCP,0,queriesOfShard,d_queries,bound,keepClosest);
+
+      // round 2: all other shards that could still have a closer point
+      for (auto &q : queriesOfShard) q.clear();
+      std::vector<OrderedShard<scalar_t>> order(router.numShards());
+      for (int i=0;i<numQueries;i++) {
+        const int numOrdered
+          = shardOrder(order.data(),router,(const scalar_t*)&d_queries[i],(scalar_t)bestDist2[i]);
+        for (int j=0;j<numOrdered;j++)
+          if (order[j].shardID != homeOf[i] && order[j].dist2 < bestDist2[i])
+            queriesOfShard[order[j].shardID].push_back(i);
+      }
+      runRound(SHARD_FCP,0,queriesOfShard,d_queries,bound,keepClosest);
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    void ShardWorkerPool<point_t,scalar_t,numDims>::knnBatch(int *d_results,
+                                                             float *d_dist2,
+                                                             const point_t *d_queries,
+                                                             int numQueries,
+                                                             int k,
+                                                             float maxRadius)
+    {
+      if (k < 1)
+        throw std::runtime_error("ShardWorkerPool: invalid k "+std::to_string(k));
+      const int numShards = router.numShards();
+      // parent only merges a few k candidates per shard, so a heap
+      // is fine for any k
+      std::vector<uint64_t> storage(size_t(numQueries)*k);
+      std::vector<RuntimeHeapCandidateList> lists;
+      lists.reserve(numQueries);
+      for (int i=0;i<numQueries;i++)
+        lists.emplace_back(storage.data()+size_t(i)*k,k,maxRadius*maxRadius);
+      auto merge = [&](int queryID, int, const Entry *entries, int count) {
+        for (int j=0;j<count;j++)
+          lists[queryID].push(entries[j].dist2,entries[j].pointID);
+      };
+      auto bound = [&](int queryID) { return lists[queryID].maxRadius2(); };
+
+      std::vector<std::vector<int>> queriesOfShard(numShards);
+      std::vector<int> homeOf(numQueries);
+      for (int i=0;i<numQueries;i++) {
+        homeOf[i] = router.homeShard((const scalar_t*)&d_queries[i]);
+        queriesOfShard[homeOf[i]].push_back(i);
+      }
+      runRound(SHARD_KNN,k,queriesOfShard,d_queries,bound,merge);
+
+      for (auto &q : queriesOfShard) q.clear();
+      std::vector<OrderedShard<scalar_t>> order(numShards);
+      for (int i=0;i<numQueries;i++) {
+        const float maxDist2 = lists[i].maxRadius2();
+        const int numOrdered
+          = shardOrder(order.data(),router,(const scalar_t*)&d_queries[i],(scalar_t)maxDist2);
+        for (int j=0;j<numOrdered;j++)
+          if (order[j].shardID != homeOf[i] && order[j].dist2 < maxDist2)
+            queriesOfShard[order[j].shardID].push_back(i);
+      }
+      runRound(SHARD_KNN,k,queriesOfShard,d_queries,bound,merge);
+
+      for (int i=0;i<numQueries;i++)
+        lists[i].finish(d_results+size_t(i)*k,d_dist2 ? d_dist2+size_t(i)*k : nullptr);
+    }
+
+    template<typename point_t, typename scalar_t, int numDims>
+    template<typename ProcessPoint>
+    void ShardWorkerPool<point_t,scalar_t,numDims>::radiusBatch(const point_t *d_queries,
+                                                                int numQueries,
+                                                                scalar_t radius,
+                                                                ProcessPoint &&processPoint)
+    {
+      std::vector<std::vector<int>> queriesOfShard(router.numShards());
+      std::vector<OrderedShard<scalar_t>> order(router.numShards());
+      for (int i=0;i<numQueries;i++) {
+        const int numOrdered
+          = shardOrder(order.data(),router,(const scalar_t*)&d_queries[i],radius*radius);
+        for (int j=0;j<numOrdered;j++)
+          queriesOfShard[order[j].shardID].push_back(i);
+      }
+      runRound(SHARD_RADIUS,0,queriesOfShard,d_queries,
+               [&](int) { return radius; },
+               [&](int queryID, int, const Entry *entries, int count) {
+                 for (int j=0;j<count;j++)
+                   processPoint(queryID,entries[j].pointID,(scalar_t)entries[j].dist2);
+               });
+    }
+
+  } // ::cpukd::sharded
+} // ::cpukd
+#endif
@@ -0,0 +1,158 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* checks that a left-balanced tree actually is a valid kd-tree, ie,
+   that for every node, all points in its left subtree are no larger
+   than the node in its split dimension, and all points in its right
+   subtree no smaller.
+
+   Rather than checking each node's subtrees against that node (which
+   costs O(N log N), and is hard to parallelize when done recursively)
+   this passes down the box that all of a node's ancestors' split
+   planes leave for it, and checks each point against that box only
+   once: linear time, and the subtrees on some level can be checked
+   in parallel, each starting with the box of its root as computed
+   from the path to that root. */
+
+#pragma once
+
+#include "cpukd/bounds.h"
+#include "cpukd/builder.h"
+#include "cpukd/fcp.h"
+#include "cpukd/parallel_for.h"
+#include <atomic>
+
+namespace cpukd {
+
+  // ==================================================================
+  // INTERFACE SECTION
+  // ==================================================================
+
+  /*! returns -1 if d_nodes is a valid kd-tree (as built by
+      buildTree(d_nodes,N,splitDimOfLevel); nullptr meaning
+      round-robin split dimensions), or otherwise the lowest ID of a
+      node that lies outside the region its ancestors leave for it;
+      NaN coordinates are never valid */
+  template<typename point_t,
+           typename scalar_t,
+           int      numDims=sizeof(point_t)/sizeof(scalar_t)>
+  int validateTree(const point_t *d_nodes,
+                   int N,
+                   const int *splitDimOfLevel=nullptr);
+
+  // ==================================================================
+  // IMPLEMENTATION SECTION
+  // ==================================================================
+
+  /*! tree level whose subtrees become the parallel tasks */
+  enum { validateTaskLevel = 10 };
+
+  template<typename scalar_t, int numDims>
+  inline bool insideBox(const scalar_t *point, const Box<scalar_t,numDims> &box)
+  {
+    for (int d=0;d<numDims;d++)
+      // written such that NaNs fail
+      if (!(point[d] >= box.lower[d] && point[d] <= box.upper[d]))
+        return false;
+    return true;
+  }
+
+  /*! the box that node's ancestors' split planes leave for it */
+  template<typename point_t, typename scalar_t, int numDims>
+  Box<scalar_t,numDims> regionOfNode(const point_t *d_nodes,
+                                     int node,
+                                     const int *splitDimOfLevel)
+  {
+    Box<scalar_t,numDims> region;
+    for (int d=0;d<numDims;d++) {
+      region.lower[d] = -std::numeric_limits<scalar_t>::infinity();
+      region.upper[d] = +std::numeric_limits<scalar_t>::infinity();
+    }
+    const int level = levelOf(node);
+    for (int l=0;l<level;l++) {
+      const int ancestor = ((node+1) >> (level-l))-1;
+      const int child    = ((node+1) >> (level-l-1))-1;
+      const int dim      = splitDimOfLevel ? splitDimOfLevel[l] : (l % numDims);
+      const scalar_t split = ((const scalar_t*)&d_nodes[ancestor])[dim];
+      if (child == lChild(ancestor))
+        region.upper[dim] = std::min(region.upper[dim],split);
+      else
+        region.lower[dim] = std::max(region.lower[dim],split);
+    }
+    return region;
+  }
+
+  inline void recordBadNode(std::atomic<int> &firstBad, int node)
+  {
+    int prev = firstBad.load();
+    while ((prev < 0 || node < prev)
+           && !firstBad.compare_exchange_weak(prev,node))
+      ;
+  }
+
+  template<typename point_t, typename scalar_t, int numDims>
+  void validateSubtree_rec(const point_t *d_nodes,
+                           int N,
+                           int node,
+                           int level,
+                           Box<scalar_t,numDims> region,
+                           const int *splitDimOfLevel,
+                           std::atomic<int> &firstBad)
+  {
+    if (node >= N) return;
+    const scalar_t *point = (const scalar_t*)&d_nodes[node];
+    if (!insideBox(point,region)) {
+      recordBadNode(firstBad,node);
+      // anything below is relative to a node that's already wrong
+      return;
+    }
+    const int dim = splitDimOfLevel ? splitDimOfLevel[level] : (level % numDims);
+    Box<scalar_t,numDims> lRegion = region;
+    lRegion.upper[dim] = point[dim];
+    validateSubtree_rec(d_nodes,N,lChild(node),level+1,lRegion,splitDimOfLevel,firstBad);
+    region.lower[dim] = point[dim];
+    validateSubtree_rec(d_nodes,N,rChild(node),level+1,region,splitDimOfLevel,firstBad);
+  }
+
+  template<typename point_t, typename scalar_t, int numDims>
+  int validateTree(const point_t *d_nodes,
+                   int N,
+                   const int *splitDimOfLevel)
+  {
+    if (N <= 0) return -1;
+    std::atomic<int> firstBad(-1);
+    const int taskLevel = std::min(int(validateTaskLevel),levelOf(N-1));
+    const int firstTask = (1<<taskLevel)-1;
+
+    // the few nodes above the task level get checked individually
+    common::parallel_for(firstTask,[&](int node) {
+      const Box<scalar_t,numDims> region
+        = regionOfNode<point_t,scalar_t,numDims>(d_nodes,node,splitDimOfLevel);
+      if (!insideBox((const scalar_t*)&d_nodes[node],region))
+        recordBadNode(firstBad,node);
+    });
+    const int numTasks = std::min(N,2*firstTask+1)-firstTask;
+    common::parallel_for(numTasks,[&](int taskID) {
+      const int root = firstTask+taskID;
+      validateSubtree_rec<point_t,scalar_t,numDims>
+        (d_nodes,N,root,taskLevel,
+         regionOfNode<point_t,scalar_t,numDims>(d_nodes,root,splitDimOfLevel),
+         splitDimOfLevel,firstBad);
+    });
+    return firstBad.load();
+  }
+
+} // ::cpukd
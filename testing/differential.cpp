@@ -0,0 +1,732 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* differential test of (almost) all builders and traversals: every
+   builder's trees get checked with validateTree(), and every query
+   variant gets compared against reference::BruteForce on a random
+   sample of queries - a third uniformly random, a third copies of
+   data points (zero distances), and a third partly outside the
+   points' bounds. Results get compared by distance, not by ID, since
+   different traversals may break ties differently. The non-L2
+   metrics, filtered and periodic queries get compared against a
+   reference with the same metric (or over only the accepted points),
+   and the ray queries against the same per-point tests over all
+   points. */
+
+#include "cpukd/aggregates.h"
+#include "cpukd/allknn.h"
+#include "cpukd/batch.h"
+#include "cpukd/bucketed.h"
+#include "cpukd/builder.h"
+#include "cpukd/cursor.h"
+#include "cpukd/dualtree.h"
+#include "cpukd/fcp.h"
+#include "cpukd/filtered.h"
+#include "cpukd/highdim.h"
+#include "cpukd/knn.h"
+#include "cpukd/metrics.h"
+#include "cpukd/periodic.h"
+#include "cpukd/quantized.h"
+#include "cpukd/radius.h"
+#include "cpukd/rays.h"
+#include "cpukd/reference.h"
+#include "cpukd/segmented.h"
+#include "cpukd/sharded.h"
+#include "cpukd/validate.h"
+#include "helpers.h"
+#include <atomic>
+#include <cstring>
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+/*! largest k any of the knn variants below gets tested with */
+enum { maxK = 300 };
+/*! largest k the non-L2 metrics get tested with */
+enum { maxMetricK = 100 };
+
+int numFailedVariants = 0;
+
+/*! runs isCorrect(i) for all i in [0,count), in parallel, and reports
+    how many of those failed */
+template<typename IsCorrect>
+void checkVariant(const std::string &name, int count, IsCorrect &&isCorrect)
+{
+  std::atomic<int> numWrong(0);
+  std::atomic<int> firstWrong(-1);
+  parallel_for(count,[&](int i) {
+    if (isCorrect(i)) return;
+    numWrong++;
+    int expected = -1;
+    firstWrong.compare_exchange_strong(expected,i);
+  });
+  if (numWrong == 0) {
+    std::cout << "  " << name << ": ok" << std::endl;
+    return;
+  }
+  std::cout << "  " << name << ": FAILED for " << numWrong << " of " << count
+            << " (eg, #" << firstWrong << ")" << std::endl;
+  ++numFailedVariants;
+}
+
+void checkBuilder(const std::string &name, int firstBadNode)
+{
+  checkVariant(name+" (validateTree)",1,[&](int) { return firstBadNode == -1; });
+}
+
+inline float dist2(const float3 &a, const float3 &b)
+{ return sqrDistance<float3,float,3>(a,b); }
+
+/*! the periodic (minimum-image) distance, as a metric that
+    reference::BruteForce can compute the periodic results with */
+struct PeriodicMetric {
+  inline float reducedDistance(const float *a, const float *b) const
+  { return periodic::sqrDistance<float3,float,3>(*(const float3*)a,*(const float3*)b,box); }
+  inline float toReduced(float dist) const
+  { return dist*dist; }
+
+  periodic::PeriodicBox<float,3> box;
+};
+
+/*! checks k (pointID,dist2) results - sorted by distance - of a query
+    against the reference distances: same distances, each reported
+    distance is that point's actual (reduced) distance under the
+    given metric, and no point twice */
+template<typename Metric=metrics::L2<float,3>>
+bool knnMatches(const int *ids, const float *d2, int k,
+                const float3 &query, const float3 *points, int N,
+                const float *refDist2,
+                const Metric &metric=Metric())
+{
+  std::vector<int> seen;
+  for (int i=0;i<k;i++) {
+    if (d2[i] != refDist2[i]) return false;
+    if (ids[i] < 0 || ids[i] >= N) return false;
+    if (metric.reducedDistance((const float*)&query,(const float*)&points[ids[i]]) != d2[i])
+      return false;
+    seen.push_back(ids[i]);
+  }
+  std::sort(seen.begin(),seen.end());
+  return std::adjacent_find(seen.begin(),seen.end()) == seen.end();
+}
+
+/*! decodes (and sorts) the entries of one of the fixed-k candidate lists */
+template<typename CandidateList, int k>
+void decodeList(int *ids, float *d2, CandidateList &list)
+{
+  std::vector<uint64_t> entries(list.entry,list.entry+k);
+  std::sort(entries.begin(),entries.end());
+  for (int i=0;i<k;i++) {
+    ids[i] = list.decode_pointID(entries[i]);
+    d2[i]  = list.decode_dist2(entries[i]);
+  }
+}
+
+/*! fcp, knn (without and with a max search radius), and radius
+    queries under the given metric, against a reference that uses the
+    same metric */
+template<typename Metric>
+void checkMetric(const std::string &name,
+                 const Metric &metric,
+                 const std::vector<float3> &tree,
+                 const std::vector<float3> &queries,
+                 float radius)
+{
+  const int N = (int)tree.size();
+  const int Q = (int)queries.size();
+  const reference::BruteForce<float3,float,3,Metric> reference(tree.data(),N,metric);
+  std::vector<int>   refIDs(Q*maxMetricK), refIDsInRadius(Q*maxMetricK);
+  std::vector<float> refDist(Q*maxMetricK), refDistInRadius(Q*maxMetricK);
+  reference.knnBatch(refIDs.data(),refDist.data(),maxMetricK,queries.data(),Q);
+  reference.knnBatch(refIDsInRadius.data(),refDistInRadius.data(),maxMetricK,
+                     queries.data(),Q,radius);
+  auto distanceTo = [&](int i, int pointID) {
+    return metric.reducedDistance((const float*)&queries[i],(const float*)&tree[pointID]);
+  };
+  // with a finite radius some queries find fewer than k points, and
+  // the rest of the k results have to stay unused
+  auto numInRadius = [&](int i, int k) {
+    int refFound = 0;
+    while (refFound < k && refIDsInRadius[i*maxMetricK+refFound] >= 0)
+      ++refFound;
+    return refFound;
+  };
+  auto inRadiusMatches = [&](int i, const int *ids, const float *d2, int k) {
+    const int refFound = numInRadius(i,k);
+    for (int j=refFound;j<k;j++)
+      if (ids[j] != -1) return false;
+    return knnMatches(ids,d2,refFound,queries[i],tree.data(),N,
+                      refDistInRadius.data()+i*maxMetricK,metric);
+  };
+
+  checkVariant(name+" fcp",Q,[&](int i) {
+    const int result = fcp<float3,float,3,Metric>(queries[i],tree.data(),N,nullptr,metric);
+    return result >= 0 && distanceTo(i,result) == refDist[i*maxMetricK];
+  });
+  checkVariant(name+" knn w/ FixedCandidateList<8>",Q,[&](int i) {
+    FixedCandidateList<8> list(std::numeric_limits<float>::infinity());
+    knn<float3,float,3,Metric>(list,queries[i],tree.data(),N,AcceptAll(),metric);
+    int ids[8]; float d2[8];
+    decodeList<FixedCandidateList<8>,8>(ids,d2,list);
+    return knnMatches(ids,d2,8,queries[i],tree.data(),N,refDist.data()+i*maxMetricK,metric);
+  });
+  checkVariant(name+" knn w/ FixedCandidateList<8> in radius",Q,[&](int i) {
+    FixedCandidateList<8> list(metric.toReduced(radius));
+    knn<float3,float,3,Metric>(list,queries[i],tree.data(),N,AcceptAll(),metric);
+    int ids[8]; float d2[8];
+    decodeList<FixedCandidateList<8>,8>(ids,d2,list);
+    return inRadiusMatches(i,ids,d2,8);
+  });
+  checkVariant(name+" knn w/ HeapCandidateList<20> in radius",Q,[&](int i) {
+    HeapCandidateList<20> list(metric.toReduced(radius));
+    knn<float3,float,3,Metric>(list,queries[i],tree.data(),N,AcceptAll(),metric);
+    int ids[20]; float d2[20];
+    decodeList<HeapCandidateList<20>,20>(ids,d2,list);
+    return inRadiusMatches(i,ids,d2,20);
+  });
+  for (int k : { 8, 40, int(maxMetricK) }) {
+    checkVariant(name+" knnRuntimeK in radius, k="+std::to_string(k),Q,[&](int i) {
+      std::vector<uint64_t> storage(runtimeKStorageSize(k));
+      std::vector<int>   ids(k);
+      std::vector<float> d2(k);
+      const int numFound
+        = knnRuntimeK<float3,float,3,Metric>(ids.data(),d2.data(),k,storage.data(),
+                                             queries[i],tree.data(),N,radius,
+                                             AcceptAll(),metric);
+      return numFound == numInRadius(i,k) && inRadiusMatches(i,ids.data(),d2.data(),k);
+    });
+  }
+  checkVariant(name+" radiusQuery",Q,[&](int i) {
+    std::vector<int> found;
+    bool distancesOk = true;
+    radiusQuery<float3,float,3,Metric>(queries[i],radius,tree.data(),N,
+                                       [&](int pointID, float d) {
+                                         distancesOk &= (d == distanceTo(i,pointID));
+                                         found.push_back(pointID);
+                                       },metric);
+    std::vector<int> expected;
+    reference.radiusQuery(queries[i],radius,&expected);
+    std::sort(found.begin(),found.end());
+    return distancesOk && found == expected;
+  });
+}
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,100000,3000);
+  const int N = cmdLine.numPoints;
+  const int Q = cmdLine.numQueries;
+  if (N < maxK+1)
+    throw std::runtime_error("need at least "+std::to_string(maxK+1)+" points");
+  const std::vector<float3> input = generatePoints<float3>(N);
+  std::vector<float3> queries = generatePoints<float3>(Q);
+  for (int i=0;i<Q;i++)
+    if (i % 3 == 1)
+      queries[i] = input[int(drand48()*N) % N];
+    else if (i % 3 == 2)
+      queries[i] = { 2.f*queries[i].x-.5f, 2.f*queries[i].y-.5f, 2.f*queries[i].z-.5f };
+  // about 50 points per query
+  const float radius = powf(50.f/N,1.f/3.f);
+
+  // ------------------------------------------------------------------
+  // builders
+  // ------------------------------------------------------------------
+  std::cout << "builders:" << std::endl;
+  std::vector<float3> tree = input;
+  double t0 = getCurrentTime();
+  buildTree<float3,float>(tree.data(),N);
+  double t1 = getCurrentTime();
+  const int treeValid = validateTree<float3,float>(tree.data(),N);
+  double t2 = getCurrentTime();
+  std::cout << "  (build " << prettyDouble(t1-t0) << "s, validate "
+            << prettyDouble(t2-t1) << "s)" << std::endl;
+  checkBuilder("buildTree",treeValid);
+
+  {
+    // a tree with two swapped children of the root must fail
+    std::vector<float3> broken = tree;
+    std::swap(broken[1],broken[2]);
+    checkVariant("broken tree (validateTree)",1,[&](int) {
+      return validateTree<float3,float>(broken.data(),N) == 1;
+    });
+  }
+
+  {
+    std::vector<float3> withStats = input;
+    BuildStats stats;
+    buildTree<float3,float>(withStats.data(),N,nullptr,&stats);
+    checkBuilder("buildTree w/ stats",validateTree<float3,float>(withStats.data(),N));
+    checkVariant("buildTree w/ stats == buildTree",1,[&](int) {
+      return !memcmp(withStats.data(),tree.data(),N*sizeof(float3));
+    });
+  }
+  {
+    std::vector<float3> withScratch = input;
+    std::vector<float3> scratch(N);
+    buildTreeWithScratch<float3,float>(withScratch.data(),N,scratch.data());
+    checkBuilder("buildTreeWithScratch",validateTree<float3,float>(withScratch.data(),N));
+  }
+
+  const std::vector<int> splitDims = highdim::chooseSplitDims<float3,float,3>(input.data(),N);
+  std::vector<float3> highdimTree = input;
+  buildTree<float3,float>(highdimTree.data(),N,splitDims.data());
+  checkBuilder("buildTree w/ chosen split dims",
+               validateTree<float3,float>(highdimTree.data(),N,splitDims.data()));
+
+  const std::vector<int> offsets = { 0, N/5, N/2, N/2, N };
+  const int numSegments = (int)offsets.size()-1;
+  std::vector<float3> segments = input;
+  segmented::buildTrees<float3,float>(segments.data(),offsets.data(),numSegments);
+  checkVariant("segmented::buildTrees (validateTree)",numSegments,[&](int s) {
+    return validateTree<float3,float>(segments.data()+offsets[s],offsets[s+1]-offsets[s]) == -1;
+  });
+
+  sharded::ShardedForest<float3,float,3> forest;
+  forest.build(input.data(),N,3);
+  checkVariant("ShardedForest::build (validateTree)",forest.router.numShards(),[&](int s) {
+    return validateTree<float3,float>(forest.shards[s].data(),(int)forest.shards[s].size()) == -1
+      && (int)forest.shards[s].size() == forest.router.offsets[s+1]-forest.router.offsets[s];
+  });
+  std::vector<float3> global;
+  for (auto &shard : forest.shards)
+    global.insert(global.end(),shard.begin(),shard.end());
+
+  // ------------------------------------------------------------------
+  // reference results
+  // ------------------------------------------------------------------
+  // all trees above are over the same points, so the reference
+  // distances don't depend on which one of them we scan
+  const reference::BruteForce<float3,float,3> reference(tree.data(),N);
+  std::vector<int>   refFCP(Q), refKNN(Q*maxK), refCount(Q);
+  std::vector<float> refFCPDist2(Q), refKNNDist2(Q*maxK);
+  double t3 = getCurrentTime();
+  reference.fcpBatch(refFCP.data(),refFCPDist2.data(),queries.data(),Q);
+  double t4 = getCurrentTime();
+  reference.knnBatch(refKNN.data(),refKNNDist2.data(),maxK,queries.data(),Q);
+  reference.countBatch(refCount.data(),radius,queries.data(),Q);
+  std::cout << "reference fcp: " << prettyDouble(Q/(t4-t3)) << " queries/s ("
+            << prettyDouble(double(Q)*N/(t4-t3)) << " distances/s)" << std::endl;
+
+  // ------------------------------------------------------------------
+  // fcp variants
+  // ------------------------------------------------------------------
+  std::cout << "fcp:" << std::endl;
+  auto fcpMatches = [&](int i, int result, const float3 *points) {
+    return result >= 0 && dist2(queries[i],points[result]) == refFCPDist2[i];
+  };
+  checkVariant("fcp",Q,[&](int i) {
+    return fcpMatches(i,fcp<float3,float,3>(queries[i],tree.data(),N),tree.data());
+  });
+  checkVariant("fcpWithHint",Q,[&](int i) {
+    const int hint = (i*7919) % N;
+    return fcpMatches(i,fcpWithHint<float3,float,3>(queries[i],hint,tree.data(),N),tree.data());
+  });
+  checkVariant("fcpInRadius",Q,[&](int i) {
+    // just outside the closest point, and well within it
+    const float closest = sqrtf(refFCPDist2[i]);
+    return fcpMatches(i,fcpInRadius<float3,float,3>(queries[i],closest*1.01f+1e-6f,tree.data(),N),tree.data())
+      && (closest < 1e-3f || fcpInRadius<float3,float,3>(queries[i],closest*.99f,tree.data(),N) == -1);
+  });
+  checkVariant("cct::fcp",Q,[&](int i) {
+    return fcpMatches(i,cct::fcp<float3,float,3>(queries[i],tree.data(),N),tree.data());
+  });
+  {
+    std::vector<int> results(Q);
+    fcpBatch<float3,float,3>(results.data(),queries.data(),Q,tree.data(),N);
+    checkVariant("fcpBatch",Q,[&](int i) { return fcpMatches(i,results[i],tree.data()); });
+  }
+  checkVariant("highdim::fcp",Q,[&](int i) {
+    return fcpMatches(i,highdim::fcp<float3,float,3>(queries[i],highdimTree.data(),N,splitDims.data()),
+                      highdimTree.data());
+  });
+  {
+    std::vector<quantized::QuantizedPoint<3>> quantizedPoints(N);
+    const quantized::QuantizedDomain<float,3> domain
+      = quantized::quantizeTree<float3,float,3>(quantizedPoints.data(),tree.data(),N);
+    checkVariant("quantized::fcp",Q,[&](int i) {
+      return fcpMatches(i,quantized::fcp<float3,float,3>(queries[i],domain,quantizedPoints.data(),
+                                                         tree.data(),N),tree.data());
+    });
+  }
+  {
+    std::vector<float3> bucketPoints = input;
+    bucketed::BucketTree<float,3> bucketTree;
+    bucketed::buildTree<float3,float,3>(bucketTree,bucketPoints.data(),N);
+    checkVariant("bucketed::fcp",Q,[&](int i) {
+      return fcpMatches(i,bucketed::fcp<float3,float,3>(queries[i],bucketTree),bucketPoints.data());
+    });
+  }
+  checkVariant("ShardedForest::fcp",Q,[&](int i) {
+    return fcpMatches(i,forest.fcp(queries[i]),global.data());
+  });
+  {
+    std::vector<float3> queryTree = queries;
+    buildTree<float3,float>(queryTree.data(),Q);
+    std::vector<int> results(Q);
+    dualtree::fcpJoin<float3,float,3>(results.data(),queryTree.data(),Q,tree.data(),N);
+    checkVariant("dualtree::fcpJoin",Q,[&](int i) {
+      float refDist2;
+      reference.fcp(queryTree[i],&refDist2);
+      return results[i] >= 0 && dist2(queryTree[i],tree[results[i]]) == refDist2;
+    });
+
+    std::vector<std::atomic<int>> counts(Q);
+    for (auto &count : counts) count = 0;
+    dualtree::radiusJoin<float3,float,3>(radius,queryTree.data(),Q,tree.data(),N,
+                                         [&](int q, int r, float d2) {
+                                           if (d2 == dist2(queryTree[q],tree[r])) counts[q]++;
+                                         });
+    checkVariant("dualtree::radiusJoin",Q,[&](int i) {
+      return counts[i] == reference.radiusQuery(queryTree[i],radius);
+    });
+  }
+  {
+    // segments are different point sets, so each needs its own reference
+    std::vector<std::unique_ptr<reference::BruteForce<float3,float,3>>> segmentRefs;
+    for (int s=0;s<numSegments;s++)
+      segmentRefs.emplace_back(new reference::BruteForce<float3,float,3>
+                               (segments.data()+offsets[s],offsets[s+1]-offsets[s]));
+    std::vector<int> treeIDs(Q), results(Q);
+    for (int i=0;i<Q;i++) treeIDs[i] = i % numSegments;
+    segmented::fcpBatch<float3,float,3>(results.data(),queries.data(),treeIDs.data(),Q,
+                                        segments.data(),offsets.data());
+    checkVariant("segmented::fcpBatch",Q,[&](int i) {
+      float refDist2;
+      const int refID = segmentRefs[treeIDs[i]]->fcp(queries[i],&refDist2);
+      if (refID < 0) return results[i] == -1;
+      return results[i] >= offsets[treeIDs[i]] && results[i] < offsets[treeIDs[i]+1]
+        && dist2(queries[i],segments[results[i]]) == refDist2;
+    });
+  }
+
+  // ------------------------------------------------------------------
+  // knn variants
+  // ------------------------------------------------------------------
+  std::cout << "knn:" << std::endl;
+  auto knnMatchesRef = [&](int i, const int *ids, const float *d2, int k, const float3 *points) {
+    return knnMatches(ids,d2,k,queries[i],points,N,refKNNDist2.data()+i*maxK);
+  };
+  checkVariant("knn w/ FixedCandidateList<8>",Q,[&](int i) {
+    FixedCandidateList<8> list(std::numeric_limits<float>::infinity());
+    knn<float3,float,3>(list,queries[i],tree.data(),N);
+    int ids[8]; float d2[8];
+    decodeList<FixedCandidateList<8>,8>(ids,d2,list);
+    return knnMatchesRef(i,ids,d2,8,tree.data());
+  });
+  checkVariant("knn w/ HeapCandidateList<20>",Q,[&](int i) {
+    HeapCandidateList<20> list(std::numeric_limits<float>::infinity());
+    knn<float3,float,3>(list,queries[i],tree.data(),N);
+    int ids[20]; float d2[20];
+    decodeList<HeapCandidateList<20>,20>(ids,d2,list);
+    return knnMatchesRef(i,ids,d2,20,tree.data());
+  });
+  for (int k : { 1, 8, 50, int(maxK) }) {
+    // covers all three of knnRuntimeK()'s candidate lists
+    checkVariant("knnRuntimeK, k="+std::to_string(k),Q,[&](int i) {
+      std::vector<uint64_t> storage(runtimeKStorageSize(k));
+      std::vector<int>   ids(k);
+      std::vector<float> d2(k);
+      return knnRuntimeK<float3,float,3>(ids.data(),d2.data(),k,storage.data(),
+                                         queries[i],tree.data(),N) == k
+        && knnMatchesRef(i,ids.data(),d2.data(),k,tree.data());
+    });
+  }
+  {
+    const int k = 50;
+    std::vector<int>   ids(Q*k);
+    std::vector<float> d2(Q*k);
+    knnBatch<float3,float,3>(ids.data(),d2.data(),k,queries.data(),Q,tree.data(),N);
+    checkVariant("knnBatch, k=50",Q,[&](int i) {
+      return knnMatchesRef(i,ids.data()+i*k,d2.data()+i*k,k,tree.data());
+    });
+  }
+  checkVariant("NeighborCursor, first 100",Q,[&](int i) {
+    NeighborCursor<float3,float,3> cursor(tree.data(),N);
+    cursor.reset(queries[i]);
+    int ids[100]; float d2[100];
+    for (int j=0;j<100;j++)
+      ids[j] = cursor.next(&d2[j]);
+    return knnMatchesRef(i,ids,d2,100,tree.data());
+  });
+  checkVariant("ShardedForest::knn",Q,[&](int i) {
+    HeapCandidateList<20> list(std::numeric_limits<float>::infinity());
+    forest.knn(list,queries[i]);
+    int ids[20]; float d2[20];
+    decodeList<HeapCandidateList<20>,20>(ids,d2,list);
+    return knnMatchesRef(i,ids,d2,20,global.data());
+  });
+  {
+    // the graph has all N points as queries; check a sample of them
+    KNNGraph graph;
+    allKNN<float3,float,3,8>(graph,tree.data(),N);
+    checkVariant("allKNN",Q,[&](int i) {
+      const int pointID = int((i*2654435761u) % uint32_t(N));
+      int   refIDs[9];
+      float refDist2[9];
+      reference.knn(refIDs,refDist2,9,tree[pointID]);
+      const size_t begin = graph.offsets[pointID];
+      if (graph.offsets[pointID+1]-begin != 8) return false;
+      // the point itself is (one of the) closest, at distance 0
+      for (int j=0;j<8;j++)
+        if (graph.neighbors[begin+j] == pointID
+            || graph.dist2[begin+j] != refDist2[j+1]
+            || dist2(tree[pointID],tree[graph.neighbors[begin+j]]) != graph.dist2[begin+j])
+          return false;
+      return true;
+    });
+  }
+
+  // ------------------------------------------------------------------
+  // radius variants
+  // ------------------------------------------------------------------
+  std::cout << "radius:" << std::endl;
+  checkVariant("radiusQuery",Q,[&](int i) {
+    std::vector<int> found;
+    bool distancesOk = true;
+    radiusQuery<float3,float,3>(queries[i],radius,tree.data(),N,[&](int pointID, float d2) {
+      distancesOk &= (d2 == dist2(queries[i],tree[pointID]));
+      found.push_back(pointID);
+    });
+    std::vector<int> expected;
+    reference.radiusQuery(queries[i],radius,&expected);
+    std::sort(found.begin(),found.end());
+    return distancesOk && found == expected;
+  });
+  {
+    std::vector<SubtreeAggregate<float,3>> aggregates(N);
+    computeAggregates<float3,float,3>(aggregates.data(),tree.data(),N,
+                                      [](const float3 &) { return 1.f; });
+    checkVariant("countInRadius",Q,[&](int i) {
+      return countInRadius<float3,float,3>(queries[i],radius,tree.data(),aggregates.data(),N)
+        == refCount[i];
+    });
+  }
+  checkVariant("ShardedForest::radiusQuery",Q,[&](int i) {
+    bool distancesOk = true;
+    const int count = forest.radiusQuery(queries[i],radius,[&](int pointID, float d2) {
+      distancesOk &= (d2 == dist2(queries[i],global[pointID]));
+    });
+    return distancesOk && count == refCount[i];
+  });
+
+  // ------------------------------------------------------------------
+  // other metrics
+  // ------------------------------------------------------------------
+  std::cout << "metrics:" << std::endl;
+  checkMetric("L2",metrics::L2<float,3>(),tree,queries,radius);
+  metrics::WeightedL2<float,3> weighted;
+  weighted.weight[0] = 1.f; weighted.weight[1] = 4.f; weighted.weight[2] = .25f;
+  checkMetric("WeightedL2",weighted,tree,queries,radius);
+  checkMetric("L1",metrics::L1<float,3>(),tree,queries,radius);
+  checkMetric("LInf",metrics::LInf<float,3>(),tree,queries,radius);
+
+  // ------------------------------------------------------------------
+  // filtered queries
+  // ------------------------------------------------------------------
+  std::cout << "filtered:" << std::endl;
+  {
+    auto accept = [](int pointID, const float3 &point) {
+      return pointID % 3 != 0 && point.z > .2f;
+    };
+    // the reference only gets to see the accepted points (in
+    // increasing order of their IDs in the tree)
+    std::vector<float3> acceptedPoints;
+    std::vector<int>    acceptedIDs;
+    for (int i=0;i<N;i++)
+      if (accept(i,tree[i])) {
+        acceptedPoints.push_back(tree[i]);
+        acceptedIDs.push_back(i);
+      }
+    const reference::BruteForce<float3,float,3>
+      filteredRef(acceptedPoints.data(),(int)acceptedPoints.size());
+    checkVariant("filtered::fcp",Q,[&](int i) {
+      float refDist2;
+      filteredRef.fcp(queries[i],&refDist2);
+      const int result = filtered::fcp<float3,float,3>(queries[i],tree.data(),N,accept);
+      return result >= 0 && accept(result,tree[result])
+        && dist2(queries[i],tree[result]) == refDist2;
+    });
+    checkVariant("filtered::knn w/ HeapCandidateList<20>",Q,[&](int i) {
+      int   refIDs[20];
+      float refDist2[20];
+      filteredRef.knn(refIDs,refDist2,20,queries[i]);
+      HeapCandidateList<20> list(std::numeric_limits<float>::infinity());
+      filtered::knn<float3,float,3>(list,queries[i],tree.data(),N,accept);
+      int ids[20]; float d2[20];
+      decodeList<HeapCandidateList<20>,20>(ids,d2,list);
+      for (int j=0;j<20;j++)
+        if (ids[j] < 0 || !accept(ids[j],tree[ids[j]])) return false;
+      return knnMatches(ids,d2,20,queries[i],tree.data(),N,refDist2);
+    });
+    checkVariant("knnRuntimeK w/ predicate, k=50",Q,[&](int i) {
+      const int k = 50;
+      int   refIDs[k];
+      float refDist2[k];
+      const int refFound = filteredRef.knn(refIDs,refDist2,k,queries[i],radius);
+      std::vector<uint64_t> storage(runtimeKStorageSize(k));
+      int ids[k]; float d2[k];
+      const int numFound
+        = knnRuntimeK<float3,float,3>(ids,d2,k,storage.data(),queries[i],tree.data(),N,
+                                      radius,accept);
+      if (numFound != refFound) return false;
+      for (int j=0;j<numFound;j++)
+        if (!accept(ids[j],tree[ids[j]])) return false;
+      return knnMatches(ids,d2,numFound,queries[i],tree.data(),N,refDist2);
+    });
+    checkVariant("filtered::radiusQuery",Q,[&](int i) {
+      std::vector<int> found;
+      bool distancesOk = true;
+      const int count
+        = filtered::radiusQuery<float3,float,3>(queries[i],radius,tree.data(),N,accept,
+                                                [&](int pointID, float d2) {
+                                                  distancesOk &= (d2 == dist2(queries[i],tree[pointID]));
+                                                  found.push_back(pointID);
+                                                });
+      std::vector<int> expected;
+      filteredRef.radiusQuery(queries[i],radius,&expected);
+      for (auto &id : expected) id = acceptedIDs[id];
+      std::sort(found.begin(),found.end());
+      return distancesOk && count == (int)found.size() && found == expected;
+    });
+  }
+
+  // ------------------------------------------------------------------
+  // periodic queries
+  // ------------------------------------------------------------------
+  std::cout << "periodic:" << std::endl;
+  {
+    // all points are in [0,1)^3; a third of the queries are outside
+    // of it, and have to get wrapped
+    PeriodicMetric periodicMetric;
+    for (int d=0;d<3;d++) {
+      periodicMetric.box.lower[d] = 0.f;
+      periodicMetric.box.upper[d] = 1.f;
+    }
+    const periodic::PeriodicBox<float,3> &box = periodicMetric.box;
+    const reference::BruteForce<float3,float,3,PeriodicMetric>
+      periodicRef(tree.data(),N,periodicMetric);
+    std::vector<float3> wrapped(Q);
+    for (int i=0;i<Q;i++)
+      wrapped[i] = { periodic::wrap(queries[i].x,0,box),
+                     periodic::wrap(queries[i].y,1,box),
+                     periodic::wrap(queries[i].z,2,box) };
+    auto periodicDist2 = [&](int i, int pointID) {
+      return periodic::sqrDistance<float3,float,3>(wrapped[i],tree[pointID],box);
+    };
+    checkVariant("periodic::fcp",Q,[&](int i) {
+      float refDist2;
+      periodicRef.fcp(wrapped[i],&refDist2);
+      const int result = periodic::fcp<float3,float,3>(queries[i],box,tree.data(),N);
+      return result >= 0 && periodicDist2(i,result) == refDist2;
+    });
+    checkVariant("periodic::knn w/ HeapCandidateList<20>",Q,[&](int i) {
+      int   refIDs[20];
+      float refDist2[20];
+      periodicRef.knn(refIDs,refDist2,20,wrapped[i]);
+      HeapCandidateList<20> list(std::numeric_limits<float>::infinity());
+      periodic::knn<float3,float,3>(list,queries[i],box,tree.data(),N);
+      int ids[20]; float d2[20];
+      decodeList<HeapCandidateList<20>,20>(ids,d2,list);
+      return knnMatches(ids,d2,20,wrapped[i],tree.data(),N,refDist2,periodicMetric);
+    });
+    checkVariant("periodic::radiusQuery",Q,[&](int i) {
+      std::vector<int> found;
+      bool distancesOk = true;
+      periodic::radiusQuery<float3,float,3>(queries[i],radius,box,tree.data(),N,
+                                            [&](int pointID, float d2) {
+                                              distancesOk &= (d2 == periodicDist2(i,pointID));
+                                              found.push_back(pointID);
+                                            });
+      std::vector<int> expected;
+      periodicRef.radiusQuery(wrapped[i],radius,&expected);
+      std::sort(found.begin(),found.end());
+      return distancesOk && found == expected;
+    });
+  }
+
+  // ------------------------------------------------------------------
+  // ray queries
+  // ------------------------------------------------------------------
+  std::cout << "rays:" << std::endl;
+  {
+    typedef Ray<float3,float> ray_t;
+    // rays from inside the domain, in random directions; every
+    // second one a segment, and every fourth one starting at t=.25
+    const int R = std::min(Q,1000);
+    std::vector<ray_t> rays(R);
+    for (int i=0;i<R;i++) {
+      rays[i].origin = { (float)drand48(), (float)drand48(), (float)drand48() };
+      float3 dir = { (float)drand48()-.5f, (float)drand48()-.5f, (float)drand48()-.5f };
+      const float len = sqrtf(dir.x*dir.x+dir.y*dir.y+dir.z*dir.z);
+      rays[i].direction = { dir.x/len, dir.y/len, dir.z/len };
+      if (i % 2) rays[i].tMax = (float)drand48();
+      if (i % 4 == 3) rays[i].tMin = .25f*rays[i].tMax;
+    }
+    // a few points per unit length of ray
+    const float rayRadius = sqrtf(4.f/(float(M_PI)*N));
+    const float rayRadius2 = rayRadius*rayRadius;
+
+    checkVariant("pointsNearRay",R,[&](int i) {
+      const ray_t &ray = rays[i];
+      std::vector<int> found;
+      bool distancesOk = true;
+      pointsNearRay<float3,float,3>(ray,rayRadius,tree.data(),N,
+                                    [&](int pointID, float t, float d2) {
+                                      distancesOk
+                                        &= (t >= ray.tMin && t <= ray.tMax
+                                            && d2 == rays::sqrDistanceAt<float3,float,3>
+                                            (ray,tree[pointID],t));
+                                      found.push_back(pointID);
+                                    });
+      std::vector<int> expected;
+      for (int j=0;j<N;j++) {
+        float t, lineDist2;
+        rays::closestApproach<float3,float,3>(ray,tree[j],t,lineDist2);
+        t = std::min(std::max(t,ray.tMin),ray.tMax);
+        if (rays::sqrDistanceAt<float3,float,3>(ray,tree[j],t) <= rayRadius2)
+          expected.push_back(j);
+      }
+      std::sort(found.begin(),found.end());
+      return distancesOk && found == expected;
+    });
+    checkVariant("firstPointAlongRay",R,[&](int i) {
+      const ray_t &ray = rays[i];
+      const float dd = ray.direction.x*ray.direction.x
+        + ray.direction.y*ray.direction.y + ray.direction.z*ray.direction.z;
+      int   expected  = -1;
+      float expectedT = ray.tMax;
+      for (int j=0;j<N;j++) {
+        float t, lineDist2;
+        rays::closestApproach<float3,float,3>(ray,tree[j],t,lineDist2);
+        if (lineDist2 > rayRadius2) continue;
+        const float halfChord = sqrtf((rayRadius2-lineDist2)/dd);
+        if (t+halfChord < ray.tMin) continue;
+        const float tEnter = std::max(ray.tMin,t-halfChord);
+        if (tEnter > expectedT || (tEnter == expectedT && expected >= 0)) continue;
+        expected  = j;
+        expectedT = tEnter;
+      }
+      float tHit;
+      const int result = firstPointAlongRay<float3,float,3>(ray,rayRadius,tree.data(),N,&tHit);
+      return result == expected && (result < 0 || tHit == expectedT);
+    });
+  }
+
+  if (numFailedVariants)
+    throw std::runtime_error(std::to_string(numFailedVariants)+" variant(s) do not match the reference!?");
+  std::cout << "all variants match the reference" << std::endl;
+}
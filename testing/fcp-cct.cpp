@@ -0,0 +1,116 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* compares the default (plane-distance culling) fcp traversal with
+   the "closest corner tracking" one, for 3D, 4D, and 8D data */
+
+#include "cpukd/builder.h"
+#include "cpukd/fcp.h"
+#include "cpukd/parallel_for.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+template<int numDims, bool cct>
+void runQueries(int *d_results,
+                int *d_numVisited,
+                const floatN<numDims> *d_queries,
+                int numQueries,
+                const floatN<numDims> *d_nodes,
+                int numNodes)
+{
+  typedef floatN<numDims> point_t;
+  parallel_for_blocked
+    (0,numQueries,1024,
+     [&](size_t begin, size_t end) {
+       for (size_t i=begin;i<end;i++) {
+         int *numVisited = d_numVisited ? d_numVisited+i : nullptr;
+         d_results[i]
+           = cct
+           ? cpukd::cct::fcp<point_t,float,numDims>(d_queries[i],d_nodes,numNodes,numVisited)
+           : cpukd::fcp<point_t,float,numDims>(d_queries[i],d_nodes,numNodes,numVisited);
+       }
+     });
+}
+
+template<int numDims, bool cct>
+void measure(const char *name,
+             std::vector<int> &results,
+             const std::vector<floatN<numDims>> &queries,
+             const std::vector<floatN<numDims>> &points,
+             int numRepeats)
+{
+  std::vector<int> numVisited(queries.size(),0);
+  runQueries<numDims,cct>(results.data(),numVisited.data(),
+                          queries.data(),(int)queries.size(),
+                          points.data(),(int)points.size());
+  double sumVisited = 0.;
+  for (auto v : numVisited) sumVisited += v;
+
+  double t0 = getCurrentTime();
+  for (int r=0;r<numRepeats;r++)
+    runQueries<numDims,cct>(results.data(),nullptr,
+                            queries.data(),(int)queries.size(),
+                            points.data(),(int)points.size());
+  double t1 = getCurrentTime();
+  std::cout << "  " << name << ": "
+            << prettyDouble(sumVisited/queries.size()) << " nodes visited/query, "
+            << prettyDouble(queries.size()*numRepeats/(t1-t0)) << " queries/s" << std::endl;
+}
+
+template<int numDims>
+void run(const CmdLine &cmdLine)
+{
+  typedef floatN<numDims> point_t;
+  std::cout << "### " << numDims << "D data" << std::endl;
+  std::vector<point_t> points = generatePoints<point_t>(cmdLine.numPoints);
+  buildTree<point_t,float,numDims>(points.data(),(int)points.size());
+  std::vector<point_t> queries = generatePoints<point_t>(cmdLine.numQueries);
+
+  std::vector<int> results_stack(queries.size());
+  std::vector<int> results_cct(queries.size());
+  measure<numDims,false>("plane culling ",results_stack,queries,points,cmdLine.numRepeats);
+  measure<numDims,true> ("corner culling",results_cct,queries,points,cmdLine.numRepeats);
+
+  // both are exact, so results may only differ for equidistant points
+  for (size_t i=0;i<queries.size();i++) {
+    float d_stack = sqrDistance<point_t,float,numDims>(queries[i],points[results_stack[i]]);
+    float d_cct   = sqrDistance<point_t,float,numDims>(queries[i],points[results_cct[i]]);
+    if (d_stack != d_cct)
+      throw std::runtime_error("cct fcp result does not match stack-based fcp!?");
+  }
+
+  if (cmdLine.verify) {
+    const size_t numChecked = std::min(queries.size(),size_t(1000));
+    for (size_t i=0;i<numChecked;i++) {
+      float reported = sqrDistance<point_t,float,numDims>(queries[i],points[results_cct[i]]);
+      for (size_t j=0;j<points.size();j++)
+        if (sqrDistance<point_t,float,numDims>(queries[i],points[j]) < reported)
+          throw std::runtime_error("cct fcp verification failed ...");
+    }
+    std::cout << "  verified " << numChecked << " queries against brute force" << std::endl;
+  }
+}
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av);
+  run<3>(cmdLine);
+  run<4>(cmdLine);
+  run<8>(cmdLine);
+}
@@ -0,0 +1,86 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* k-nn graph over all points of a tree: allKNN() vs one independent
+   knn query per point, in random order */
+
+#include "cpukd/builder.h"
+#include "cpukd/allknn.h"
+#include "helpers.h"
+#include <random>
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+#define K 8
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,1000000);
+  
+  std::vector<float3> points = generatePoints<float3>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  buildTree<float3,float>(points.data(),N);
+
+  KNNGraph graph;
+  double t0 = getCurrentTime();
+  allKNN<float3,float,3,K>(graph,points.data(),N);
+  double t1 = getCurrentTime();
+  std::cout << "allKNN:     " << prettyDouble(N/(t1-t0)) << " points/s" << std::endl;
+
+  std::vector<int> order(N);
+  for (int i=0;i<N;i++) order[i] = i;
+  std::shuffle(order.begin(),order.end(),std::mt19937(0));
+  std::vector<float> naive_dist2(size_t(N)*K);
+  double t2 = getCurrentTime();
+  parallel_for_blocked
+    (0,N,1024,
+     [&](size_t begin, size_t end) {
+       for (size_t j=begin;j<end;j++) {
+         const int i = order[j];
+         FixedCandidateList<K> result(std::numeric_limits<float>::infinity());
+         knn<float3,float,3>(result,points[i],points.data(),N,
+                             [i](int pointID, const float3 &) { return pointID != i; });
+         for (int k=0;k<K;k++)
+           naive_dist2[size_t(i)*K+k] = result.decode_dist2(result.entry[k]);
+       }
+     });
+  double t3 = getCurrentTime();
+  std::cout << "naive loop: " << prettyDouble(N/(t3-t2)) << " points/s" << std::endl;
+
+  for (int i=0;i<N;i++)
+    for (int k=0;k<int(graph.offsets[i+1]-graph.offsets[i]);k++)
+      if (graph.dist2[graph.offsets[i]+k] != naive_dist2[size_t(i)*K+k])
+        throw std::runtime_error("allKNN does not match naive knn loop!?");
+  std::cout << "allKNN results match naive knn loop" << std::endl;
+
+  if (cmdLine.verify) {
+    const int numChecked = std::min(N,1000);
+    for (int i=0;i<numChecked;i++) {
+      std::vector<float> dists;
+      for (int j=0;j<N;j++)
+        if (j != i) dists.push_back(sqrDistance<float3,float,3>(points[i],points[j]));
+      std::sort(dists.begin(),dists.end());
+      for (int k=0;k<int(graph.offsets[i+1]-graph.offsets[i]);k++) {
+        const int nb = graph.neighbors[graph.offsets[i]+k];
+        if (nb == i || sqrDistance<float3,float,3>(points[i],points[nb]) != dists[k])
+          throw std::runtime_error("allKNN verification failed ...");
+      }
+    }
+    std::cout << "verified " << numChecked << " points against brute force" << std::endl;
+  }
+}
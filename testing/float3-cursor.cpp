@@ -0,0 +1,133 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* incremental neighbor cursor vs re-running knn with doubling k, for
+   consumers that take neighbors until some condition holds; here,
+   each query wants a (log-uniformly) random number of 1 to 1000
+   neighbors, which neither side knows up front */
+
+#include "cpukd/builder.h"
+#include "cpukd/knn.h"
+#include "cpukd/cursor.h"
+#include "cpukd/parallel_for.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,1000000,100000);
+  std::vector<float3> points = generatePoints<float3>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  buildTree<float3,float>(points.data(),N);
+  const std::vector<float3> queries = generatePoints<float3>(cmdLine.numQueries);
+  const int Q = (int)queries.size();
+
+  std::vector<int> numWanted(Q);
+  for (auto &m : numWanted)
+    m = std::min(N,int(powf(1000.f,(float)drand48())));
+
+  // sum of the consumed neighbors' distances, as the "application"
+  std::vector<float> sumCursor(Q), sumKNN(Q);
+
+  double t0 = getCurrentTime();
+  parallel_for_blocked
+    (0,Q,1024,
+     [&](size_t begin, size_t end) {
+       NeighborCursor<float3,float,3> cursor(points.data(),N);
+       for (size_t i=begin;i<end;i++) {
+         cursor.reset(queries[i]);
+         float sum = 0.f, dist2;
+         for (int j=0;j<numWanted[i];j++) {
+           cursor.next(&dist2);
+           sum += dist2;
+         }
+         sumCursor[i] = sum;
+       }
+     });
+  double t1 = getCurrentTime();
+  std::cout << "cursor:          " << prettyDouble(Q/(t1-t0)) << " queries/s" << std::endl;
+
+  double t2 = getCurrentTime();
+  parallel_for_blocked
+    (0,Q,1024,
+     [&](size_t begin, size_t end) {
+       std::vector<uint64_t> storage;
+       std::vector<int>      ids;
+       std::vector<float>    dist2;
+       for (size_t i=begin;i<end;i++) {
+         // take neighbors one by one, and re-run with twice the k
+         // whenever we run out
+         float sum = 0.f;
+         int k = 0;
+         for (int j=0;j<numWanted[i];j++) {
+           if (j == k) {
+             k = std::max(8,2*k);
+             storage.resize(runtimeKStorageSize(k));
+             ids.resize(k);
+             dist2.resize(k);
+             knnRuntimeK<float3,float,3>(ids.data(),dist2.data(),k,storage.data(),
+                                         queries[i],points.data(),N);
+           }
+           sum += dist2[j];
+         }
+         sumKNN[i] = sum;
+       }
+     });
+  double t3 = getCurrentTime();
+  std::cout << "doubling-k knn:  " << prettyDouble(Q/(t3-t2)) << " queries/s" << std::endl;
+
+  // same distances in the same order, so same float sums
+  if (sumCursor != sumKNN)
+    throw std::runtime_error("cursor and knn disagree!?");
+
+  // runs to the end, with a max radius
+  const float maxRadius = powf(100.f/N,1.f/3.f);
+  NeighborCursor<float3,float,3> cursor(points.data(),N);
+  for (int i=0;i<std::min(Q,1000);i++) {
+    cursor.reset(queries[i],maxRadius);
+    float prev = 0.f, dist2;
+    int count = 0, pointID;
+    while ((pointID = cursor.next(&dist2)) >= 0) {
+      if (dist2 < prev || dist2 != sqrDistance<float3,float,3>(queries[i],points[pointID]))
+        throw std::runtime_error("cursor out of order!?");
+      prev = dist2;
+      ++count;
+    }
+    int expected = 0;
+    for (int j=0;j<N;j++)
+      expected += sqrDistance<float3,float,3>(queries[i],points[j]) <= maxRadius*maxRadius;
+    if (count != expected)
+      throw std::runtime_error("cursor with max radius returned wrong number of points!?");
+    if (!cmdLine.verify) break;
+  }
+  std::cout << "cursor matches knn, and max-radius cursor matches brute force" << std::endl;
+
+  // the largest tree a cursor can handle; the constructor doesn't
+  // touch the points, so none are needed for this
+  NeighborCursor<float3,float,3>(nullptr,NeighborCursor<float3,float,3>::maxNumPoints);
+  bool rejected = false;
+  try {
+    NeighborCursor<float3,float,3>(nullptr,NeighborCursor<float3,float,3>::maxNumPoints+1);
+  } catch (const std::runtime_error &) {
+    rejected = true;
+  }
+  if (!rejected)
+    throw std::runtime_error("cursor accepted more points than it can encode!?");
+  std::cout << "cursor rejects trees with more than 2^30 points" << std::endl;
+}
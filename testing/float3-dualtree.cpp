@@ -0,0 +1,126 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* dual-tree fcp and fixed-radius joins vs batched single-tree
+   queries (both in the queries' original, random order, and in the
+   query tree's order) */
+
+#include "cpukd/builder.h"
+#include "cpukd/batch.h"
+#include "cpukd/radius.h"
+#include "cpukd/dualtree.h"
+#include "helpers.h"
+#include <atomic>
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,1000000,1000000);
+
+  std::vector<float3> points = generatePoints<float3>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  buildTree<float3,float>(points.data(),N);
+  std::vector<float3> queries = generatePoints<float3>(cmdLine.numQueries);
+  const int Q = (int)queries.size();
+
+  // ------------------------------------------------------------------
+  // fcp join
+  // ------------------------------------------------------------------
+  std::vector<int> results_random(Q);
+  double t0 = getCurrentTime();
+  fcpBatch<float3,float,3>(results_random.data(),queries.data(),Q,points.data(),N);
+  double t1 = getCurrentTime();
+  std::cout << "fcpBatch, random order: " << prettyDouble(Q/(t1-t0)) << " queries/s" << std::endl;
+
+  std::vector<float3> queryNodes = queries;
+  double t2 = getCurrentTime();
+  buildTree<float3,float>(queryNodes.data(),Q);
+  double t3 = getCurrentTime();
+  std::cout << "building query tree took " << prettyDouble(t3-t2) << "s" << std::endl;
+
+  std::vector<int> results_single(Q);
+  double t4 = getCurrentTime();
+  fcpBatch<float3,float,3>(results_single.data(),queryNodes.data(),Q,points.data(),N);
+  double t5 = getCurrentTime();
+  std::cout << "fcpBatch, tree order:   " << prettyDouble(Q/(t5-t4)) << " queries/s" << std::endl;
+
+  std::vector<int> results_dual(Q);
+  double t6 = getCurrentTime();
+  dualtree::fcpJoin<float3,float,3>(results_dual.data(),queryNodes.data(),Q,points.data(),N);
+  double t7 = getCurrentTime();
+  std::cout << "dualtree::fcpJoin:      " << prettyDouble(Q/(t7-t6)) << " queries/s"
+            << " (" << prettyDouble(Q/(t7-t6+t3-t2)) << " incl. query tree build)" << std::endl;
+
+  for (int i=0;i<Q;i++) {
+    float d_single = sqrDistance<float3,float,3>(queryNodes[i],points[results_single[i]]);
+    float d_dual   = sqrDistance<float3,float,3>(queryNodes[i],points[results_dual[i]]);
+    if (d_single != d_dual)
+      throw std::runtime_error("dual-tree fcp result does not match single-tree fcp!?");
+  }
+  std::cout << "fcp join matches single-tree fcp" << std::endl;
+
+  // ------------------------------------------------------------------
+  // radius join, with a radius that has ~10 points in each query's ball
+  // ------------------------------------------------------------------
+  const float radius = cbrtf(10.f/(N*4.f/3.f*float(M_PI)));
+  std::vector<size_t> count_single(Q);
+  double t8 = getCurrentTime();
+  parallel_for_blocked
+    (0,Q,1024,
+     [&](size_t begin, size_t end) {
+       for (size_t i=begin;i<end;i++)
+         count_single[i] = radiusQuery<float3,float,3>(queryNodes[i],radius,points.data(),N,
+                                                       [](int, float) {});
+     });
+  double t9 = getCurrentTime();
+  size_t sum_single = 0;
+  for (auto c : count_single) sum_single += c;
+  std::cout << "radiusQuery batch:      " << prettyDouble(Q/(t9-t8)) << " queries/s, "
+            << prettyNumber(sum_single) << " pairs" << std::endl;
+
+  std::vector<size_t> count_dual(Q,0);
+  double t10 = getCurrentTime();
+  size_t sum_dual
+    = dualtree::radiusJoin<float3,float,3>(radius,queryNodes.data(),Q,points.data(),N,
+                                           [&](int queryID, int, float)
+                                           { count_dual[queryID]++; });
+  double t11 = getCurrentTime();
+  std::cout << "dualtree::radiusJoin:   " << prettyDouble(Q/(t11-t10)) << " queries/s, "
+            << prettyNumber(sum_dual) << " pairs" << std::endl;
+  if (count_dual != count_single)
+    throw std::runtime_error("dual-tree radius join does not match single-tree radius queries!?");
+  std::cout << "radius join matches single-tree radius queries" << std::endl;
+
+  if (cmdLine.verify) {
+    const int numChecked = std::min(Q,1000);
+    for (int i=0;i<numChecked;i++) {
+      float reported = sqrDistance<float3,float,3>(queryNodes[i],points[results_dual[i]]);
+      size_t inRadius = 0;
+      for (int j=0;j<N;j++) {
+        float dist2 = sqrDistance<float3,float,3>(queryNodes[i],points[j]);
+        if (dist2 < reported)
+          throw std::runtime_error("dual-tree fcp verification failed ...");
+        if (dist2 <= radius*radius) inRadius++;
+      }
+      if (inRadius != count_dual[i])
+        throw std::runtime_error("dual-tree radius join verification failed ...");
+    }
+    std::cout << "verified " << numChecked << " queries against brute force" << std::endl;
+  }
+}
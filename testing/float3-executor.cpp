@@ -0,0 +1,169 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* load generator for the micro-batching executor: a few client
+   threads issue single fcp queries at a fixed (open-loop) target
+   rate, either through a QueryExecutor, or by calling fcp()
+   directly; reports achieved rate and latency percentiles (measured
+   from each query's scheduled issue time, so clients falling behind
+   show up as latency) */
+
+#include "cpukd/builder.h"
+#include "cpukd/batch.h"
+#include "cpukd/executor.h"
+#include "helpers.h"
+#include <atomic>
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+typedef std::chrono::steady_clock Clock;
+
+const int    numClients = 4;
+const double duration   = 1.;
+
+template<typename IssueQuery>
+double runClients(int targetQPS, int numQueries, IssueQuery &&issueQuery)
+{
+  const Clock::time_point start = Clock::now();
+  std::vector<std::thread> clients;
+  for (int c=0;c<numClients;c++)
+    clients.push_back(std::thread([&,c]() {
+          for (int i=c;i<numQueries;i+=numClients) {
+            const Clock::time_point scheduled
+              = start + std::chrono::duration_cast<Clock::duration>
+              (std::chrono::duration<double>(i/double(targetQPS)));
+            std::this_thread::sleep_until(scheduled);
+            issueQuery(i,scheduled);
+          }
+        }));
+  for (auto &client : clients) client.join();
+  return std::chrono::duration<double>(Clock::now()-start).count();
+}
+
+void print(const char *name, int numQueries, double seconds,
+           double mean, double p50, double p99, double p999, double avgBatchSize)
+{
+  std::cout << "  " << name << ": " << prettyDouble(numQueries/seconds) << " queries/s, latency"
+            << " mean " << prettyDouble(mean) << "s"
+            << " p50 "  << prettyDouble(p50)  << "s"
+            << " p99 "  << prettyDouble(p99)  << "s"
+            << " p999 " << prettyDouble(p999) << "s";
+  if (avgBatchSize > 0.) std::cout << ", avg batch " << prettyDouble(avgBatchSize);
+  std::cout << std::endl;
+}
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,1000000);
+  std::vector<float3> points = generatePoints<float3>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  buildTree<float3,float>(points.data(),N);
+
+  for (int targetQPS : { 10000, 100000, 200000, 400000 }) {
+    const int numQueries = int(targetQPS*duration);
+    std::cout << "### target " << prettyNumber(targetQPS) << " queries/s" << std::endl;
+    std::vector<float3> queries = generatePoints<float3>(numQueries);
+
+    // direct calls, from the client threads
+    {
+      std::vector<int> results(numQueries);
+      std::mutex histogramMutex;
+      LatencyHistogram histogram;
+      double seconds = runClients
+        (targetQPS,numQueries,[&](int i, Clock::time_point scheduled) {
+          results[i] = fcp<float3,float,3>(queries[i],points.data(),N);
+          double latency = std::chrono::duration<double>(Clock::now()-scheduled).count();
+          std::lock_guard<std::mutex> lock(histogramMutex);
+          histogram.add(latency);
+        });
+      print("direct fcp",numQueries,seconds,histogram.sum/histogram.count,
+            histogram.percentile(.5),histogram.percentile(.99),histogram.percentile(.999),0.);
+    }
+
+    // through the executor
+    {
+      std::vector<int> results(numQueries,-1);
+      std::atomic<int> numCompleted(0);
+      double seconds;
+      QueryExecutor<float3,int>::Stats stats;
+      {
+        QueryExecutor<float3,int> executor
+          ([&](int *d_results, const float3 *d_queries, int count) {
+            fcpBatch<float3,float,3>(d_results,d_queries,count,points.data(),N);
+          });
+        seconds = runClients
+          (targetQPS,numQueries,[&](int i, Clock::time_point) {
+            executor.submit(queries[i],[&,i](const int &result) {
+                results[i] = result;
+                numCompleted++;
+              });
+          });
+        while (numCompleted < numQueries)
+          std::this_thread::yield();
+        stats = executor.stats();
+      }
+      print("executor  ",numQueries,seconds,stats.mean,stats.p50,stats.p99,stats.p999,
+            stats.numQueries/double(stats.numBatches));
+      for (int i=0;i<numQueries;i++)
+        if (results[i] != fcp<float3,float,3>(queries[i],points.data(),N))
+          throw std::runtime_error("executor result does not match fcp!?");
+    }
+  }
+  std::cout << "all executor results match fcp" << std::endl;
+
+  // a throwing batch function must fail its queries' futures and
+  // error callbacks, and a throwing result callback must not keep
+  // the rest of its batch from completing
+  {
+    std::atomic<int> numErrors(0), numCompleted(0);
+    QueryExecutor<float3,int>::Stats stats;
+    {
+      QueryExecutor<float3,int> executor
+        ([&](int *d_results, const float3 *d_queries, int count) {
+          if (d_queries[0].x < 0.f) throw std::runtime_error("bad batch");
+          fcpBatch<float3,float,3>(d_results,d_queries,count,points.data(),N);
+        });
+      std::future<int> failed = executor.submit(float3{-1.f,0.f,0.f});
+      try {
+        failed.get();
+        throw std::runtime_error("executor did not forward batch exception!?");
+      } catch (const std::runtime_error &e) {
+        if (std::string(e.what()) != "bad batch") throw;
+      }
+      executor.submit(float3{-1.f,0.f,0.f},[](const int &) {},
+                      [&](std::exception_ptr) { numErrors++; });
+      while (numErrors < 1)
+        std::this_thread::yield();
+      for (int i=0;i<100;i++)
+        executor.submit(float3{.5f,.5f,.5f},[&,i](const int &) {
+            numCompleted++;
+            if (i % 2) throw std::runtime_error("bad callback");
+          },[&](std::exception_ptr) { numErrors++; });
+      // stats get updated right after a batch's callbacks
+      const Clock::time_point deadline = Clock::now()+std::chrono::seconds(10);
+      do {
+        std::this_thread::yield();
+        stats = executor.stats();
+      } while ((numCompleted < 100 || numErrors < 51 || stats.numFailed < 52)
+               && Clock::now() < deadline);
+    }
+    if (numCompleted != 100 || numErrors != 51 || stats.numFailed != 52)
+      throw std::runtime_error("executor failure count is wrong!?");
+    std::cout << "executor forwards exceptions" << std::endl;
+  }
+}
@@ -0,0 +1,174 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* runtime-k candidate lists: all three list types over a range of k
+   (from 1 to 4096), plus the compile-time FixedCandidateList and
+   HeapCandidateList where k allows, all checked against each other;
+   and knnBatch() with a max radius */
+
+#include "cpukd/builder.h"
+#include "cpukd/knn.h"
+#include "cpukd/batch.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+/*! runs knn with the given list type for all queries; returns
+    queries/s, and each query's k-th distance in kthDist2 */
+template<typename MakeList>
+double runKNN(std::vector<float> &kthDist2,
+              const std::vector<float3> &queries,
+              const std::vector<float3> &points,
+              int numRepeats,
+              MakeList &&makeList)
+{
+  const int Q = (int)queries.size();
+  double t0 = getCurrentTime();
+  for (int r=0;r<numRepeats;r++)
+    parallel_for_blocked
+      (0,Q,1024,
+       [&](size_t begin, size_t end) {
+         std::vector<uint64_t> storage(runtimeKStorageSize(4096));
+         for (size_t i=begin;i<end;i++) {
+           auto list = makeList(storage.data());
+           kthDist2[i] = knn<float3,float,3>(list,queries[i],points.data(),(int)points.size());
+         }
+       });
+  double t1 = getCurrentTime();
+  return Q*numRepeats/(t1-t0);
+}
+
+/*! same for the runtime-k lists, including the final sort; the
+    buffered list's knn() return value is only an upper bound, so take
+    the k-th distance from the final, sorted list */
+template<typename MakeList>
+double runRuntimeKNN(std::vector<float> &kthDist2,
+                     int k,
+                     const std::vector<float3> &queries,
+                     const std::vector<float3> &points,
+                     int numRepeats,
+                     MakeList &&makeList)
+{
+  const int Q = (int)queries.size();
+  double t0 = getCurrentTime();
+  for (int r=0;r<numRepeats;r++)
+    parallel_for_blocked
+      (0,Q,1024,
+       [&](size_t begin, size_t end) {
+         std::vector<uint64_t> storage(runtimeKStorageSize(k));
+         std::vector<int>      ids(k);
+         std::vector<float>    dist2(k);
+         for (size_t i=begin;i<end;i++) {
+           auto list = makeList(storage.data());
+           knn<float3,float,3>(list,queries[i],points.data(),(int)points.size());
+           list.finish(ids.data(),dist2.data());
+           kthDist2[i] = dist2[k-1];
+         }
+       });
+  double t1 = getCurrentTime();
+  return Q*numRepeats/(t1-t0);
+}
+
+template<int k>
+void compileTimeLists(std::vector<float> &reference,
+                      const std::vector<float3> &queries,
+                      const std::vector<float3> &points,
+                      int numRepeats)
+{
+  const float inf = std::numeric_limits<float>::infinity();
+  std::vector<float> kthDist2(queries.size());
+  double fixed = runKNN(kthDist2,queries,points,numRepeats,
+                        [&](uint64_t *) { return FixedCandidateList<k>(inf); });
+  if (kthDist2 != reference) throw std::runtime_error("fixed list mismatch!?");
+  double heap = runKNN(kthDist2,queries,points,numRepeats,
+                       [&](uint64_t *) { return HeapCandidateList<k>(inf); });
+  if (kthDist2 != reference) throw std::runtime_error("heap list mismatch!?");
+  std::cout << "   (compile-time k: fixed " << prettyDouble(fixed)
+            << ", heap " << prettyDouble(heap) << ")" << std::endl;
+}
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,1000000,10000);
+  std::vector<float3> points = generatePoints<float3>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  buildTree<float3,float>(points.data(),N);
+  const std::vector<float3> queries = generatePoints<float3>(cmdLine.numQueries);
+  const int Q = (int)queries.size();
+  const float inf = std::numeric_limits<float>::infinity();
+
+  std::cout << "queries/s for:      sorted    heap   buffered" << std::endl;
+  for (int k : { 1, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 4096 }) {
+    if (k > N) break;
+    std::vector<float> sorted(Q), heap(Q), buffered(Q);
+    const double qpsHeap
+      = runRuntimeKNN(heap,k,queries,points,cmdLine.numRepeats,
+                      [&](uint64_t *s) { return RuntimeHeapCandidateList(s,k,inf); });
+    const double qpsBuffered
+      = runRuntimeKNN(buffered,k,queries,points,cmdLine.numRepeats,
+                      [&](uint64_t *s) { return BufferedCandidateList(s,k,inf); });
+    // sorted list is quadratic in k, and takes minutes for k=4096
+    const double qpsSorted
+      = k > 512 ? 0.
+      : runRuntimeKNN(sorted,k,queries,points,cmdLine.numRepeats,
+                      [&](uint64_t *s) { return SortedCandidateList(s,k,inf); });
+    if (k > 512) sorted = heap;
+    printf("k=%-5i %12s %8s %8s\n",k,
+           k > 512 ? "-" : prettyDouble(qpsSorted).c_str(),
+           prettyDouble(qpsHeap).c_str(),
+           prettyDouble(qpsBuffered).c_str());
+    if (heap != sorted || buffered != heap)
+      throw std::runtime_error("runtime-k lists disagree!?");
+    if (k == 8)  compileTimeLists<8>(sorted,queries,points,cmdLine.numRepeats);
+    if (k == 64) compileTimeLists<64>(sorted,queries,points,cmdLine.numRepeats);
+  }
+
+  // knnBatch, with a max radius that typically holds fewer than k
+  // points: results must be the same as the first few of an
+  // unbounded query
+  const int k = std::min(N,256);
+  const float maxRadius = powf(100.f/N,1.f/3.f);
+  std::vector<int>   ids(size_t(Q)*k), idsInf(size_t(Q)*k);
+  std::vector<float> dist2(size_t(Q)*k), dist2Inf(size_t(Q)*k);
+  double t0 = getCurrentTime();
+  knnBatch<float3,float,3>(ids.data(),dist2.data(),k,queries.data(),Q,points.data(),N,maxRadius);
+  double t1 = getCurrentTime();
+  std::cout << "knnBatch (k=" << k << ", max radius): "
+            << prettyDouble(Q/(t1-t0)) << " queries/s" << std::endl;
+  knnBatch<float3,float,3>(idsInf.data(),dist2Inf.data(),k,queries.data(),Q,points.data(),N);
+  for (size_t i=0;i<ids.size();i++) {
+    const bool inRadius = dist2Inf[i] <= maxRadius*maxRadius;
+    if (inRadius ? dist2[i] != dist2Inf[i] : ids[i] != -1)
+      throw std::runtime_error("knnBatch with max radius mismatch!?");
+  }
+  std::cout << "knnBatch with max radius matches unbounded queries" << std::endl;
+
+  if (cmdLine.verify) {
+    const int numChecked = std::min(Q,100);
+    for (int i=0;i<numChecked;i++) {
+      std::vector<float> dists;
+      for (int j=0;j<N;j++)
+        dists.push_back(sqrDistance<float3,float,3>(queries[i],points[j]));
+      std::sort(dists.begin(),dists.end());
+      for (int j=0;j<k;j++)
+        if (dist2Inf[size_t(i)*k+j] != dists[j])
+          throw std::runtime_error("knn verification failed ...");
+    }
+    std::cout << "verified " << numChecked << " queries against brute force" << std::endl;
+  }
+}
@@ -0,0 +1,116 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* fcp, knn, and radius queries with each of the metrics in
+   cpukd/metrics.h, verified against brute force */
+
+#include "cpukd/builder.h"
+#include "cpukd/knn.h"
+#include "cpukd/radius.h"
+#include "cpukd/parallel_for.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+#define K 8
+
+template<typename Metric>
+void run(const char *name,
+         const Metric &metric,
+         const std::vector<float3> &points,
+         const std::vector<float3> &queries,
+         const CmdLine &cmdLine)
+{
+  const int N = (int)points.size();
+  const int numQueries = (int)queries.size();
+  std::vector<int> results(numQueries);
+  
+  double t0 = getCurrentTime();
+  for (int r=0;r<cmdLine.numRepeats;r++)
+    parallel_for_blocked
+      (0,numQueries,1024,
+       [&](size_t begin, size_t end) {
+         for (size_t i=begin;i<end;i++)
+           results[i] = fcp<float3,float,3,Metric>(queries[i],points.data(),N,nullptr,metric);
+       });
+  double t1 = getCurrentTime();
+  std::cout << name << ": "
+            << prettyDouble(numQueries*cmdLine.numRepeats/(t1-t0)) << " fcp queries/s" << std::endl;
+
+  if (!cmdLine.verify) return;
+  
+  const int   numChecked = std::min(numQueries,1000);
+  const float radius = .05f;
+  for (int i=0;i<numChecked;i++) {
+    const float *query = (const float *)&queries[i];
+    std::vector<float> dists;
+    int inRadius = 0;
+    for (int j=0;j<N;j++) {
+      dists.push_back(metric.reducedDistance(query,(const float *)&points[j]));
+      if (dists.back() <= metric.toReduced(radius)) ++inRadius;
+    }
+    std::vector<float> sorted = dists;
+    std::sort(sorted.begin(),sorted.end());
+
+    if (dists[results[i]] != sorted[0])
+      throw std::runtime_error(std::string(name)+" fcp verification failed ...");
+    
+    FixedCandidateList<K> result(std::numeric_limits<float>::infinity());
+    knn<float3,float,3,Metric>(result,queries[i],points.data(),N,AcceptAll(),metric);
+    for (int k=0;k<std::min(N,K);k++)
+      if (result.decode_dist2(result.entry[k]) != sorted[k])
+        throw std::runtime_error(std::string(name)+" knn verification failed ...");
+
+    // runtime-k, with the radius as cut-off; k's cover all three
+    // runtime-k lists, and the larger ones get cut by the radius
+    for (int k : { K, 40, 100 }) {
+      std::vector<int>      ids(k);
+      std::vector<float>    dist2(k);
+      std::vector<uint64_t> storage(runtimeKStorageSize(k));
+      const int numFound = knnRuntimeK<float3,float,3,Metric>
+        (ids.data(),dist2.data(),k,storage.data(),queries[i],points.data(),N,
+         radius,AcceptAll(),metric);
+      if (numFound != std::min(k,inRadius))
+        throw std::runtime_error(std::string(name)+" knnRuntimeK verification failed ...");
+      for (int j=0;j<numFound;j++)
+        if (dist2[j] != sorted[j])
+          throw std::runtime_error(std::string(name)+" knnRuntimeK verification failed ...");
+    }
+
+    int found = radiusQuery<float3,float,3,Metric>
+      (queries[i],radius,points.data(),N,[](int,float){},metric);
+    if (found != inRadius)
+      throw std::runtime_error(std::string(name)+" radius query verification failed ...");
+  }
+  std::cout << "  verified " << numChecked << " queries against brute force" << std::endl;
+}
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av);
+  
+  std::vector<float3> points = generatePoints<float3>(cmdLine.numPoints);
+  buildTree<float3,float>(points.data(),(int)points.size());
+  std::vector<float3> queries = generatePoints<float3>(cmdLine.numQueries);
+
+  metrics::WeightedL2<float,3> weighted = {{ 1.f, 4.f, .25f }};
+  run("L2         ",metrics::L2<float,3>(),points,queries,cmdLine);
+  run("weighted L2",weighted,points,queries,cmdLine);
+  run("L1         ",metrics::L1<float,3>(),points,queries,cmdLine);
+  run("LInf       ",metrics::LInf<float,3>(),points,queries,cmdLine);
+}
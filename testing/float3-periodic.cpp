@@ -0,0 +1,114 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* fcp, knn, and radius queries in a periodic [0,1)^3 box, verified
+   against brute force with minimum-image distances */
+
+#include "cpukd/builder.h"
+#include "cpukd/periodic.h"
+#include "cpukd/parallel_for.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+#define K 8
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av);
+  
+  std::vector<float3> points = generatePoints<float3>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  buildTree<float3,float>(points.data(),N);
+
+  periodic::PeriodicBox<float,3> box = {{0.f,0.f,0.f},{1.f,1.f,1.f}};
+
+  // queries in [-.5,1.5)^3, so some of them need wrapping, too
+  std::vector<float3> queries = generatePoints<float3>(cmdLine.numQueries);
+  const int numQueries = (int)queries.size();
+  for (auto &q : queries) {
+    q.x = 2.f*q.x-.5f; q.y = 2.f*q.y-.5f; q.z = 2.f*q.z-.5f;
+  }
+
+  std::vector<int> results(numQueries);
+  {
+    double t0 = getCurrentTime();
+    for (int r=0;r<cmdLine.numRepeats;r++)
+      parallel_for_blocked
+        (0,numQueries,1024,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++)
+             results[i] = periodic::fcp<float3,float,3>(queries[i],box,points.data(),N);
+         });
+    double t1 = getCurrentTime();
+    std::cout << "periodic fcp: "
+              << prettyDouble(numQueries*cmdLine.numRepeats/(t1-t0)) << " queries/s" << std::endl;
+  }
+  std::vector<float> maxRadius2(numQueries);
+  {
+    double t0 = getCurrentTime();
+    parallel_for_blocked
+      (0,numQueries,1024,
+       [&](size_t begin, size_t end) {
+         for (size_t i=begin;i<end;i++) {
+           FixedCandidateList<K> result(std::numeric_limits<float>::infinity());
+           maxRadius2[i] = periodic::knn<float3,float,3>(result,queries[i],box,points.data(),N);
+         }
+       });
+    double t1 = getCurrentTime();
+    std::cout << "periodic knn (k=" << K << "): "
+              << prettyDouble(numQueries/(t1-t0)) << " queries/s" << std::endl;
+  }
+
+  if (cmdLine.verify) {
+    const int numChecked = std::min(numQueries,1000);
+    const float radius = .05f;
+    for (int i=0;i<numChecked;i++) {
+      float3 wrapped = { periodic::wrap(queries[i].x,0,box),
+                         periodic::wrap(queries[i].y,1,box),
+                         periodic::wrap(queries[i].z,2,box) };
+      std::vector<float> dists;
+      int inRadius = 0;
+      for (int j=0;j<N;j++) {
+        dists.push_back(periodic::sqrDistance<float3,float,3>(wrapped,points[j],box));
+        if (dists.back() <= radius*radius) ++inRadius;
+      }
+      std::vector<float> sorted = dists;
+      std::sort(sorted.begin(),sorted.end());
+
+      if (dists[results[i]] != sorted[0])
+        throw std::runtime_error("periodic fcp verification failed ...");
+
+      FixedCandidateList<K> result(std::numeric_limits<float>::infinity());
+      periodic::knn<float3,float,3>(result,queries[i],box,points.data(),N);
+      for (int k=0;k<std::min(N,K);k++)
+        if (result.decode_dist2(result.entry[k]) != sorted[k])
+          throw std::runtime_error("periodic knn verification failed ...");
+
+      int found = periodic::radiusQuery<float3,float,3>
+        (queries[i],radius,box,points.data(),N,
+         [&](int pointID, float dist2) {
+           if (dist2 != dists[pointID] || dist2 > radius*radius)
+             throw std::runtime_error("periodic radius query reported wrong point ...");
+         });
+      if (found != inRadius)
+        throw std::runtime_error("periodic radius query verification failed ...");
+    }
+    std::cout << "verified " << numChecked << " queries against brute force" << std::endl;
+  }
+}
@@ -0,0 +1,109 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* ray/segment proximity queries: all points near random rays and
+   segments, and first point along random rays, checked against brute
+   force */
+
+#include "cpukd/builder.h"
+#include "cpukd/rays.h"
+#include "helpers.h"
+#include <atomic>
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+typedef Ray<float3,float> ray_t;
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,1000000,100000);
+  std::vector<float3> points = generatePoints<float3>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  buildTree<float3,float>(points.data(),N);
+  // about 1 point per unit length of ray, for a domain of [0,1]^3
+  const float radius = sqrtf(1.f/(float(M_PI)*N));
+
+  // half rays (from inside the domain, in random directions), half
+  // segments of random length up to 1
+  std::vector<ray_t> rays(cmdLine.numQueries);
+  const int R = (int)rays.size();
+  for (int i=0;i<R;i++) {
+    rays[i].origin = { (float)drand48(), (float)drand48(), (float)drand48() };
+    float3 dir = { (float)drand48()-.5f, (float)drand48()-.5f, (float)drand48()-.5f };
+    const float len = sqrtf(dir.x*dir.x+dir.y*dir.y+dir.z*dir.z);
+    rays[i].direction = { dir.x/len, dir.y/len, dir.z/len };
+    if (i % 2) rays[i].tMax = (float)drand48();
+  }
+
+  std::vector<int> counts(R);
+  std::atomic<size_t> numFound(0);
+  double t0 = getCurrentTime();
+  pointsNearRayBatch<float3,float,3>(counts.data(),rays.data(),R,radius,points.data(),N,
+                                     [&](int, int, float, float) { numFound++; });
+  double t1 = getCurrentTime();
+  std::cout << "points near ray:   " << prettyDouble(R/(t1-t0)) << " rays/s, "
+            << prettyDouble(numFound/double(R)) << " points/ray" << std::endl;
+
+  std::vector<int>   hits(R);
+  std::vector<float> tHit(R);
+  for (auto &ray : rays) ray.tMax = std::numeric_limits<float>::infinity();
+  double t2 = getCurrentTime();
+  firstPointAlongRayBatch<float3,float,3>(hits.data(),tHit.data(),rays.data(),R,
+                                          radius,points.data(),N);
+  double t3 = getCurrentTime();
+  int numHits = 0;
+  for (int h : hits) numHits += (h >= 0);
+  std::cout << "first along ray:   " << prettyDouble(R/(t3-t2)) << " rays/s, "
+            << prettyDouble(numHits/double(R)) << " hit rate" << std::endl;
+
+  // brute force: the same per-point tests, over all points
+  const int numChecked = cmdLine.verify ? std::min(R,1000) : std::min(R,20);
+  for (int i=0;i<numChecked;i++) {
+    ray_t segment = rays[i];
+    if (i % 2) segment.tMax = .5f;
+    int expected = 0;
+    for (int j=0;j<N;j++) {
+      float t, dist2;
+      rays::closestApproach<float3,float,3>(segment,points[j],t,dist2);
+      t = std::min(std::max(t,segment.tMin),segment.tMax);
+      dist2 = rays::sqrDistanceAt<float3,float,3>(segment,points[j],t);
+      expected += dist2 <= radius*radius;
+    }
+    const int found = pointsNearRay<float3,float,3>(segment,radius,points.data(),N,
+                                                    [](int,float,float){});
+    if (found != expected)
+      throw std::runtime_error("points near ray verification failed ...");
+
+    int   closest  = -1;
+    float closestT = std::numeric_limits<float>::infinity();
+    for (int j=0;j<N;j++) {
+      float t, lineDist2;
+      rays::closestApproach<float3,float,3>(rays[i],points[j],t,lineDist2);
+      if (lineDist2 > radius*radius) continue;
+      const float halfChord = sqrtf(radius*radius-lineDist2);
+      if (t+halfChord < 0.f) continue;
+      const float tEnter = std::max(0.f,t-halfChord);
+      if (tEnter < closestT || (tEnter == closestT && j < closest)) {
+        closest = j; closestT = tEnter;
+      }
+    }
+    if (hits[i] != closest)
+      throw std::runtime_error("first along ray verification failed ...");
+  }
+  std::cout << "verified " << numChecked << " rays against brute force" << std::endl;
+}
@@ -0,0 +1,95 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* many small trees (1K-100K points each, log-uniformly distributed)
+   over one segmented array: segmented::buildTrees() vs a loop over
+   buildTree(), and segmented::fcpBatch() with random per-query trees */
+
+#include "cpukd/builder.h"
+#include "cpukd/segmented.h"
+#include "helpers.h"
+#include <cstring>
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,10000000,1000000);
+
+  // segment sizes, until we have (about) numPoints in total
+  std::vector<int> offsets = { 0 };
+  while (offsets.back() < cmdLine.numPoints) {
+    const int size = int(1000.*pow(100.,drand48()));
+    offsets.push_back(offsets.back()+size);
+  }
+  const int numTrees = (int)offsets.size()-1;
+  const int N = offsets.back();
+  std::cout << "building " << prettyNumber(numTrees) << " trees over "
+            << prettyNumber(N) << " points" << std::endl;
+  const std::vector<float3> input = generatePoints<float3>(N);
+
+  std::vector<float3> points_loop = input;
+  double t0 = getCurrentTime();
+  for (int i=0;i<numTrees;i++)
+    buildTree<float3,float>(points_loop.data()+offsets[i],offsets[i+1]-offsets[i]);
+  double t1 = getCurrentTime();
+  std::cout << "buildTree loop:        " << prettyDouble(t1-t0) << "s" << std::endl;
+
+  std::vector<float3> points = input;
+  double t2 = getCurrentTime();
+  segmented::buildTrees<float3,float>(points.data(),offsets.data(),numTrees);
+  double t3 = getCurrentTime();
+  std::cout << "segmented::buildTrees: " << prettyDouble(t3-t2) << "s" << std::endl;
+
+  for (int i=0;i<N;i++)
+    if (memcmp(&points[i],&points_loop[i],sizeof(float3)))
+      throw std::runtime_error("segmented build does not match per-tree builds!?");
+  std::cout << "all trees match per-tree builds" << std::endl;
+
+  // ------------------------------------------------------------------
+  // queries, each in a random tree
+  // ------------------------------------------------------------------
+  std::vector<float3> queries = generatePoints<float3>(cmdLine.numQueries);
+  const int Q = (int)queries.size();
+  std::vector<int> treeIDs(Q);
+  for (int i=0;i<Q;i++)
+    treeIDs[i] = std::min(numTrees-1,int(drand48()*numTrees));
+  std::vector<int> results(Q);
+  double t4 = getCurrentTime();
+  segmented::fcpBatch<float3,float,3>(results.data(),queries.data(),treeIDs.data(),Q,
+                                      points.data(),offsets.data());
+  double t5 = getCurrentTime();
+  std::cout << "segmented::fcpBatch:   " << prettyDouble(Q/(t5-t4)) << " queries/s" << std::endl;
+
+  for (int i=0;i<Q;i++) {
+    const int begin = offsets[treeIDs[i]], end = offsets[treeIDs[i]+1];
+    if (results[i] < begin || results[i] >= end)
+      throw std::runtime_error("segmented fcp returned point from wrong tree!?");
+  }
+
+  if (cmdLine.verify) {
+    const int numChecked = std::min(Q,1000);
+    for (int i=0;i<numChecked;i++) {
+      float reported = sqrDistance<float3,float,3>(queries[i],points[results[i]]);
+      for (int j=offsets[treeIDs[i]];j<offsets[treeIDs[i]+1];j++)
+        if (sqrDistance<float3,float,3>(queries[i],points[j]) < reported)
+          throw std::runtime_error("segmented fcp verification failed ...");
+    }
+    std::cout << "verified " << numChecked << " queries against brute force" << std::endl;
+  }
+}
@@ -0,0 +1,131 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* sharded forest of 16 shards: in-process fcp/knn/radius queries, and
+   the same queries served by one worker process per shard (from the
+   saved shard files), all checked against a single tree over the same
+   points */
+
+#include "cpukd/builder.h"
+#include "cpukd/fcp.h"
+#include "cpukd/knn.h"
+#include "cpukd/radius.h"
+#include "cpukd/sharded.h"
+#include "cpukd/shardworkers.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+enum { k = 8, depth = 4 };
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,1000000,100000);
+  const std::vector<float3> input = generatePoints<float3>(cmdLine.numPoints);
+  const std::vector<float3> queries = generatePoints<float3>(cmdLine.numQueries);
+  const int N = (int)input.size();
+  const int Q = (int)queries.size();
+  // about 50 points per query
+  const float radius = powf(50.f/N,1.f/3.f);
+
+  std::vector<float3> tree = input;
+  buildTree<float3,float>(tree.data(),N);
+
+  double t0 = getCurrentTime();
+  sharded::ShardedForest<float3,float,3> forest;
+  forest.build(input.data(),N,depth);
+  double t1 = getCurrentTime();
+  std::cout << "built " << forest.router.numShards() << " shards in "
+            << prettyDouble(t1-t0) << "s" << std::endl;
+  // all global IDs refer to the points in shard order
+  std::vector<float3> global;
+  for (auto &shard : forest.shards)
+    global.insert(global.end(),shard.begin(),shard.end());
+
+  // reference results from the single tree
+  std::vector<float> refFCP(Q), refKNN(Q);
+  std::vector<int>   refCount(Q);
+  double t2 = getCurrentTime();
+  parallel_for(Q,[&](int i) {
+    refFCP[i] = sqrDistance<float3,float,3>(queries[i],tree[fcp<float3,float,3>(queries[i],tree.data(),N)]);
+  });
+  double t3 = getCurrentTime();
+  parallel_for(Q,[&](int i) {
+    FixedCandidateList<k> list(std::numeric_limits<float>::infinity());
+    refKNN[i] = knn<float3,float,3>(list,queries[i],tree.data(),N);
+    refCount[i] = radiusQuery<float3,float,3>(queries[i],radius,tree.data(),N,[](int,float){});
+  });
+  std::cout << "single tree fcp:    " << prettyDouble(Q/(t3-t2)) << " queries/s" << std::endl;
+
+  auto check = [&](bool ok, const char *what) {
+    if (!ok) throw std::runtime_error(std::string("sharded ")+what+" does not match single tree!?");
+  };
+
+  // ------------------------------------------------------------------
+  // in-process
+  // ------------------------------------------------------------------
+  std::vector<int> results(Q*k);
+  double t4 = getCurrentTime();
+  parallel_for(Q,[&](int i) { results[i] = forest.fcp(queries[i]); });
+  double t5 = getCurrentTime();
+  std::cout << "in-process fcp:     " << prettyDouble(Q/(t5-t4)) << " queries/s" << std::endl;
+  for (int i=0;i<Q;i++)
+    check(sqrDistance<float3,float,3>(queries[i],global[results[i]]) == refFCP[i],"fcp");
+  parallel_for(Q,[&](int i) {
+    FixedCandidateList<k> list(std::numeric_limits<float>::infinity());
+    check(forest.knn(list,queries[i]) == refKNN[i],"knn");
+    int count = 0;
+    forest.radiusQuery(queries[i],radius,[&](int pointID, float dist2) {
+      check(dist2 == sqrDistance<float3,float,3>(queries[i],global[pointID]),"radius");
+      ++count;
+    });
+    check(count == refCount[i],"radius");
+  });
+  std::cout << "in-process fcp/knn/radius match single tree" << std::endl;
+
+  // ------------------------------------------------------------------
+  // worker processes
+  // ------------------------------------------------------------------
+  const std::string baseName = "/tmp/cpukd_test_sharded";
+  forest.save(baseName);
+  {
+    sharded::ShardWorkerPool<float3,float,3> pool(baseName);
+    double t6 = getCurrentTime();
+    pool.fcpBatch(results.data(),queries.data(),Q);
+    double t7 = getCurrentTime();
+    std::cout << "worker pool fcp:    " << prettyDouble(Q/(t7-t6)) << " queries/s" << std::endl;
+    for (int i=0;i<Q;i++)
+      check(sqrDistance<float3,float,3>(queries[i],global[results[i]]) == refFCP[i],"worker fcp");
+
+    std::vector<float> dist2(Q*k);
+    pool.knnBatch(results.data(),dist2.data(),queries.data(),Q,k);
+    for (int i=0;i<Q;i++)
+      check(dist2[i*k+k-1] == refKNN[i],"worker knn");
+
+    std::vector<int> counts(Q,0);
+    pool.radiusBatch(queries.data(),Q,radius,[&](int queryID, int pointID, float) {
+      check(pointID >= 0 && pointID < N,"worker radius");
+      counts[queryID]++;
+    });
+    check(counts == refCount,"worker radius");
+    std::cout << "worker pool fcp/knn/radius match single tree" << std::endl;
+  }
+  for (int s=0;s<forest.router.numShards();s++)
+    remove(sharded::shardFileName(baseName,s).c_str());
+  remove(sharded::routerFileName(baseName).c_str());
+}
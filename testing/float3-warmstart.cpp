@@ -0,0 +1,83 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* simulates a set of particles that move a little bit every frame,
+   and get re-queried every frame; compares "cold" fcp queries with
+   ones that get last frame's results as hints */
+
+#include "cpukd/builder.h"
+#include "cpukd/batch.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av);
+  const int   numFrames = 10;
+  // per-frame displacement, relative to the [0,1)^3 domain
+  const float displacement = 1e-3f;
+  
+  std::vector<float3> points = generatePoints<float3>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  buildTree<float3,float>(points.data(),N);
+
+  std::vector<float3> particles = generatePoints<float3>(cmdLine.numQueries);
+  const int numQueries = (int)particles.size();
+  std::vector<int> results_cold(numQueries), results_warm(numQueries);
+  fcpBatch<float3,float,3>(results_warm.data(),particles.data(),numQueries,points.data(),N);
+
+  double time_cold = 0., time_warm = 0.;
+  size_t visited_cold = 0, visited_warm = 0;
+  for (int frame=0;frame<numFrames;frame++) {
+    for (auto &p : particles) {
+      p.x += displacement*(2.f*(float)drand48()-1.f);
+      p.y += displacement*(2.f*(float)drand48()-1.f);
+      p.z += displacement*(2.f*(float)drand48()-1.f);
+    }
+
+    for (int i=0;i<std::min(numQueries,10000);i++) {
+      int cold = 0, warm = 0;
+      fcp<float3,float,3>(particles[i],points.data(),N,&cold);
+      fcpWithHint<float3,float,3>(particles[i],results_warm[i],points.data(),N,&warm);
+      visited_cold += cold;
+      visited_warm += warm;
+    }
+    
+    double t0 = getCurrentTime();
+    fcpBatch<float3,float,3>(results_cold.data(),particles.data(),numQueries,points.data(),N);
+    double t1 = getCurrentTime();
+    fcpBatchWithHints<float3,float,3>(results_warm.data(),results_warm.data(),
+                                      particles.data(),numQueries,points.data(),N);
+    double t2 = getCurrentTime();
+    time_cold += t1-t0;
+    time_warm += t2-t1;
+
+    for (int i=0;i<numQueries;i++)
+      if (sqrDistance<float3,float,3>(particles[i],points[results_cold[i]])
+          !=
+          sqrDistance<float3,float,3>(particles[i],points[results_warm[i]]))
+        throw std::runtime_error("warm-start fcp result does not match cold fcp!?");
+  }
+  const double numSampled = numFrames*double(std::min(numQueries,10000));
+  std::cout << "cold: " << prettyDouble(numFrames*numQueries/time_cold) << " queries/s, "
+            << prettyDouble(visited_cold/numSampled) << " nodes visited/query" << std::endl;
+  std::cout << "warm: " << prettyDouble(numFrames*numQueries/time_warm) << " queries/s, "
+            << prettyDouble(visited_warm/numSampled) << " nodes visited/query" << std::endl;
+  std::cout << "warm-start results match cold results" << std::endl;
+}
@@ -0,0 +1,87 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* compares fcp on a regular (one point per node) tree with fcp on
+   bucket trees of various bucket sizes, on float4 data (3 coordinates
+   plus payload in 'w') */
+
+#include "cpukd/builder.h"
+#include "cpukd/bucketed.h"
+#include "cpukd/parallel_for.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,1000000);
+  
+  const std::vector<float4> points = generatePoints<float4>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  std::vector<float4> queries = generatePoints<float4>(cmdLine.numQueries);
+  const int numQueries = (int)queries.size();
+
+  std::vector<float4> tree = points;
+  double t0 = getCurrentTime();
+  buildTree<float4,float,3>(tree.data(),N);
+  double t1 = getCurrentTime();
+  std::vector<int> results(numQueries);
+  double t2 = getCurrentTime();
+  for (int r=0;r<cmdLine.numRepeats;r++)
+    parallel_for_blocked
+      (0,numQueries,1024,
+       [&](size_t begin, size_t end) {
+         for (size_t i=begin;i<end;i++)
+           results[i] = fcp<float4,float,3>(queries[i],tree.data(),N);
+       });
+  double t3 = getCurrentTime();
+  std::cout << "per-point tree: build " << prettyDouble(t1-t0) << "s, "
+            << prettyDouble(numQueries*cmdLine.numRepeats/(t3-t2)) << " queries/s" << std::endl;
+
+  for (int bucketSize : { 4, 8, 16, 32, 64 }) {
+    std::vector<float4> bucketPoints = points;
+    bucketed::BucketTree<float,3> bucketTree;
+    double t0 = getCurrentTime();
+    bucketed::buildTree<float4,float,3>(bucketTree,bucketPoints.data(),N,bucketSize);
+    double t1 = getCurrentTime();
+    std::vector<int> bucketResults(numQueries);
+    double t2 = getCurrentTime();
+    for (int r=0;r<cmdLine.numRepeats;r++)
+      parallel_for_blocked
+        (0,numQueries,1024,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++)
+             bucketResults[i] = bucketed::fcp<float4,float,3>(queries[i],bucketTree);
+         });
+    double t3 = getCurrentTime();
+    int numBuckets = 0;
+    for (int i=0;i<std::min(numQueries,10000);i++)
+      bucketed::fcp<float4,float,3>(queries[i],bucketTree,&numBuckets);
+    std::cout << "B=" << bucketSize << ": build " << prettyDouble(t1-t0) << "s, "
+              << prettyDouble(numQueries*cmdLine.numRepeats/(t3-t2)) << " queries/s, "
+              << prettyDouble(numBuckets/double(std::min(numQueries,10000)))
+              << " buckets visited/query" << std::endl;
+
+    for (int i=0;i<numQueries;i++)
+      if (sqrDistance<float4,float,3>(queries[i],tree[results[i]])
+          !=
+          sqrDistance<float4,float,3>(queries[i],bucketPoints[bucketResults[i]]))
+        throw std::runtime_error("bucket tree fcp does not match regular fcp!?");
+  }
+  std::cout << "all bucket tree results match regular fcp" << std::endl;
+}
@@ -0,0 +1,162 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* SPH-style density estimation over 3D points whose fourth float is
+   their mass: count, mass sum, and kernel sum within a radius, each
+   once through explicit radius enumeration, and once through subtree
+   aggregates */
+
+#include "cpukd/builder.h"
+#include "cpukd/radius.h"
+#include "cpukd/aggregates.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+/*! cubic spline (M4) kernel with support radius h, as a function of
+    squared distance (and without the dimension-dependent normalization) */
+struct CubicSpline {
+  CubicSpline(float h) : rcp_h2(1.f/(h*h)) {}
+  inline float operator()(float dist2) const
+  {
+    const float q = 2.f*sqrtf(dist2*rcp_h2);
+    if (q >= 2.f) return 0.f;
+    if (q >= 1.f) return .25f*(2.f-q)*(2.f-q)*(2.f-q);
+    return 1.f - 1.5f*q*q + .75f*q*q*q;
+  }
+  const float rcp_h2;
+};
+
+template<typename Lambda>
+double measure(const char *name, int numQueries, Lambda &&lambda)
+{
+  double t0 = getCurrentTime();
+  parallel_for_blocked(0,numQueries,1024,
+                       [&](size_t begin, size_t end) {
+                         for (size_t i=begin;i<end;i++) lambda(i);
+                       });
+  double t1 = getCurrentTime();
+  std::cout << "  " << name << ": " << prettyDouble(numQueries/(t1-t0)) << " queries/s" << std::endl;
+  return t1-t0;
+}
+
+void run(const std::vector<float4> &points,
+         const std::vector<SubtreeAggregate<float,3>> &aggregates,
+         const std::vector<float4> &queries,
+         int avgNeighbors,
+         bool verify)
+{
+  const int N = (int)points.size();
+  const int Q = (int)queries.size();
+  const float radius = cbrtf(avgNeighbors/(N*4.f/3.f*float(M_PI)));
+  auto getMass = [](const float4 &p) { return p.w; };
+  CubicSpline kernel(radius);
+  std::cout << "### radius " << radius << " (~" << avgNeighbors << " points per query)" << std::endl;
+
+  std::vector<int>   count_enum(Q),   count_agg(Q);
+  std::vector<float> mass_enum(Q),    mass_agg(Q);
+  std::vector<float> density_enum(Q), density_agg(Q), density_approx(Q);
+  measure("count,   enumeration",Q,[&](size_t i) {
+      count_enum[i] = radiusQuery<float4,float,3>(queries[i],radius,points.data(),N,
+                                                  [](int, float) {});
+    });
+  measure("count,   aggregates ",Q,[&](size_t i) {
+      count_agg[i] = countInRadius<float4,float,3>(queries[i],radius,points.data(),
+                                                   aggregates.data(),N);
+    });
+  measure("mass,    enumeration",Q,[&](size_t i) {
+      float sum = 0.f;
+      radiusQuery<float4,float,3>(queries[i],radius,points.data(),N,
+                                  [&](int pointID, float) { sum += points[pointID].w; });
+      mass_enum[i] = sum;
+    });
+  measure("mass,    aggregates ",Q,[&](size_t i) {
+      mass_agg[i] = weightSumInRadius<float4,float,3>(queries[i],radius,points.data(),
+                                                      aggregates.data(),N,getMass);
+    });
+  measure("density, enumeration",Q,[&](size_t i) {
+      float sum = 0.f;
+      radiusQuery<float4,float,3>(queries[i],radius,points.data(),N,
+                                  [&](int pointID, float dist2)
+                                  { sum += points[pointID].w*kernel(dist2); });
+      density_enum[i] = sum;
+    });
+  measure("density, aggregates ",Q,[&](size_t i) {
+      density_agg[i] = kernelSum<float4,float,3>(queries[i],radius,points.data(),
+                                                 aggregates.data(),N,getMass,kernel);
+    });
+  const float maxKernelError = .01f;
+  measure("density, approximate",Q,[&](size_t i) {
+      density_approx[i] = kernelSum<float4,float,3>(queries[i],radius,points.data(),
+                                                    aggregates.data(),N,getMass,kernel,
+                                                    maxKernelError);
+    });
+
+  // count is exact; sums only differ by summation order
+  double maxApproxError = 0.;
+  for (int i=0;i<Q;i++) {
+    if (count_agg[i] != count_enum[i])
+      throw std::runtime_error("aggregate count does not match radius enumeration!?");
+    if (fabsf(mass_agg[i]-mass_enum[i]) > 1e-4f*(1.f+mass_enum[i]))
+      throw std::runtime_error("aggregate mass does not match radius enumeration!?");
+    if (fabsf(density_agg[i]-density_enum[i]) > 1e-4f*(1.f+density_enum[i]))
+      throw std::runtime_error("aggregate density does not match radius enumeration!?");
+    // all masses are in [0,1), so error is at most maxKernelError*count
+    const float error = fabsf(density_approx[i]-density_enum[i]);
+    if (error > maxKernelError*count_enum[i]+1e-4f*(1.f+density_enum[i]))
+      throw std::runtime_error("approximate density exceeds error bound!?");
+    maxApproxError = std::max(maxApproxError,double(error/(1e-6f+density_enum[i])));
+  }
+  std::cout << "  all results match enumeration; max relative error of approximation "
+            << prettyDouble(maxApproxError) << std::endl;
+
+  if (verify) {
+    const int numChecked = std::min(Q,1000);
+    for (int i=0;i<numChecked;i++) {
+      int count = 0;
+      for (int j=0;j<N;j++)
+        if (sqrDistance<float4,float,3>(queries[i],points[j]) <= radius*radius)
+          ++count;
+      if (count != count_agg[i])
+        throw std::runtime_error("aggregate count verification failed ...");
+    }
+    std::cout << "  verified " << numChecked << " counts against brute force" << std::endl;
+  }
+}
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,1000000,100000);
+
+  std::vector<float4> points = generatePoints<float4>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  double t0 = getCurrentTime();
+  buildTree<float4,float,3>(points.data(),N);
+  double t1 = getCurrentTime();
+  std::vector<SubtreeAggregate<float,3>> aggregates(N);
+  computeAggregates<float4,float,3>(aggregates.data(),points.data(),N,
+                                    [](const float4 &p) { return p.w; });
+  double t2 = getCurrentTime();
+  std::cout << "tree build " << prettyDouble(t1-t0) << "s, aggregates "
+            << prettyDouble(t2-t1) << "s (" << prettyBytes(N*sizeof(aggregates[0])) << ")"
+            << std::endl;
+
+  std::vector<float4> queries = generatePoints<float4>(cmdLine.numQueries);
+  for (int avgNeighbors : { 50, 500, 5000 })
+    run(points,aggregates,queries,avgNeighbors,cmdLine.verify);
+}
@@ -15,9 +15,11 @@
 // ======================================================================== //
 
 #include "cpukd/builder.h"
-#include "parallel_for.h"
+#include "cpukd/parallel_for.h"
 // fcp = "find closest point" query
 #include "cpukd/fcp.h"
+#include "cpukd/reference.h"
+#include "cpukd/validate.h"
 
 using namespace cpukd;
 
@@ -95,42 +97,6 @@ void fcp(int *d_results,
      });
 }
 
-bool noneBelow(float4 *d_points, int N, int curr, int dim, float value)
-{
-  if (curr >= N) return true;
-  return
-    ((&d_points[curr].x)[dim] >= value)
-    && noneBelow(d_points,N,2*curr+1,dim,value)
-    && noneBelow(d_points,N,2*curr+2,dim,value);
-}
-
-bool noneAbove(float4 *d_points, int N, int curr, int dim, float value)
-{
-  if (curr >= N) return true;
-  return
-    ((&d_points[curr].x)[dim] <= value)
-    && noneAbove(d_points,N,2*curr+1,dim,value)
-    && noneAbove(d_points,N,2*curr+2,dim,value);
-}
-
-bool checkTree(float4 *d_points, int N, int curr=0)
-{
-  if (curr >= N) return true;
-
-  int dim = cpukd::levelOf(curr)%4;
-  float value = (&d_points[curr].x)[dim];
-  
-  if (!noneAbove(d_points,N,2*curr+1,dim,value))
-    return false;
-  if (!noneBelow(d_points,N,2*curr+2,dim,value))
-    return false;
-  
-  return
-    checkTree(d_points,N,2*curr+1)
-    &&
-    checkTree(d_points,N,2*curr+2);
-}
-
 int main(int ac, const char **av)
 {
   using namespace cpukd::common;
@@ -138,6 +104,7 @@ int main(int ac, const char **av)
   int nPoints = 173;
   bool verify = false;
   int nRepeats = 1;
+  std::string statsBaseName;
   for (int i=1;i<ac;i++) {
     std::string arg = av[i];
     if (arg[0] != '-')
@@ -146,6 +113,8 @@ int main(int ac, const char **av)
       verify = true;
     else if (arg == "-nr")
       nRepeats = atoi(av[++i]);
+    else if (arg == "-stats")
+      statsBaseName = av[++i];
     else
       throw std::runtime_error("known cmdline arg "+arg);
   }
@@ -153,17 +122,31 @@ int main(int ac, const char **av)
   float4 *d_points = generatePoints(nPoints);
 
   {
+    // only record build stats if asked to; the default build path
+    // does not record anything
+    std::unique_ptr<cpukd::BuildStats> stats;
+    if (!statsBaseName.empty()) stats.reset(new cpukd::BuildStats);
     double t0 = getCurrentTime();
     std::cout << "calling builder..." << std::endl;
-    cpukd::buildTree<float4,float>(d_points,nPoints);
+    cpukd::buildTree<float4,float>(d_points,nPoints,nullptr,stats.get());
     double t1 = getCurrentTime();
     std::cout << "done building tree, took " << prettyDouble(t1-t0) << "s" << std::endl;
+    if (stats) {
+      for (size_t l=0;l<stats->levels.size();l++)
+        std::cout << "  level " << l << ": " << prettyDouble(stats->levels[l].seconds) << "s, "
+                  << prettyNumber(stats->levels[l].bytesMoved) << "B" << std::endl;
+      stats->saveJSON(statsBaseName+".json");
+      stats->saveChromeTrace(statsBaseName+".trace.json");
+      std::cout << "build stats written to " << statsBaseName << ".json and "
+                << statsBaseName << ".trace.json" << std::endl;
+    }
   }
 
   if (verify) {
     std::cout << "checking tree..." << std::endl;
-    if (!checkTree(d_points,nPoints))
-      throw std::runtime_error("not a valid kd-tree!?");
+    const int badNode = cpukd::validateTree<float4,float>(d_points,nPoints);
+    if (badNode >= 0)
+      throw std::runtime_error("not a valid kd-tree (at node "+std::to_string(badNode)+")!?");
     else
       std::cout << "... passed" << std::endl;
   }
@@ -182,29 +165,35 @@ int main(int ac, const char **av)
   }
   
   if (verify) {
-    std::cout << "verifying ..." << std::endl;
-    for (int i=0;i<nQueries;i++) {
-      if (d_results[i] == -1) continue;
-      
-      float4 qp = d_queries[i];
-      float reportedDist = distance(qp,d_points[d_results[i]]);
-      for (int j=0;j<nPoints;j++) {
-        float dist_j = distance(qp,d_points[j]);
-        if (dist_j < reportedDist) {
-          printf("for query %i: found offending point %i (%f %f %f %f) with dist %f (vs %f)\n",
-                 i,
-                 j,
-                 d_points[j].x,
-                 d_points[j].y,
-                 d_points[j].z,
-                 d_points[j].w,
-                 dist_j,
-                 reportedDist);
-          
-          throw std::runtime_error("verification failed ...");
-        }
+    // brute force over all 10M queries would take forever; check an
+    // evenly spaced sample of them
+    const int numSamples = std::min<int>(nQueries,10000);
+    std::cout << "verifying " << numSamples << " sampled queries ..." << std::endl;
+    const cpukd::reference::BruteForce<float4,float,4> reference(d_points,nPoints);
+    cpukd::common::parallel_for(numSamples,[&](int s) {
+      const int i = int(s*(nQueries/numSamples));
+      const float4 qp = d_queries[i];
+      float refDist2;
+      const int refID = reference.fcp(qp,&refDist2);
+      if (refID < 0 && d_results[i] == -1) return;
+      const float reportedDist2
+        = d_results[i] < 0
+        ? std::numeric_limits<float>::infinity()
+        : cpukd::sqrDistance<float4,float,4>(qp,d_points[d_results[i]]);
+      if (refDist2 < reportedDist2) {
+        printf("for query %i: found offending point %i (%f %f %f %f) with dist %f (vs %f)\n",
+               i,
+               refID,
+               d_points[refID].x,
+               d_points[refID].y,
+               d_points[refID].z,
+               d_points[refID].w,
+               sqrtf(refDist2),
+               sqrtf(reportedDist2));
+
+        throw std::runtime_error("verification failed ...");
       }
-    }
+    });
     std::cout << "verification succeeded... done." << std::endl;
   }
 }
@@ -0,0 +1,132 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* "closest point with a different label" queries on float4 data
+   (3D points, with an integer label stored in float4::w): filtered
+   fcp, vs. over-sampled knn with post-filtering */
+
+#include "cpukd/builder.h"
+#include "cpukd/filtered.h"
+#include "cpukd/parallel_for.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+#define K 32
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av);
+  // with L labels, (L-1)/L of all points are acceptable
+  const int numLabels = 2;
+  
+  std::vector<float4> points = generatePoints<float4>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  for (auto &p : points) p.w = float(int(p.w*numLabels));
+  buildTree<float4,float,3>(points.data(),N);
+
+  std::vector<float4> queries = generatePoints<float4>(cmdLine.numQueries);
+  const int numQueries = (int)queries.size();
+  for (auto &q : queries) q.w = float(int(q.w*numLabels));
+
+  std::vector<int> results_filtered(numQueries), results_knn(numQueries);
+  {
+    double t0 = getCurrentTime();
+    for (int r=0;r<cmdLine.numRepeats;r++)
+      parallel_for_blocked
+        (0,numQueries,1024,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++) {
+             const float4 query = queries[i];
+             results_filtered[i] = filtered::fcp<float4,float,3>
+               (query,points.data(),N,
+                [&](int, const float4 &point) { return point.w != query.w; });
+           }
+         });
+    double t1 = getCurrentTime();
+    std::cout << "filtered fcp:              "
+              << prettyDouble(numQueries*cmdLine.numRepeats/(t1-t0)) << " queries/s" << std::endl;
+  }
+  size_t numMissed = 0;
+  {
+    double t0 = getCurrentTime();
+    for (int r=0;r<cmdLine.numRepeats;r++)
+      parallel_for_blocked
+        (0,numQueries,1024,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++) {
+             FixedCandidateList<K> result(std::numeric_limits<float>::infinity());
+             knn<float4,float,3>(result,queries[i],points.data(),N);
+             results_knn[i] = -1;
+             for (int k=0;k<K;k++) {
+               int pointID = result.decode_pointID(result.entry[k]);
+               if (pointID >= 0 && points[pointID].w != queries[i].w) {
+                 results_knn[i] = pointID;
+                 break;
+               }
+             }
+           }
+         });
+    double t1 = getCurrentTime();
+    for (auto r : results_knn) if (r < 0) ++numMissed;
+    std::cout << "knn (k=" << K << ") + post-filter: "
+              << prettyDouble(numQueries*cmdLine.numRepeats/(t1-t0)) << " queries/s"
+              << " (" << numMissed << " queries found no acceptable point)" << std::endl;
+  }
+
+  for (int i=0;i<numQueries;i++) {
+    if (results_knn[i] < 0) continue;
+    if (sqrDistance<float4,float,3>(queries[i],points[results_knn[i]])
+        !=
+        sqrDistance<float4,float,3>(queries[i],points[results_filtered[i]]))
+      throw std::runtime_error("filtered fcp does not match post-filtered knn!?");
+  }
+  
+  if (cmdLine.verify) {
+    const int numChecked = std::min(numQueries,1000);
+    const float radius = .05f;
+    for (int i=0;i<numChecked;i++) {
+      const float4 query = queries[i];
+      auto accept = [&](int, const float4 &point) { return point.w != query.w; };
+      std::vector<float> dists;
+      int inRadius = 0;
+      for (int j=0;j<N;j++) {
+        if (!accept(j,points[j])) continue;
+        dists.push_back(sqrDistance<float4,float,3>(query,points[j]));
+        if (dists.back() <= radius*radius) ++inRadius;
+      }
+      std::sort(dists.begin(),dists.end());
+
+      if (points[results_filtered[i]].w == query.w ||
+          sqrDistance<float4,float,3>(query,points[results_filtered[i]]) != dists[0])
+        throw std::runtime_error("filtered fcp verification failed ...");
+      
+      FixedCandidateList<8> result(std::numeric_limits<float>::infinity());
+      filtered::knn<float4,float,3>(result,query,points.data(),N,accept);
+      for (int k=0;k<std::min((int)dists.size(),8);k++)
+        if (result.decode_dist2(result.entry[k]) != dists[k])
+          throw std::runtime_error("filtered knn verification failed ...");
+
+      int found = filtered::radiusQuery<float4,float,3>
+        (query,radius,points.data(),N,accept,[](int,float){});
+      if (found != inRadius)
+        throw std::runtime_error("filtered radius query verification failed ...");
+    }
+    std::cout << "verified " << numChecked << " queries against brute force" << std::endl;
+  }
+}
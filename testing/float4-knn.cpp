@@ -0,0 +1,92 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* knn and radius queries on float4 data */
+
+#include "cpukd/builder.h"
+#include "cpukd/knn.h"
+#include "cpukd/radius.h"
+#include "cpukd/parallel_for.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+#define K 8
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av);
+  
+  std::vector<float4> points = generatePoints<float4>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  buildTree<float4,float>(points.data(),N);
+
+  std::vector<float4> queries = generatePoints<float4>(cmdLine.numQueries);
+  const int numQueries = (int)queries.size();
+  std::vector<float> maxRadius2(numQueries);
+  {
+    double t0 = getCurrentTime();
+    for (int r=0;r<cmdLine.numRepeats;r++)
+      parallel_for_blocked
+        (0,numQueries,1024,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++) {
+             FixedCandidateList<K> result(std::numeric_limits<float>::infinity());
+             maxRadius2[i] = knn<float4,float,4>(result,queries[i],points.data(),N);
+           }
+         });
+    double t1 = getCurrentTime();
+    std::cout << "knn (k=" << K << "): "
+              << prettyDouble(numQueries*cmdLine.numRepeats/(t1-t0)) << " queries/s" << std::endl;
+  }
+
+  // radius query with each query's k-th neighbor distance must find
+  // (at least, in case of ties) k points; pad radius a bit so
+  // sqrt-then-square rounding doesn't drop the k-th point
+  size_t numFound = 0;
+  {
+    double t0 = getCurrentTime();
+    for (int i=0;i<numQueries;i++) {
+      int found = radiusQuery<float4,float,4>
+        (queries[i],sqrtf(maxRadius2[i])*1.0001f,points.data(),N,[](int,float){});
+      if (N >= K && found < K)
+        throw std::runtime_error("radius query missed some of the knn points!?");
+      numFound += found;
+    }
+    double t1 = getCurrentTime();
+    std::cout << "radius: "
+              << prettyDouble(numQueries/(t1-t0)) << " queries/s, "
+              << prettyDouble(numFound/double(numQueries)) << " points/query" << std::endl;
+  }
+
+  if (cmdLine.verify) {
+    const int numChecked = std::min(numQueries,1000);
+    for (int i=0;i<numChecked;i++) {
+      FixedCandidateList<K> result(std::numeric_limits<float>::infinity());
+      knn<float4,float,4>(result,queries[i],points.data(),N);
+      std::vector<float> dists;
+      for (int j=0;j<N;j++)
+        dists.push_back(sqrDistance<float4,float,4>(queries[i],points[j]));
+      std::sort(dists.begin(),dists.end());
+      for (int k=0;k<std::min(N,K);k++)
+        if (result.decode_dist2(result.entry[k]) != dists[k])
+          throw std::runtime_error("knn verification failed ...");
+    }
+    std::cout << "verified " << numChecked << " queries against brute force" << std::endl;
+  }
+}
@@ -0,0 +1,136 @@
+// ======================================================================== //
+// Copyright 2022-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* load+build times from point files, for float4 points (x,y,z, plus
+   one payload value). With '-f <file>', loads that file (format by
+   extension, see cpukd/loader.h); else, writes random points to
+   temporary raw, xyz, and ply files, and checks that loading them
+   reproduces the original points */
+
+#include "cpukd/builder.h"
+#include "cpukd/loader.h"
+#include "helpers.h"
+#include <fstream>
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+void loadAndBuild(std::vector<float4> &points, const std::string &fileName)
+{
+  double t0 = getCurrentTime();
+  loader::loadPoints<float4,float>(points,fileName);
+  double t1 = getCurrentTime();
+  buildTree<float4,float,3>(points.data(),(int)points.size());
+  double t2 = getCurrentTime();
+  std::ifstream in(fileName,std::ios::binary|std::ios::ate);
+  const size_t fileSize = (size_t)in.tellg();
+  std::cout << fileName << ": " << prettyNumber(points.size()) << " points, "
+            << "load " << prettyDouble(t1-t0) << "s ("
+            << prettyBytes(fileSize/(t1-t0)) << "/s), build "
+            << prettyDouble(t2-t1) << "s, total " << prettyDouble(t2-t0) << "s"
+            << std::endl;
+}
+
+void writeFiles(const std::vector<float4> &points, const std::string &base)
+{
+  std::ofstream raw(base+".raw",std::ios::binary);
+  raw.write((const char *)points.data(),points.size()*sizeof(float4));
+
+  FILE *xyz = fopen((base+".xyz").c_str(),"w");
+  fprintf(xyz,"# x y z intensity\n");
+  for (auto &p : points)
+    fprintf(xyz,"%.9g %.9g %.9g %.9g\n",p.x,p.y,p.z,p.w);
+  fclose(xyz);
+
+  // vertices with an extra property in the middle, and a double
+  // coordinate, to exercise the property lookup
+  std::ofstream ply(base+".ply",std::ios::binary);
+  ply << "ply\nformat binary_little_endian 1.0\ncomment written by cpukd\n"
+      << "element vertex " << points.size() << "\n"
+      << "property float x\nproperty uchar red\nproperty float y\n"
+      << "property double z\nproperty float intensity\nend_header\n";
+  for (auto &p : points) {
+    const unsigned char red = 255;
+    const double z = p.z;
+    ply.write((const char *)&p.x,4);
+    ply.write((const char *)&red,1);
+    ply.write((const char *)&p.y,4);
+    ply.write((const char *)&z,8);
+    ply.write((const char *)&p.w,4);
+  }
+}
+
+int main(int ac, const char **av)
+{
+  std::string fileName;
+  std::vector<const char *> args = { av[0] };
+  for (int i=1;i<ac;i++)
+    if (std::string(av[i]) == "-f") fileName = av[++i];
+    else args.push_back(av[i]);
+  CmdLine cmdLine((int)args.size(),args.data(),1000000);
+
+  std::vector<float4> points;
+  if (!fileName.empty()) {
+    loadAndBuild(points,fileName);
+    return 0;
+  }
+
+  const std::vector<float4> original = generatePoints<float4>(cmdLine.numPoints);
+  const std::string base = "/tmp/cpukd-loader-test";
+  writeFiles(original,base);
+  for (auto ext : { ".raw", ".xyz" }) {
+    loader::loadPoints<float4,float>(points,base+ext);
+    for (size_t i=0;i<original.size();i++)
+      if (memcmp(&points[i],&original[i],sizeof(float4)))
+        throw std::runtime_error(std::string("loaded ")+ext+" points do not match original!?");
+    loadAndBuild(points,base+ext);
+  }
+  loader::loadPLY<float4,float>(points,base+".ply",{ "x","y","z","intensity" });
+  for (size_t i=0;i<original.size();i++)
+    if (memcmp(&points[i],&original[i],sizeof(float4)))
+      throw std::runtime_error("loaded .ply points do not match original!?");
+  loadAndBuild(points,base+".ply");
+  std::cout << "all loaded files match original points" << std::endl;
+
+  // malformed and truncated files must throw, rather than load zeros
+  auto expectThrow = [&](const std::string &file, const std::string &expected) {
+    try {
+      loader::loadPoints<float4,float>(points,file);
+    } catch (const std::runtime_error &e) {
+      if (std::string(e.what()).find(expected) != std::string::npos) return;
+      throw std::runtime_error("unexpected error loading "+file+": "+e.what());
+    }
+    throw std::runtime_error("loading "+file+" did not throw!?");
+  };
+  {
+    std::ofstream bad(base+".bad.xyz");
+    bad << "# x y z\n1 2 3\n\n4 5x 6\n";
+  }
+  expectThrow(base+".bad.xyz","line 4");
+  {
+    std::ofstream bad(base+".bad.ply",std::ios::binary);
+    bad << "ply\nformat binary_little_endian 1.0\n"
+        << "element face 1000000000000\nproperty int id\n"
+        << "element vertex 1\nproperty float x\nend_header\n";
+  }
+  expectThrow(base+".bad.ply","truncated");
+  std::cout << "malformed files get rejected" << std::endl;
+  remove((base+".bad.xyz").c_str());
+  remove((base+".bad.ply").c_str());
+  for (auto ext : { ".raw", ".xyz", ".ply" })
+    remove((base+ext).c_str());
+}
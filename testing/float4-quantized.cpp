@@ -0,0 +1,94 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* compares fcp on full-precision float4 data (3 coordinates plus
+   payload in 'w') with fcp on a 16-bit quantized mirror of the same
+   tree */
+
+#include "cpukd/builder.h"
+#include "cpukd/quantized.h"
+#include "cpukd/parallel_for.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,1000000);
+  
+  std::vector<float4> points = generatePoints<float4>(cmdLine.numPoints);
+  const int N = (int)points.size();
+  buildTree<float4,float,3>(points.data(),N);
+
+  std::vector<quantized::QuantizedPoint<3>> quantizedPoints(N);
+  quantized::QuantizedDomain<float,3> domain
+    = quantized::quantizeTree<float4,float,3>(quantizedPoints.data(),points.data(),N);
+  std::cout << "memory: "
+            << prettyBytes(N*sizeof(float4)) << " full precision, "
+            << prettyBytes(N*sizeof(quantized::QuantizedPoint<3>)) << " quantized" << std::endl;
+  
+  std::vector<float4> queries = generatePoints<float4>(cmdLine.numQueries);
+  const int numQueries = (int)queries.size();
+  std::vector<int> results(numQueries), results_quantized(numQueries);
+  {
+    double t0 = getCurrentTime();
+    for (int r=0;r<cmdLine.numRepeats;r++)
+      parallel_for_blocked
+        (0,numQueries,1024,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++)
+             results[i] = cpukd::fcp<float4,float,3>(queries[i],points.data(),N);
+         });
+    double t1 = getCurrentTime();
+    std::cout << "full precision: "
+              << prettyDouble(numQueries*cmdLine.numRepeats/(t1-t0)) << " queries/s" << std::endl;
+  }
+  {
+    double t0 = getCurrentTime();
+    for (int r=0;r<cmdLine.numRepeats;r++)
+      parallel_for_blocked
+        (0,numQueries,1024,
+         [&](size_t begin, size_t end) {
+           for (size_t i=begin;i<end;i++)
+             results_quantized[i]
+               = quantized::fcp<float4,float,3>(queries[i],domain,quantizedPoints.data(),
+                                                points.data(),N);
+         });
+    double t1 = getCurrentTime();
+    std::cout << "quantized     : "
+              << prettyDouble(numQueries*cmdLine.numRepeats/(t1-t0)) << " queries/s" << std::endl;
+  }
+
+  size_t numRefined = 0;
+  for (int i=0;i<std::min(numQueries,100000);i++) {
+    int refined = 0;
+    quantized::fcp<float4,float,3>(queries[i],domain,quantizedPoints.data(),
+                                   points.data(),N,&refined);
+    numRefined += refined;
+  }
+  std::cout << "full-precision points fetched per query: "
+            << prettyDouble(numRefined/double(std::min(numQueries,100000))) << std::endl;
+
+  for (int i=0;i<numQueries;i++) {
+    float d_full  = sqrDistance<float4,float,3>(queries[i],points[results[i]]);
+    float d_quant = sqrDistance<float4,float,3>(queries[i],points[results_quantized[i]]);
+    if (d_full != d_quant)
+      throw std::runtime_error("quantized fcp result does not match full-precision fcp!?");
+  }
+  std::cout << "quantized results match full-precision results" << std::endl;
+}
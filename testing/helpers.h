@@ -0,0 +1,83 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* helper types and functions shared by the various test/benchmark
+   drivers in this directory */
+
+#pragma once
+
+#include "cpukd/common.h"
+#include <vector>
+
+namespace cpukd {
+  namespace testing {
+
+    /*! a simple point type of N floats, for testing dimensionalities
+        that don't have a native vector type */
+    template<int N>
+    struct floatN { float v[N]; };
+
+    struct float3 { float x, y, z; };
+    struct float4 { float x, y, z, w; };
+
+    /*! generate N uniformly random points in [0,1)^D, where D is the
+        number of floats in point_t (payload members, if any, are
+        filled with random values, too) */
+    template<typename point_t>
+    std::vector<point_t> generatePoints(size_t N)
+    {
+      std::cout << "generating " << common::prettyNumber(N) <<  " points" << std::endl;
+      std::vector<point_t> points(N);
+      for (size_t i=0;i<N;i++) {
+        float *p = (float *)&points[i];
+        for (size_t d=0;d<sizeof(point_t)/sizeof(float);d++)
+          p[d] = (float)drand48();
+      }
+      return points;
+    }
+
+    /*! parses the cmdline args shared by most test drivers: '<numPoints>',
+        '-nq <numQueries>', '-nr <numRepeats>', and '-v' (verify) */
+    struct CmdLine {
+      CmdLine(int ac, const char **av,
+              int defaultNumPoints=100000,
+              int defaultNumQueries=1000000)
+        : numPoints(defaultNumPoints),
+          numQueries(defaultNumQueries)
+      {
+        for (int i=1;i<ac;i++) {
+          std::string arg = av[i];
+          if (arg[0] != '-')
+            numPoints = std::stoi(arg);
+          else if (arg == "-v")
+            verify = true;
+          else if (arg == "-nq")
+            numQueries = std::stoi(av[++i]);
+          else if (arg == "-nr")
+            numRepeats = std::stoi(av[++i]);
+          else
+            throw std::runtime_error("unknown cmdline arg "+arg);
+        }
+      }
+
+      int  numPoints;
+      int  numQueries;
+      int  numRepeats = 1;
+      bool verify     = false;
+    };
+
+  } // ::cpukd::testing
+} // ::cpukd
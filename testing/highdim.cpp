@@ -0,0 +1,106 @@
+// ======================================================================== //
+// Copyright 2018-2022 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/* fcp on 8, 32, and 128-dimensional data: regular fcp, vs high-dim
+   fcp (early-exit distance kernel) on round-robin and widest-dim
+   trees, vs brute force. Data is "embedding-like", with the extent of
+   dimension d falling off as 1/(1+d/4) */
+
+#include "cpukd/highdim.h"
+#include "cpukd/parallel_for.h"
+#include "helpers.h"
+
+using namespace cpukd;
+using namespace cpukd::common;
+using namespace cpukd::testing;
+
+template<int numDims, typename QueryFunction>
+void measure(const char *name,
+             std::vector<int> &results,
+             const std::vector<floatN<numDims>> &queries,
+             const QueryFunction &query)
+{
+  const int numQueries = (int)queries.size();
+  double t0 = getCurrentTime();
+  parallel_for_blocked
+    (0,numQueries,16,
+     [&](size_t begin, size_t end) {
+       for (size_t i=begin;i<end;i++)
+         results[i] = query(queries[i]);
+     });
+  double t1 = getCurrentTime();
+  std::cout << "  " << name << ": "
+            << prettyDouble(numQueries/(t1-t0)) << " queries/s" << std::endl;
+}
+
+template<int numDims>
+void run(const CmdLine &cmdLine)
+{
+  typedef floatN<numDims> point_t;
+  std::cout << "### " << numDims << "D data" << std::endl;
+  std::vector<point_t> points  = generatePoints<point_t>(cmdLine.numPoints);
+  std::vector<point_t> queries = generatePoints<point_t>(cmdLine.numQueries);
+  for (auto *pts : { &points, &queries })
+    for (auto &p : *pts)
+      for (int d=0;d<numDims;d++)
+        p.v[d] *= 1.f/(1.f+d/4.f);
+  const int N = (int)points.size();
+  const int numQueries = (int)queries.size();
+
+  std::vector<point_t> roundRobin = points;
+  buildTree<point_t,float,numDims>(roundRobin.data(),N);
+  std::vector<point_t> widest = points;
+  std::vector<int> splitDims = highdim::chooseSplitDims<point_t,float,numDims>(points.data(),N);
+  buildTree<point_t,float,numDims>(widest.data(),N,splitDims.data());
+  
+  std::vector<int> results_regular(numQueries), results_rr(numQueries),
+    results_widest(numQueries), results_bf(numQueries);
+  measure<numDims>("regular fcp              ",results_regular,queries,
+                   [&](const point_t &q)
+                   { return fcp<point_t,float,numDims>(q,roundRobin.data(),N); });
+  measure<numDims>("high-dim fcp, round-robin",results_rr,queries,
+                   [&](const point_t &q)
+                   { return highdim::fcp<point_t,float,numDims>(q,roundRobin.data(),N,nullptr); });
+  measure<numDims>("high-dim fcp, widest dims",results_widest,queries,
+                   [&](const point_t &q)
+                   { return highdim::fcp<point_t,float,numDims>
+                       (q,widest.data(),N,splitDims.data()); });
+  measure<numDims>("brute force              ",results_bf,queries,
+                   [&](const point_t &q)
+                   { return highdim::bruteForceFCP<point_t,float,numDims>(q,points.data(),N); });
+
+  const float inf = std::numeric_limits<float>::infinity();
+  for (int i=0;i<numQueries;i++) {
+    const float *q = (const float *)&queries[i];
+    const float d_bf = highdim::sqrDistanceBounded<float,numDims>
+      (q,(const float*)&points[results_bf[i]],inf);
+    const float d_rr = highdim::sqrDistanceBounded<float,numDims>
+      (q,(const float*)&roundRobin[results_rr[i]],inf);
+    const float d_widest = highdim::sqrDistanceBounded<float,numDims>
+      (q,(const float*)&widest[results_widest[i]],inf);
+    if (d_rr != d_bf || d_widest != d_bf)
+      throw std::runtime_error("high-dim fcp does not match brute force!?");
+  }
+  std::cout << "  all high-dim fcp results match brute force" << std::endl;
+}
+
+int main(int ac, const char **av)
+{
+  CmdLine cmdLine(ac,av,100000,2000);
+  run<8>(cmdLine);
+  run<32>(cmdLine);
+  run<128>(cmdLine);
+}